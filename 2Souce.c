@@ -1,17 +1,147 @@
-﻿#include <stdio.h>
+﻿#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <locale.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "windrose.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+typedef HANDLE thread_handle;
+typedef CRITICAL_SECTION mutex_handle;
+typedef CONDITION_VARIABLE cond_handle;
+#define THREAD_FUNC DWORD WINAPI
+#define THREAD_RETURN 0
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+typedef pthread_t thread_handle;
+typedef pthread_mutex_t mutex_handle;
+typedef pthread_cond_t cond_handle;
+#define THREAD_FUNC void*
+#define THREAD_RETURN NULL
+#define THREAD_LOCAL _Thread_local
+#endif
+
+/*
+* Замер тактов по этапам генерации включается при сборке с GEN_PROFILE
+* (cmake -DGEN_PROFILE=ON); без него макросы ничего не делают
+*/
+#ifdef GEN_PROFILE
+#define PROFILE_START(start) unsigned long long start = read_cycles()
+#define PROFILE_STOP(start, stage) (gen_stats.stage += read_cycles() - (start))
+#else
+#define PROFILE_START(start) ((void)0)
+#define PROFILE_STOP(start, stage) ((void)0)
+#endif
+
+/*
+* Функции попытки генерации, которые встраиваются в ядра generate_puzzle_RxC
+* всегда, чтобы размеры поля стали в них постоянными
+*/
+#ifdef _MSC_VER
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
 
+#define BORDER -3
 #define EMPTY -2
 #define BLACK -1
 #define WHITE 0
 #define MAX_ATTEMPTS 100000000
 
-#define MIN_FIELD_SIZE 3
+#define MIN_FIELD_SIZE WINDROSE_MIN_SIZE
 #define MAX_FIELD_SIZE 12
+#define LARGE_MAX_SIZE WINDROSE_MAX_SIZE
+#define TILE_SIZE 8
+#define TILE_MAX_TRIES 100000
+#define TILE_CONTEXT_TRIES 20
+#define TILE_MAX_ROUNDS 64
+#define TILE_STRIKES 2
 #define DEFAULT_FILENAME_LEN 64
+#define BATCH_OUTPUT_BUFFER (1 << 20)
+#define BATCH_QUEUE_MIN 16
+#define BATCH_STOP_CHECK 4096
+#define BATCH_UNLIMITED LLONG_MAX
+#define WAIT_SLICE_MS 200
+#define PROGRESS_INTERVAL 1.0
+#define PREFETCH_QUEUE 4
+#define PREFETCH_DEFAULT_BUDGET 60.0
+#define SOLUTION_LIMIT 2
+#define REPAIR_MAX_CELLS 8
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_DEFAULT_BUDGET 1.0
+#define BENCH_BOARDS 256
+#define BENCH_REPEAT 64
+#define DENSITY_FILENAME "density.txt"
+#define TUNE_DEFAULT_SEED 1
+#define TUNE_DEFAULT_BUDGET 2.0
+#define TUNE_KEEP 4
+#define ARENA_ALIGN 16
+#define HASH_SET_MIN 1024
+#define LIBRARY_MAGIC "WRLB"
+#define LIBRARY_VERSION 1
+#define VALIDATE_CHUNK 64
+#define VALIDATE_LIST 10
+#define DEDUP_MAX_STREAK 100000
+#define SPLIT_THRESHOLD 2000
+#define SPLIT_POLL 16
+#define SERVE_DEFAULT_DEPTH 16
+#define SERVE_HANDLERS 4
+#define SERVE_BACKLOG 64
+#define SERVE_LINE 256
+#define SERVE_SIZES 64
+#define SERVE_CHUNK 256
+#define SERVE_SLICE 0.25
+#define SERVE_MISS_BUDGET 0.05
+#define SERVE_INDEX_SHIFT 32
+#define SHARD_CHECKPOINT_INTERVAL 10.0
+
+#define ENGINE_REJECTION WINDROSE_ENGINE_REJECTION
+#define ENGINE_CONSTRUCTIVE WINDROSE_ENGINE_CONSTRUCTIVE
+
+/* Формат выходного файла пакетного режима */
+#define FORMAT_TEXT 0
+#define FORMAT_BINARY 1
+
+/* Уровни сложности поля (rate_field) */
+#define RATING_EASY WINDROSE_TIER_EASY
+#define RATING_MEDIUM WINDROSE_TIER_MEDIUM
+#define RATING_HARD WINDROSE_TIER_HARD
+#define RATING_GUESS WINDROSE_TIER_GUESS
+#define RATING_MEDIUM_ROUNDS 3
+#define RATING_HARD_ROUNDS 5
+#define RATING_ROUND_WEIGHT 10
+#define RATING_GUESS_WEIGHT 100
+
+/* Результат проверки поля в режиме --validate */
+#define VALIDATE_UNIQUE 1
+#define VALIDATE_AMBIGUOUS 2
+#define VALIDATE_UNSOLVABLE 3
+#define VALIDATE_BAD_FORMAT 4
 
 typedef struct
 {
@@ -25,35 +155,1146 @@ typedef struct
     int dy;
 } Direction;
 
+/* Направления: 0 — вверх, 1 — вниз, 2 — влево, 3 — вправо (противоположное — dir ^ 1) */
+const Direction directions[4] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+
+typedef signed char Cell;
+
+/*
+* Игровое поле: клетки лежат одним блоком построчно, вокруг поля рамка
+* шириной в одну клетку со значением BORDER (stride = cols + 2)
+*/
+typedef struct
+{
+    int rows;
+    int cols;
+    int stride;
+    Cell* cells;
+} Field;
+
+#define FIELD_INDEX(field, x, y) (((x) + 1) * (field)->stride + (y) + 1)
+#define FIELD_AT(field, x, y) ((field)->cells[FIELD_INDEX(field, x, y)])
+
+/*
+* Битовые маски занятости клеток для генерации: по одной маске на строку
+* и на столбец. Поле до MAX_FIELD_SIZE клеток плюс два бита рамки
+* помещается в 32-битную маску
+*/
+typedef unsigned int Mask;
+
+typedef struct
+{
+    int rows;
+    int cols;
+    Mask row_bits[MAX_FIELD_SIZE];
+    Mask col_bits[MAX_FIELD_SIZE];
+} Bitboard;
+
+/*
+* Состояние конструктивной генерации: для каждой чёрной клетки хранятся
+* длины линий по четырём направлениям, для каждой клетки поля — номер
+* чёрной клетки в ней (black_at) и номер чёрной клетки, чья линия
+* её покрывает (owner); -1 означает отсутствие
+*/
+typedef struct
+{
+    Bitboard board;
+    int black_count;
+    Point blacks[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+    int line_len[MAX_FIELD_SIZE * MAX_FIELD_SIZE][4];
+    short black_at[MAX_FIELD_SIZE][MAX_FIELD_SIZE];
+    short owner[MAX_FIELD_SIZE][MAX_FIELD_SIZE];
+} Construction;
+
+/*
+* Чёрные клетки, линии которых ещё не проведены (для досрочного прерывания
+* попытки): по маске на строку и на столбец, биты те же, что в Bitboard
+*/
+typedef struct
+{
+    Mask row[MAX_FIELD_SIZE];
+    Mask col[MAX_FIELD_SIZE];
+} Pending;
+
+typedef struct
+{
+    unsigned long long state;
+} Rng;
+
+/*
+* Оценка сложности поля (rate_field): сколько раз сработало каждое логическое
+* правило решателя и за сколько проходов (раундов) ограничения дошли до
+* неподвижной точки. Если логики не хватило, guesses — число ветвлений
+* перебора до решения. tier — уровень сложности от RATING_EASY до RATING_GUESS
+*/
+typedef struct
+{
+    int rounds;
+    long long sum_steps;
+    long long block_steps;
+    long long force_steps;
+    long long guesses;
+    long long score;
+    int tier;
+} Rating;
+
+/*
+* Поддерево перебора, отложенное для другого потока (count_solutions_split):
+* путь от корня до него — границы pos[i] по порядку получают значения value[i]
+*/
+typedef struct
+{
+    int length;
+    int* pos;
+    short* value;
+} SplitTask;
+
+/*
+* Очередь отложенных поддеревьев одного потока: владелец берёт последнее
+* (tasks[head + count - 1]), другой поток забирает самое раннее (tasks[head]) —
+* оно ближе к корню и обычно крупнее
+*/
+typedef struct
+{
+    SplitTask** tasks;
+    int head;
+    int count;
+    int capacity;
+} SplitDeque;
+
+/*
+* Общее состояние параллельного подсчёта решений одного поля: очереди
+* поддеревьев потоков, число решений всех потоков (перебор прекращается
+* флагом stop, когда их набралось limit), число ждущих работы (idle)
+* и занятых поддеревом (busy) потоков; allocs — выделения памяти
+* дополнительных потоков (их счётчики alloc_count)
+*/
+typedef struct
+{
+    Field* puzzle;
+    int limit;
+    int solutions;
+    int stop;
+    int idle;
+    int busy;
+    int threads;
+    long long allocs;
+    SplitDeque* deques;
+    mutex_handle lock;
+    cond_handle work;
+} SplitPool;
+
+/* Аргумент потока параллельного подсчёта решений (split_worker) */
+typedef struct
+{
+    SplitPool* pool;
+    int index;
+} SplitWorker;
+
+/*
+* Состояние точного решателя. Для каждой чёрной клетки b и направления d
+* хранится переменная var = b * 4 + d — длина луча, заданная границами
+* bounds[var * 2] (не меньше) и bounds[var * 2 + 1] (не больше).
+* Изменения границ записываются в trail, чтобы откатывать их при переборе.
+* Если solution не NULL, в него записываются длины лучей первого найденного решения,
+* если rating не NULL, в него записывается, какие правила сработали (rate_field);
+* branches — число ветвлений перебора; перебор прерывается (stop), когда их
+* больше branch_limit. При параллельном подсчёте pool — общее состояние потоков,
+* worker — номер потока, path_pos/path_value — путь решений от корня (его длина
+* path_len ведётся всегда), is_hungry — есть поток, ждущий работы
+*/
+typedef struct
+{
+    int black_count;
+    int white_count;
+    int* numbers;
+    int* cand_var;
+    int* cand_dist;
+    short* bounds;
+    int* trail_pos;
+    short* trail_old;
+    int trail_len;
+    int solutions;
+    int limit;
+    unsigned char* solution;
+    Rating* rating;
+    long long branches;
+    long long branch_limit;
+    int stop;
+    SplitPool* pool;
+    int worker;
+    int* path_pos;
+    short* path_value;
+    int path_len;
+    int is_hungry;
+} Solver;
+
+typedef struct
+{
+    int rows;
+    int cols;
+    long long count;
+    char* output;
+    char* dedup;
+    unsigned long long seed;
+    int has_seed;
+    long long first_index;
+    long long first_attempt;
+    int threads;
+    int engine;
+    int format;
+    double budget;
+} BatchOptions;
+
+typedef struct
+{
+    unsigned int seed;
+    double budget;
+    char* output;
+    int engine;
+} BenchOptions;
+
+typedef struct
+{
+    int rows;
+    int cols;
+    unsigned int seed;
+    double budget;
+    char* output;
+    int engine;
+} TuneOptions;
+
+typedef struct
+{
+    char* input;
+    char* output;
+    long long first;
+    long long count;
+} ConvertOptions;
+
+/*
+* Заголовок двоичной библиотеки полей: все поля одного размера rows x cols,
+* за заголовком идут count записей по record_size байт, в записи клетки
+* построчно по cell_bits бит (4 или 8), 0 — белая клетка, иначе число
+*/
+typedef struct
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int rows;
+    unsigned int cols;
+    unsigned int cell_bits;
+    unsigned int record_size;
+    unsigned long long count;
+} LibraryHeader;
+
+typedef struct
+{
+    FILE* file;
+    LibraryHeader header;
+    unsigned char* record;
+} LibraryWriter;
+
+/* Файл, отображённый в память только для чтения (file_map) */
+typedef struct
+{
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} MappedFile;
+
+/*
+* Библиотека, отображённая в память: записи читаются по номеру
+* прямо из отображения (records), без разбора файла
+*/
+typedef struct
+{
+    LibraryHeader header;
+    const unsigned char* records;
+    MappedFile map;
+} LibraryReader;
+
+typedef struct
+{
+    char* path;
+    char* output;
+    int threads;
+} ValidateOptions;
+
+/*
+* Проверяемый файл: библиотека (is_library) или текст в памяти (reader.map).
+* Его поля — задания first_job..first_job+jobs-1 очереди проверки,
+* max_rows x max_cols — наибольший размер поля в файле, status — результат
+* validate_add_file
+*/
+typedef struct
+{
+    char* name;
+    LibraryReader reader;
+    int status;
+    int is_library;
+    int max_rows;
+    int max_cols;
+    long long first_job;
+    long long jobs;
+} ValidateFile;
+
+/* Задание проверки: номер записи библиотеки или смещение поля в тексте */
+typedef struct
+{
+    int file;
+    long long offset;
+} ValidateJob;
+
+typedef struct
+{
+    ValidateFile* files;
+    ValidateJob* jobs;
+    signed char* results;
+    long long job_count;
+    long long next_job;
+    int split_threads;
+    mutex_handle lock;
+} ValidateQueue;
+
+/*
+* Параметры режима --serve: size_rows[i] x size_cols[i] (i < size_count) — размеры,
+* запас которых заполняется сразу при запуске (остальные — после первого запроса)
+*/
+typedef struct
+{
+    char* socket_path;
+    int depth;
+    int threads;
+    unsigned long long seed;
+    int has_seed;
+    int engine;
+    int size_rows[SERVE_SIZES];
+    int size_cols[SERVE_SIZES];
+    int size_count;
+} ServeOptions;
+
+/*
+* Запас проверенных полей размера rows x cols в режиме --serve: кольцо из depth
+* полей (cells — клетки полей построчно, index и attempt — номера поля
+* и попытки; cells == NULL — ячейка запаса свободна). resume_index и resume_attempt
+* (resumed штук) — прерванные поиски: номер поля и первая непроверенная попытка.
+* pending — поиски фоновых потоков, searching — все идущие поиски запаса,
+* is_active — фоновые потоки пополняют запас, is_pinned — размер задан ключом -z
+* и не вытесняется, last_used — время последнего запроса размера.
+* hits — запросы, обслуженные из запаса, misses — запросы, поле для которых
+* найдено на месте, busy — ответы BUSY, generated — поля, добавленные в запас
+*/
+typedef struct
+{
+    int rows;
+    int cols;
+    signed char* cells;
+    long long* index;
+    long long* attempt;
+    long long* resume_index;
+    long long* resume_attempt;
+    int head;
+    int count;
+    int resumed;
+    int pending;
+    int searching;
+    int is_active;
+    int is_pinned;
+    double last_used;
+    long long next_index;
+    long long hits;
+    long long misses;
+    long long busy;
+    long long generated;
+} ServePool;
+
+/*
+* Состояние режима --serve: запасы по размерам поля (pools; cursor — ячейка,
+* с которой фоновый поток начинает обход, opened — сколько запасов заведено), очередь принятых
+* соединений (clients) для потоков обслуживания и соединения, которые они
+* сейчас обслуживают (active, -1 — нет), — их закрывают при остановке
+*/
+typedef struct
+{
+    ServeOptions* options;
+    ServePool pools[SERVE_SIZES];
+    int cursor;
+    long long opened;
+    int clients[SERVE_BACKLOG];
+    int client_head;
+    int client_count;
+    int active[SERVE_HANDLERS];
+    int stop;
+    mutex_handle lock;
+    cond_handle refill;
+    cond_handle client_ready;
+} ServeState;
+
+/*
+* Буферы потока сервера для генерации поля: рабочая область windrose_generate
+* и клетки поля; растут под самый большой размер, который поток обрабатывал
+*/
+typedef struct
+{
+    void* workspace;
+    size_t workspace_size;
+    signed char* cells;
+    size_t cells_size;
+} ServeBuffer;
+
+/* Аргумент потока обслуживания соединений (serve_handler) */
+typedef struct
+{
+    ServeState* state;
+    int index;
+} ServeHandler;
+
+/*
+* Параметры режима --shards: count полей делятся на shards частей (шардов),
+* shard — номер единственного шарда этого запуска (-1 — все шарды),
+* output — префикс имён файлов шардов, interval — секунды между контрольными точками
+*/
+typedef struct
+{
+    int rows;
+    int cols;
+    long long count;
+    int shards;
+    int shard;
+    char* output;
+    unsigned long long seed;
+    int has_seed;
+    int threads;
+    int engine;
+    int format;
+    double interval;
+} ShardOptions;
+
+/*
+* Контрольная точка шарда (файл <префикс>-<шард>.ckpt): параметры запуска,
+* номер следующего поля next и длина выходного файла offset, до которой
+* в нём записаны поля меньших номеров; attempts — попытки шарда до next;
+* density — хеш таблицы плотности способа генерации (density_hash)
+*/
+typedef struct
+{
+    unsigned long long seed;
+    int rows;
+    int cols;
+    int engine;
+    int format;
+    long long count;
+    int shards;
+    int shard;
+    long long next;
+    long long offset;
+    long long attempts;
+    unsigned long long density;
+} ShardCheckpoint;
+
+/*
+* Очередь шардов режима --shards: потоки берут шарды next_shard..last_shard
+* по одному. resumed — поля, записанные до этого запуска, generated и attempts —
+* поля и попытки этого запуска, result — первая ошибка шарда (0 — нет)
+*/
+typedef struct
+{
+    ShardOptions* options;
+    int next_shard;
+    int last_shard;
+    int split_threads;
+    long long resumed;
+    long long generated;
+    long long attempts;
+    int workers_alive;
+    int result;
+    int stop;
+    mutex_handle lock;
+    cond_handle finished;
+} ShardQueue;
+
+/*
+* Выученная плотность чёрных клеток для одного размера поля:
+* количество выбирается равномерно из min..max (max == 0 — нет данных)
+*/
+typedef struct
+{
+    int min;
+    int max;
+    double rate;
+} DensityEntry;
+
+/* Результат замера одного количества чёрных клеток в режиме --tune */
+typedef struct
+{
+    int black_count;
+    long long attempts;
+    long long generated;
+    long long accepted;
+    double time;
+} TuneCandidate;
+
+/*
+* Время от начала поиска поля до его принятия (в секундах) по всем принятым
+* полям: по нему выводятся процентили p50/p95/p99 (latency_print)
+*/
+typedef struct
+{
+    double* values;
+    long long count;
+    long long capacity;
+} LatencyLog;
+
+/*
+* Статистика генерации: попытки, причины отказа и (при GEN_PROFILE)
+* такты по этапам. У каждого потока своя копия gen_stats
+*/
+typedef struct
+{
+    long long attempts;
+    long long rejected_boxed;
+    long long rejected_uncovered;
+    long long rejected_dead_end;
+    long long rejected_unsolvable;
+    long long rejected_ambiguous;
+    long long rejected_alloc;
+    long long rejected_seam;
+    long long rejected_duplicate;
+    long long accepted;
+    unsigned long long place_cycles;
+    unsigned long long draw_cycles;
+    unsigned long long finish_cycles;
+    unsigned long long create_cycles;
+} GenStats;
+
+/*
+* Рабочая область (арена) для временной памяти попыток генерации:
+* один блок, из которого память выдаётся подряд (used — занятая часть).
+* Освобождается вся память после отметки сразу (arena_release);
+* запросы, не поместившиеся в блок, выделяются в куче (arena_alloc)
+*/
+typedef struct
+{
+    char* base;
+    size_t size;
+    size_t used;
+} Arena;
+
+/*
+* Множество 64-битных хешей полей (открытая адресация, линейное
+* пробирование). Значение 0 обозначает пустую ячейку, capacity — степень двойки
+*/
+typedef struct
+{
+    unsigned long long* keys;
+    size_t capacity;
+    size_t count;
+} HashSet;
+
+typedef struct
+{
+    Field* puzzle;
+    long long attempt;
+    double seconds;
+    long long score;
+    int tier;
+    int is_ready;
+} BatchSlot;
+
+typedef struct
+{
+    BatchOptions* options;
+    mutex_handle lock;
+    cond_handle slot_ready;
+    cond_handle slot_free;
+    BatchSlot* slots;
+    int capacity;
+    long long next_ticket;
+    long long next_write;
+    long long attempts;
+    long long allocs;
+    GenStats stats;
+    int workers_alive;
+    int stop;
+} BatchQueue;
+
+typedef struct
+{
+    BatchQueue* queue;
+} BatchWorker;
+
+/*
+* Очередь заранее сгенерированных полей интерактивного режима: фоновый
+* поток (prefetch_worker) держит в ней до PREFETCH_QUEUE проверенных полей,
+* пока пользователь рассматривает текущее. fields — поля, выделенные один раз,
+* attempt — номер попытки каждого поля (для rng_seed_puzzle), seconds — время
+* поиска каждого поля, attempts — число попыток потока (для строки хода поиска),
+* budget — предел времени поиска одного поля в секундах (0 — предел MAX_ATTEMPTS попыток)
+*/
+typedef struct
+{
+    int rows;
+    int cols;
+    unsigned long long seed;
+    double budget;
+    Field* fields[PREFETCH_QUEUE];
+    long long attempt[PREFETCH_QUEUE];
+    double seconds[PREFETCH_QUEUE];
+    long long attempts;
+    int head;
+    int count;
+    int stop;
+    int finished;
+    GenStats stats;
+    mutex_handle lock;
+    cond_handle ready;
+    cond_handle space;
+} Prefetch;
+
+/* Ядро генерации для одного размера поля (generate_puzzle_RxC) */
+typedef Field* (*GenerateKernel)(int black_count, Rng* rng);
+
+/* Ядра генерации по количеству строк и столбцов (NULL — размер без своего ядра) */
+extern const GenerateKernel generate_kernels[MAX_FIELD_SIZE + 1][MAX_FIELD_SIZE + 1];
+
+/* Счётчик выделений памяти в генерации и проверке полей (свой у каждого потока) */
+THREAD_LOCAL long long alloc_count = 0;
+
+/* Статистика попыток генерации текущего потока */
+THREAD_LOCAL GenStats gen_stats;
+
+/* Рабочая область попыток генерации и проверки текущего потока */
+THREAD_LOCAL Arena scratch;
+
+/*
+* Сколько потоков может занять подсчёт решений одного поля (count_solutions),
+* если перебор оказался долгим; 1 — только текущий поток
+*/
+THREAD_LOCAL int split_threads = 1;
+
+/* Флаг отмены по Ctrl+C: его ставит обработчик сигнала on_cancel_signal */
+volatile sig_atomic_t cancel_requested = 0;
+
+/*
+* Выученная плотность чёрных клеток по способу генерации и размерам поля.
+* Значения по умолчанию получены режимом --tune (-b 3, оба способа генерации,
+* все размеры). Для 4x6, 4x10, 5x5, 6x7 и 7x3 способом rejection подбор
+* не улучшил статическую таблицу, и записан её диапазон; у rejection нет записей
+* только для размеров, поле которых подбор не нашёл (serve_can_generate).
+* Записи из файла, заданного ключом --density, заменяют эти значения
+*/
+DensityEntry density_table[2][MAX_FIELD_SIZE + 1][MAX_FIELD_SIZE + 1] =
+{
+    [ENGINE_REJECTION][3][3] = { 1, 2, 440237.81 },
+    [ENGINE_REJECTION][3][4] = { 1, 1, 325606.59 },
+    [ENGINE_REJECTION][3][5] = { 1, 1, 275830.58 },
+    [ENGINE_REJECTION][3][6] = { 2, 3, 127165.78 },
+    [ENGINE_REJECTION][3][7] = { 2, 5, 82120.99 },
+    [ENGINE_REJECTION][3][8] = { 3, 6, 57488.41 },
+    [ENGINE_REJECTION][3][9] = { 4, 6, 60394.34 },
+    [ENGINE_REJECTION][3][10] = { 4, 6, 42890.84 },
+    [ENGINE_REJECTION][3][11] = { 5, 7, 31800.95 },
+    [ENGINE_REJECTION][3][12] = { 6, 8, 18355.92 },
+    [ENGINE_REJECTION][4][3] = { 1, 2, 331433.87 },
+    [ENGINE_REJECTION][4][4] = { 2, 3, 168179.97 },
+    [ENGINE_REJECTION][4][5] = { 4, 6, 104683.35 },
+    [ENGINE_REJECTION][4][6] = { 3, 5, 64807.70 },
+    [ENGINE_REJECTION][4][7] = { 4, 6, 24019.30 },
+    [ENGINE_REJECTION][4][8] = { 5, 8, 16627.83 },
+    [ENGINE_REJECTION][4][9] = { 6, 9, 13610.37 },
+    [ENGINE_REJECTION][4][10] = { 9, 12, 7835.10 },
+    [ENGINE_REJECTION][4][11] = { 8, 11, 4727.10 },
+    [ENGINE_REJECTION][4][12] = { 9, 12, 3585.08 },
+    [ENGINE_REJECTION][5][3] = { 1, 1, 129879.79 },
+    [ENGINE_REJECTION][5][4] = { 2, 5, 50754.43 },
+    [ENGINE_REJECTION][5][5] = { 3, 5, 24938.00 },
+    [ENGINE_REJECTION][5][6] = { 5, 7, 16239.19 },
+    [ENGINE_REJECTION][5][7] = { 7, 9, 10992.80 },
+    [ENGINE_REJECTION][5][8] = { 8, 10, 9666.57 },
+    [ENGINE_REJECTION][5][9] = { 9, 12, 5735.92 },
+    [ENGINE_REJECTION][5][10] = { 10, 12, 6064.52 },
+    [ENGINE_REJECTION][5][11] = { 11, 13, 3656.83 },
+    [ENGINE_REJECTION][5][12] = { 14, 14, 2698.70 },
+    [ENGINE_REJECTION][6][3] = { 2, 4, 67184.87 },
+    [ENGINE_REJECTION][6][4] = { 4, 6, 33907.92 },
+    [ENGINE_REJECTION][6][5] = { 5, 7, 17790.58 },
+    [ENGINE_REJECTION][6][6] = { 6, 8, 10819.09 },
+    [ENGINE_REJECTION][6][7] = { 9, 12, 6658.30 },
+    [ENGINE_REJECTION][6][8] = { 10, 12, 4119.03 },
+    [ENGINE_REJECTION][6][9] = { 12, 14, 2020.05 },
+    [ENGINE_REJECTION][6][10] = { 13, 15, 1123.96 },
+    [ENGINE_REJECTION][6][11] = { 15, 16, 676.40 },
+    [ENGINE_REJECTION][6][12] = { 16, 19, 266.43 },
+    [ENGINE_REJECTION][7][3] = { 3, 5, 43638.10 },
+    [ENGINE_REJECTION][7][4] = { 5, 7, 18685.44 },
+    [ENGINE_REJECTION][7][5] = { 7, 9, 12756.49 },
+    [ENGINE_REJECTION][7][6] = { 8, 11, 6201.27 },
+    [ENGINE_REJECTION][7][7] = { 10, 12, 2890.03 },
+    [ENGINE_REJECTION][7][8] = { 11, 13, 1533.97 },
+    [ENGINE_REJECTION][7][9] = { 14, 16, 792.19 },
+    [ENGINE_REJECTION][7][10] = { 16, 17, 386.56 },
+    [ENGINE_REJECTION][7][11] = { 18, 19, 168.05 },
+    [ENGINE_REJECTION][7][12] = { 18, 21, 49.57 },
+    [ENGINE_REJECTION][8][3] = { 3, 6, 38980.36 },
+    [ENGINE_REJECTION][8][4] = { 6, 8, 18367.44 },
+    [ENGINE_REJECTION][8][5] = { 8, 10, 8296.53 },
+    [ENGINE_REJECTION][8][6] = { 10, 12, 3609.75 },
+    [ENGINE_REJECTION][8][7] = { 13, 14, 1671.97 },
+    [ENGINE_REJECTION][8][8] = { 14, 16, 748.67 },
+    [ENGINE_REJECTION][8][9] = { 17, 19, 321.34 },
+    [ENGINE_REJECTION][8][10] = { 17, 21, 128.36 },
+    [ENGINE_REJECTION][8][11] = { 18, 23, 40.52 },
+    [ENGINE_REJECTION][8][12] = { 20, 22, 16.06 },
+    [ENGINE_REJECTION][9][3] = { 4, 6, 34279.93 },
+    [ENGINE_REJECTION][9][4] = { 6, 8, 11624.53 },
+    [ENGINE_REJECTION][9][5] = { 9, 12, 5067.59 },
+    [ENGINE_REJECTION][9][6] = { 12, 14, 1967.55 },
+    [ENGINE_REJECTION][9][7] = { 14, 16, 903.75 },
+    [ENGINE_REJECTION][9][8] = { 16, 18, 302.59 },
+    [ENGINE_REJECTION][9][9] = { 19, 19, 103.77 },
+    [ENGINE_REJECTION][9][10] = { 21, 23, 31.65 },
+    [ENGINE_REJECTION][9][11] = { 22, 22, 15.32 },
+    [ENGINE_REJECTION][9][12] = { 30, 30, 3.06 },
+    [ENGINE_REJECTION][10][3] = { 5, 7, 20662.81 },
+    [ENGINE_REJECTION][10][4] = { 7, 10, 7327.91 },
+    [ENGINE_REJECTION][10][5] = { 11, 13, 3394.75 },
+    [ENGINE_REJECTION][10][6] = { 13, 15, 1273.79 },
+    [ENGINE_REJECTION][10][7] = { 15, 17, 333.57 },
+    [ENGINE_REJECTION][10][8] = { 17, 21, 108.94 },
+    [ENGINE_REJECTION][10][9] = { 18, 22, 15.98 },
+    [ENGINE_REJECTION][10][10] = { 28, 28, 12.16 },
+    [ENGINE_REJECTION][10][11] = { 24, 24, 3.13 },
+    [ENGINE_REJECTION][11][3] = { 5, 7, 16379.42 },
+    [ENGINE_REJECTION][11][4] = { 8, 11, 5814.69 },
+    [ENGINE_REJECTION][11][5] = { 12, 14, 2006.84 },
+    [ENGINE_REJECTION][11][6] = { 14, 16, 511.09 },
+    [ENGINE_REJECTION][11][7] = { 17, 20, 126.38 },
+    [ENGINE_REJECTION][11][8] = { 20, 24, 32.33 },
+    [ENGINE_REJECTION][11][9] = { 25, 25, 9.15 },
+    [ENGINE_REJECTION][12][3] = { 5, 8, 20563.78 },
+    [ENGINE_REJECTION][12][4] = { 9, 12, 6851.01 },
+    [ENGINE_REJECTION][12][5] = { 13, 15, 2199.27 },
+    [ENGINE_REJECTION][12][6] = { 16, 18, 529.49 },
+    [ENGINE_REJECTION][12][7] = { 19, 22, 123.57 },
+    [ENGINE_REJECTION][12][8] = { 21, 24, 37.15 },
+    [ENGINE_REJECTION][12][9] = { 25, 25, 6.29 },
+    [ENGINE_CONSTRUCTIVE][3][3] = { 1, 2, 448008.60 },
+    [ENGINE_CONSTRUCTIVE][3][4] = { 1, 2, 249293.43 },
+    [ENGINE_CONSTRUCTIVE][3][5] = { 1, 2, 187009.81 },
+    [ENGINE_CONSTRUCTIVE][3][6] = { 1, 3, 139163.04 },
+    [ENGINE_CONSTRUCTIVE][3][7] = { 1, 3, 131424.06 },
+    [ENGINE_CONSTRUCTIVE][3][8] = { 1, 2, 108741.94 },
+    [ENGINE_CONSTRUCTIVE][3][9] = { 1, 3, 96396.03 },
+    [ENGINE_CONSTRUCTIVE][3][10] = { 1, 3, 73063.12 },
+    [ENGINE_CONSTRUCTIVE][3][11] = { 1, 3, 83382.50 },
+    [ENGINE_CONSTRUCTIVE][3][12] = { 1, 2, 68257.59 },
+    [ENGINE_CONSTRUCTIVE][4][3] = { 1, 2, 128886.78 },
+    [ENGINE_CONSTRUCTIVE][4][4] = { 1, 3, 73124.08 },
+    [ENGINE_CONSTRUCTIVE][4][5] = { 1, 3, 54085.04 },
+    [ENGINE_CONSTRUCTIVE][4][6] = { 1, 4, 42920.37 },
+    [ENGINE_CONSTRUCTIVE][4][7] = { 1, 3, 36493.76 },
+    [ENGINE_CONSTRUCTIVE][4][8] = { 1, 3, 33186.52 },
+    [ENGINE_CONSTRUCTIVE][4][9] = { 1, 3, 28385.36 },
+    [ENGINE_CONSTRUCTIVE][4][10] = { 1, 3, 25009.11 },
+    [ENGINE_CONSTRUCTIVE][4][11] = { 1, 3, 23398.96 },
+    [ENGINE_CONSTRUCTIVE][4][12] = { 1, 3, 21709.57 },
+    [ENGINE_CONSTRUCTIVE][5][3] = { 1, 3, 86036.96 },
+    [ENGINE_CONSTRUCTIVE][5][4] = { 1, 4, 55858.37 },
+    [ENGINE_CONSTRUCTIVE][5][5] = { 1, 4, 40213.13 },
+    [ENGINE_CONSTRUCTIVE][5][6] = { 1, 3, 31147.42 },
+    [ENGINE_CONSTRUCTIVE][5][7] = { 1, 3, 25507.03 },
+    [ENGINE_CONSTRUCTIVE][5][8] = { 1, 4, 22160.94 },
+    [ENGINE_CONSTRUCTIVE][5][9] = { 1, 3, 19709.07 },
+    [ENGINE_CONSTRUCTIVE][5][10] = { 1, 3, 36489.97 },
+    [ENGINE_CONSTRUCTIVE][5][11] = { 1, 4, 19790.94 },
+    [ENGINE_CONSTRUCTIVE][5][12] = { 1, 3, 14599.33 },
+    [ENGINE_CONSTRUCTIVE][6][3] = { 1, 3, 64713.23 },
+    [ENGINE_CONSTRUCTIVE][6][4] = { 1, 3, 42663.22 },
+    [ENGINE_CONSTRUCTIVE][6][5] = { 1, 4, 31870.28 },
+    [ENGINE_CONSTRUCTIVE][6][6] = { 1, 3, 24604.07 },
+    [ENGINE_CONSTRUCTIVE][6][7] = { 1, 4, 21035.48 },
+    [ENGINE_CONSTRUCTIVE][6][8] = { 1, 4, 16530.04 },
+    [ENGINE_CONSTRUCTIVE][6][9] = { 1, 3, 13860.71 },
+    [ENGINE_CONSTRUCTIVE][6][10] = { 1, 3, 12343.78 },
+    [ENGINE_CONSTRUCTIVE][6][11] = { 1, 3, 12269.58 },
+    [ENGINE_CONSTRUCTIVE][6][12] = { 1, 3, 11517.23 },
+    [ENGINE_CONSTRUCTIVE][7][3] = { 1, 3, 61573.58 },
+    [ENGINE_CONSTRUCTIVE][7][4] = { 1, 3, 37292.44 },
+    [ENGINE_CONSTRUCTIVE][7][5] = { 1, 3, 25488.87 },
+    [ENGINE_CONSTRUCTIVE][7][6] = { 1, 5, 20687.01 },
+    [ENGINE_CONSTRUCTIVE][7][7] = { 1, 5, 16781.90 },
+    [ENGINE_CONSTRUCTIVE][7][8] = { 1, 4, 14063.66 },
+    [ENGINE_CONSTRUCTIVE][7][9] = { 1, 3, 11261.91 },
+    [ENGINE_CONSTRUCTIVE][7][10] = { 1, 3, 10196.96 },
+    [ENGINE_CONSTRUCTIVE][7][11] = { 1, 4, 8929.23 },
+    [ENGINE_CONSTRUCTIVE][7][12] = { 1, 4, 7881.78 },
+    [ENGINE_CONSTRUCTIVE][8][3] = { 1, 2, 55122.17 },
+    [ENGINE_CONSTRUCTIVE][8][4] = { 1, 3, 32416.27 },
+    [ENGINE_CONSTRUCTIVE][8][5] = { 1, 4, 23186.86 },
+    [ENGINE_CONSTRUCTIVE][8][6] = { 1, 4, 16784.69 },
+    [ENGINE_CONSTRUCTIVE][8][7] = { 1, 3, 13116.79 },
+    [ENGINE_CONSTRUCTIVE][8][8] = { 1, 4, 10974.19 },
+    [ENGINE_CONSTRUCTIVE][8][9] = { 1, 3, 9983.50 },
+    [ENGINE_CONSTRUCTIVE][8][10] = { 1, 4, 8348.39 },
+    [ENGINE_CONSTRUCTIVE][8][11] = { 1, 4, 7524.85 },
+    [ENGINE_CONSTRUCTIVE][8][12] = { 1, 5, 6489.76 },
+    [ENGINE_CONSTRUCTIVE][9][3] = { 1, 3, 47299.24 },
+    [ENGINE_CONSTRUCTIVE][9][4] = { 1, 3, 30095.65 },
+    [ENGINE_CONSTRUCTIVE][9][5] = { 1, 4, 19787.44 },
+    [ENGINE_CONSTRUCTIVE][9][6] = { 1, 3, 15111.97 },
+    [ENGINE_CONSTRUCTIVE][9][7] = { 1, 3, 11148.41 },
+    [ENGINE_CONSTRUCTIVE][9][8] = { 1, 3, 9382.89 },
+    [ENGINE_CONSTRUCTIVE][9][9] = { 1, 4, 7779.61 },
+    [ENGINE_CONSTRUCTIVE][9][10] = { 1, 4, 7014.09 },
+    [ENGINE_CONSTRUCTIVE][9][11] = { 1, 3, 6288.29 },
+    [ENGINE_CONSTRUCTIVE][9][12] = { 2, 4, 5787.11 },
+    [ENGINE_CONSTRUCTIVE][10][3] = { 1, 3, 43373.27 },
+    [ENGINE_CONSTRUCTIVE][10][4] = { 1, 4, 25597.25 },
+    [ENGINE_CONSTRUCTIVE][10][5] = { 1, 3, 18683.13 },
+    [ENGINE_CONSTRUCTIVE][10][6] = { 1, 3, 13598.24 },
+    [ENGINE_CONSTRUCTIVE][10][7] = { 1, 3, 10540.16 },
+    [ENGINE_CONSTRUCTIVE][10][8] = { 1, 4, 8498.04 },
+    [ENGINE_CONSTRUCTIVE][10][9] = { 1, 4, 6970.29 },
+    [ENGINE_CONSTRUCTIVE][10][10] = { 1, 5, 6115.28 },
+    [ENGINE_CONSTRUCTIVE][10][11] = { 1, 4, 5408.81 },
+    [ENGINE_CONSTRUCTIVE][10][12] = { 1, 3, 5073.12 },
+    [ENGINE_CONSTRUCTIVE][11][3] = { 1, 3, 41934.46 },
+    [ENGINE_CONSTRUCTIVE][11][4] = { 1, 4, 24035.79 },
+    [ENGINE_CONSTRUCTIVE][11][5] = { 1, 3, 15443.54 },
+    [ENGINE_CONSTRUCTIVE][11][6] = { 1, 3, 12110.83 },
+    [ENGINE_CONSTRUCTIVE][11][7] = { 1, 5, 9667.99 },
+    [ENGINE_CONSTRUCTIVE][11][8] = { 1, 5, 8115.36 },
+    [ENGINE_CONSTRUCTIVE][11][9] = { 1, 3, 5876.45 },
+    [ENGINE_CONSTRUCTIVE][11][10] = { 1, 4, 4716.05 },
+    [ENGINE_CONSTRUCTIVE][11][11] = { 1, 5, 5461.68 },
+    [ENGINE_CONSTRUCTIVE][11][12] = { 1, 4, 5560.88 },
+    [ENGINE_CONSTRUCTIVE][12][3] = { 1, 3, 43935.32 },
+    [ENGINE_CONSTRUCTIVE][12][4] = { 1, 3, 23442.98 },
+    [ENGINE_CONSTRUCTIVE][12][5] = { 1, 3, 15056.12 },
+    [ENGINE_CONSTRUCTIVE][12][6] = { 1, 3, 11902.52 },
+    [ENGINE_CONSTRUCTIVE][12][7] = { 1, 5, 10363.27 },
+    [ENGINE_CONSTRUCTIVE][12][8] = { 1, 6, 7441.88 },
+    [ENGINE_CONSTRUCTIVE][12][9] = { 1, 4, 5406.54 },
+    [ENGINE_CONSTRUCTIVE][12][10] = { 1, 4, 4623.23 },
+    [ENGINE_CONSTRUCTIVE][12][11] = { 1, 6, 3961.63 },
+    [ENGINE_CONSTRUCTIVE][12][12] = { 2, 5, 3305.15 }
+};
+
 int trim_newline(char* s);
 int flush_line();
 int show_menu();
 int run_generator();
-int** create_field(int rows, int cols);
-int free_field(int** field, int rows);
-int is_valid(int x, int y, int rows, int cols);
-int is_cell_available_for_line(int** field, int x, int y, int rows, int cols);
-int draw_line(int** field, int x, int y, Direction dir, int rows, int cols, int id);
-int is_fully_covered(int** field, int rows, int cols);
-int** generate_puzzle(int rows, int cols);
-int print_field(int** field, int rows, int cols);
-int save_to_file(int** field, int rows, int cols, char* filename);
-int is_solvable(int** puzzle, int rows, int cols);
+THREAD_FUNC prefetch_worker(void* arg);
+int parse_batch_options(int argc, char* argv[], BatchOptions* options);
+int run_batch(BatchOptions* options);
+int batch_close_output(BatchOptions* options, FILE* file, LibraryWriter* library);
+THREAD_FUNC batch_worker(void* arg);
+int parse_bench_options(int argc, char* argv[], BenchOptions* options);
+int run_bench(BenchOptions* options);
+int bench_size(BenchOptions* options, int size, FILE* out);
+int parse_tune_options(int argc, char* argv[], TuneOptions* options);
+int run_tune(TuneOptions* options);
+int tune_size(TuneOptions* options, int rows, int cols);
+int tune_measure(TuneCandidate* candidate, int rows, int cols, int engine, double seconds, Rng* rng);
+int tune_is_better(TuneCandidate* a, TuneCandidate* b);
+int parse_convert_options(int argc, char* argv[], ConvertOptions* options);
+int run_convert(ConvertOptions* options);
+int parse_validate_options(int argc, char* argv[], ValidateOptions* options);
+int run_validate(ValidateOptions* options);
+int validate_add_file(ValidateQueue* queue, int file, long long* capacity);
+THREAD_FUNC validate_worker(void* arg);
+int parse_serve_options(int argc, char* argv[], ServeOptions* options);
+int run_serve(ServeOptions* options);
+THREAD_FUNC serve_generator(void* arg);
+THREAD_FUNC serve_handler(void* arg);
+int serve_connection(ServeState* state, int client, ServeBuffer* buffer);
+int serve_request(ServeState* state, char* line, FILE* out, ServeBuffer* buffer);
+int serve_take(ServeState* state, int rows, int cols, ServeBuffer* buffer, long long* index, long long* attempt);
+ServePool* serve_open(ServeState* state, int rows, int cols);
+int serve_close(ServePool* pool);
+int serve_activate(ServePool* pool, int depth, int rows, int cols, long long first_index);
+int serve_claim(ServePool* pool, long long* index, long long* attempt);
+int serve_release(ServePool* pool, long long index, long long attempt, int result);
+int serve_reserve(ServeBuffer* buffer, int rows, int cols);
+int serve_search(ServeState* state, int rows, int cols, long long index, double budget, ServeBuffer* buffer, long long* attempt);
+int serve_can_generate(int engine, int rows, int cols);
+int serve_print_stats(ServeState* state, FILE* out);
+int run_client(int argc, char* argv[]);
+int parse_shard_options(int argc, char* argv[], ShardOptions* options);
+int run_shards(ShardOptions* options);
+THREAD_FUNC shard_worker(void* arg);
+int shard_run(ShardQueue* queue, int shard, void* workspace, size_t workspace_size, signed char* cells, Field* field);
+int shard_range(ShardOptions* options, int shard, long long* first, long long* count);
+char* shard_path(char* prefix, int shard, const char* suffix);
+int shard_save(FILE* file, LibraryWriter* library, ShardCheckpoint* checkpoint, char* path);
+int checkpoint_load(char* filename, ShardCheckpoint* checkpoint);
+int checkpoint_save(char* filename, ShardCheckpoint* checkpoint);
+int list_directory(char* path, char*** names);
+double get_time_sec();
+void on_cancel_signal(int sig);
+int cpu_count();
+int thread_create(thread_handle* thread, THREAD_FUNC (*func)(void*), void* arg);
+int thread_join(thread_handle thread);
+int mutex_init(mutex_handle* mutex);
+int mutex_lock(mutex_handle* mutex);
+int mutex_unlock(mutex_handle* mutex);
+int mutex_destroy(mutex_handle* mutex);
+int cond_init(cond_handle* cond);
+int cond_wait(cond_handle* cond, mutex_handle* mutex);
+int cond_wait_timeout(cond_handle* cond, mutex_handle* mutex, int ms);
+int cond_broadcast(cond_handle* cond);
+int cond_destroy(cond_handle* cond);
+unsigned long long rng_mix(unsigned long long z);
+int rng_seed(Rng* rng, unsigned long long seed);
+int rng_seed_puzzle(Rng* rng, unsigned long long seed, int rows, int cols, long long index, long long attempt);
+unsigned int rng_next(Rng* rng);
+int rng_range(Rng* rng, int n);
+void* counted_malloc(size_t size);
+int arena_reserve(Arena* arena, size_t size);
+void* arena_alloc(Arena* arena, size_t size);
+int arena_free(Arena* arena, void* block);
+int arena_release(Arena* arena, size_t mark);
+int arena_destroy(Arena* arena);
+int arena_attach(Arena* arena, void* block, size_t size);
+size_t scratch_size(int rows, int cols);
+unsigned long long read_cycles();
+int add_gen_stats(GenStats* total, GenStats* part);
+int print_gen_stats(GenStats* stats);
+int latency_add(LatencyLog* log, double seconds);
+int latency_print(LatencyLog* log);
+int compare_double(const void* a, const void* b);
+int latency_free(LatencyLog* log);
+Field* create_field(int rows, int cols);
+Field* create_scratch_field(int rows, int cols);
+Field* init_field(void* block, int rows, int cols);
+size_t field_bytes(int rows, int cols);
+int copy_field(Field* target, Field* source);
+int field_from_cells(Field* field, const signed char* cells);
+int field_to_cells(Field* field, signed char* cells);
+int free_field(Field* field);
+int lowest_bit(Mask mask);
+int highest_bit(Mask mask);
+int bit_count(Mask mask);
+int bitboard_init(Bitboard* board, int rows, int cols);
+int bitboard_is_set(Bitboard* board, int x, int y);
+int bitboard_set(Bitboard* board, int x, int y);
+int free_run(Bitboard* board, int x, int y, int dir);
+int paint_line(Bitboard* board, int x, int y, int dir, int len);
+int draw_line(Bitboard* board, int x, int y, int dir, Rng* rng);
+int is_fully_covered(Bitboard* board);
+int attempt_is_dead(Bitboard* board, Pending* pending, Mask rows, Mask cols);
+int pick_black_count(int rows, int cols, int engine, Rng* rng);
+int density_load(char* filename);
+int density_save(char* filename);
+unsigned long long density_hash(int engine);
+unsigned long long field_canonical_hash(Field* field);
+int hash_set_init(HashSet* set);
+int hash_set_insert(HashSet* set, unsigned long long key);
+int hash_set_load(HashSet* set, char* filename);
+int hash_set_save(HashSet* set, char* filename);
+int hash_set_free(HashSet* set);
+Field* build_field(int rows, int cols, Point* blacks, int (*line_len)[4], int black_count);
+Field* generate_field(int rows, int cols, int engine, Rng* rng);
+Field* generate_puzzle(int rows, int cols, int black_count, Rng* rng);
+Field* generate_puzzle_body(int rows, int cols, int black_count, Rng* rng);
+Field* generate_tiled(int rows, int cols, int engine, Rng* rng);
+int tile_start(int size, int count, int index);
+int tile_generate(Field* field, int tr, int tc, int tile_rows, int tile_cols, int engine, Rng* rng);
+int tile_context_fixed(Field* field, int tr, int tc, int tile_rows, int tile_cols);
+int tiled_mark_unfixed(Field* field, int tile_rows, int tile_cols, char* redo);
+int repair_find_owner(Bitboard* board, short black_at[][MAX_FIELD_SIZE], Point* blacks, int (*line_len)[4], int x, int y, int dir);
+int repair_coverage(Bitboard* board, Point* blacks, int (*line_len)[4], int* black_count, int capacity, Rng* rng);
+int construction_add_black(Construction* build, int x, int y);
+int construction_extend(Construction* build, int b, int dir, int count);
+int construction_line_end(Construction* build, int x, int y, int* dir_out);
+Field* generate_puzzle_constructive(int rows, int cols, int target, Rng* rng);
+int print_field(Field* field);
+int write_field(FILE* file, Field* field);
+int format_row(char* line, const Cell* row, int cols);
+int save_to_file(Field* field, char* filename);
+int file_map(MappedFile* map, char* filename);
+int file_unmap(MappedFile* map);
+int file_sync(FILE* file);
+long long file_tell(FILE* file);
+int file_truncate(char* filename, long long size);
+int file_replace(char* source, char* target);
+const char* scan_space(const char* p, const char* end);
+int scan_number(const char** cursor, const char* end, int* value);
+int parse_field(const char** cursor, const char* end, Field** field);
+int library_max_clue(int rows, int cols);
+int library_init_header(LibraryHeader* header, int rows, int cols, int max_clue);
+int library_create(LibraryWriter* writer, char* filename, int rows, int cols, int max_clue);
+int library_resume(LibraryWriter* writer, char* filename, int rows, int cols, int max_clue, unsigned long long count);
+int library_sync(LibraryWriter* writer);
+int library_append(LibraryWriter* writer, Field* field);
+int library_finish(LibraryWriter* writer);
+int library_open(LibraryReader* reader, char* filename);
+int library_get(LibraryReader* reader, long long index, Field* field);
+int library_close(LibraryReader* reader);
+int is_solvable(Field* puzzle);
+int count_solutions(Field* puzzle, int limit);
+int rate_field(Field* puzzle, Rating* rating);
+const char* rating_name(int tier);
+int solver_build(Solver* solver, Field* puzzle);
+int solver_free(Solver* solver);
+int solver_set_bound(Solver* solver, int pos, int value);
+int solver_undo(Solver* solver, int mark);
+int solver_propagate(Solver* solver);
+int solver_search(Solver* solver);
+int solver_decide(Solver* solver, int pos, int value);
+int count_solutions_split(Field* puzzle, int limit, int threads);
+THREAD_FUNC split_worker(void* arg);
+int split_run(SplitPool* pool, int index);
+SplitTask* split_take(SplitPool* pool, int index);
+int split_give(Solver* solver, int pos, int value);
+int split_poll(Solver* solver);
+int split_found(Solver* solver);
 
+/*
+* При сборке библиотеки (WINDROSE_LIBRARY, цель windrose в CMakeLists.txt)
+* main не компилируется: генератор встраивается через windrose.h
+*/
+#ifndef WINDROSE_LIBRARY
 /**
 * Главная функция программы
 * Выполняет инициализацию, выводит шапку и запускает циклическое меню
-* @return 0 при нормальном завершении программы
+* При запуске с ключом --batch работает без диалога (пакетная генерация),
+* с ключом --bench — замеряет скорость этапов генерации (run_bench),
+* с ключом --tune — подбирает плотность чёрных клеток (run_tune),
+* с ключом --convert — преобразует поля между текстом и двоичной библиотекой (run_convert),
+* с ключом --validate — проверяет поля в файлах (run_validate),
+* с ключом --serve — выдаёт поля по запросам через локальный сокет (run_serve),
+* с ключом --client — отправляет такой запрос (run_client),
+* с ключом --shards — генерирует большой набор по шардам с контрольными точками (run_shards).
+* Ключ --density <файл>, если он указан первым, загружает выученную плотность
+* из файла поверх встроенной таблицы; остальные ключи разбираются как без него
+* @param argc количество аргументов командной строки
+* @param argv аргументы командной строки
+* @return 0 при нормальном завершении программы, 1 при ошибке пакетного режима, замера, подбора,
+* преобразования, сервера, запроса к нему или генерации по шардам, если файл --density
+* не удалось открыть, или если проверка нашла неверные поля
 */
-int main()
+int main(int argc, char* argv[])
 {
     int is_running = 1;
     int menu_choice = 0;
 
     setlocale(LC_ALL, "RUS");
+#ifdef _WIN32
     system("chcp 1251");
-    
-    srand(time(NULL));
+#endif
+
+    if (argc > 1 && strcmp(argv[1], "--density") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("Ошибка: для ключа --density не указано значение.\n");
+            return 1;
+        }
+
+        if (density_load(argv[2]) < 0)
+        {
+            printf("Ошибка: не удалось открыть файл плотности %s.\n", argv[2]);
+            return 1;
+        }
+
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--tune") == 0)
+    {
+        TuneOptions options;
+
+        if (parse_tune_options(argc, argv, &options) != 0)
+        {
+            return 1;
+        }
+
+        return run_tune(&options) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--convert") == 0)
+    {
+        ConvertOptions options;
+
+        if (parse_convert_options(argc, argv, &options) != 0)
+        {
+            return 1;
+        }
+
+        return run_convert(&options) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--validate") == 0)
+    {
+        ValidateOptions options;
+
+        if (parse_validate_options(argc, argv, &options) != 0)
+        {
+            return 1;
+        }
+
+        return run_validate(&options) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+    {
+        ServeOptions options;
+
+        if (parse_serve_options(argc, argv, &options) != 0)
+        {
+            return 1;
+        }
+
+        return run_serve(&options) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--client") == 0)
+    {
+        return run_client(argc, argv) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--shards") == 0)
+    {
+        ShardOptions options;
+
+        if (parse_shard_options(argc, argv, &options) != 0)
+        {
+            return 1;
+        }
+
+        return run_shards(&options) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        BenchOptions options;
+
+        if (parse_bench_options(argc, argv, &options) != 0)
+        {
+            return 1;
+        }
+
+        return run_bench(&options) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1)
+    {
+        BatchOptions options;
+
+        if (parse_batch_options(argc, argv, &options) != 0)
+        {
+            return 1;
+        }
+
+        return run_batch(&options) == 0 ? 0 : 1;
+    }
 
     printf("============================================================\n");
     printf("Вас приветствует программа-генератор игровых полей\n");
@@ -89,6 +1330,7 @@ int main()
 
     return 0;
 }
+#endif
 
 /**
 * Удаляет символы конца строки '\n' из строки
@@ -165,7 +1407,21 @@ int show_menu()
 /**
 * Запускает режим генерации игровых полей
 * Запрашивает размеры поля, затем формирует и сохраняет 3 поля
-* После сохранения 3 полей выполняется возврат в меню
+* Поля генерирует фоновый поток (prefetch_worker): пока пользователь
+* рассматривает текущее поле и вводит имя файла, он заполняет очередь
+* следующими проверенными полями, поэтому после ответа "n" новое поле
+* показывается сразу. Генератор инициализируется перед каждой попыткой
+* по (seed, rows, cols, 0, попытка), поэтому показанное поле можно получить
+* заново в пакетном режиме (-s seed -a попытка).
+* Поиск одного поля ограничен временем, которое вводит пользователь
+* (по умолчанию PREFETCH_DEFAULT_BUDGET секунд, 0 — предел MAX_ATTEMPTS попыток).
+* Если поле ещё не готово, раз в PROGRESS_INTERVAL секунд выводится ход поиска;
+* на время ожидания Ctrl+C прерывает поиск (on_cancel_signal) с возвратом в меню,
+* уже сохранённые поля остаются.
+* Под каждым полем выводится его сложность (rate_field).
+* После сохранения 3 полей фоновый поток останавливается, выводятся процентили
+* времени поиска показанных полей (latency_print), сводка причин отказа
+* (print_gen_stats) и выполняется возврат в меню
 * @return 0
 */
 int run_generator()
@@ -174,7 +1430,16 @@ int run_generator()
     int cols = 0;
     int is_data_ok = 0;
     int generated = 0;
-    int attempts = 0;
+    int is_started = 0;
+    double budget = PREFETCH_DEFAULT_BUDGET;
+    Prefetch prefetch;
+    thread_handle producer;
+    LatencyLog latency;
+    Rating rating;
+    Field* puzzle;
+
+    memset(&gen_stats, 0, sizeof(gen_stats));
+    memset(&latency, 0, sizeof(latency));
 
     printf("\nРежим: генерация игровых полей\n");
     printf("----------------------------------------\n");
@@ -195,90 +1460,222 @@ int run_generator()
         }
     }
 
-    printf("\nПараметры приняты: %d x %d\n", rows, cols);
-    printf("Начинается генерация 3 полей...\n");
+    is_data_ok = 0;
 
-    while (generated < 3 && attempts < MAX_ATTEMPTS)
+    while (is_data_ok == 0)
     {
-        int** puzzle;
+        char line[DEFAULT_FILENAME_LEN];
 
-        attempts++;
-        puzzle = generate_puzzle(rows, cols);
+        printf("Предел времени поиска одного поля, с (Enter — %.0f, 0 — без предела): ", PREFETCH_DEFAULT_BUDGET);
 
-        if (puzzle != NULL)
+        if (fgets(line, sizeof(line), stdin) == NULL || line[0] == '\n')
         {
-            if (is_solvable(puzzle, rows, cols))
-            {
-                int accepted = 0;
-
-                printf("\n========================================\n");
-                printf("Поле %d из 3 (попытка %d)\n", generated + 1, attempts);
-                printf("========================================\n");
-                print_field(puzzle, rows, cols);
-
-                while (accepted == 0)
-                {
-                    char yn;
-
-                    printf("\nПоле подходит? (y/n): ");
-                    scanf(" %c", &yn);
-                    flush_line();
-
-                    if (yn == 'n' || yn == 'N')
-                    {
-                        printf("Вариант отклонён. Генерация нового варианта...\n");
-                        accepted = 1;
-                    }
-                    else if (yn == 'y' || yn == 'Y')
-                    {
-                        int saved = 0;
+            budget = PREFETCH_DEFAULT_BUDGET;
+            is_data_ok = 1;
+        }
+        else if (sscanf(line, "%lf", &budget) == 1 && budget >= 0.0)
+        {
+            is_data_ok = 1;
+        }
+        else
+        {
+            printf("Ошибка: введите неотрицательное число секунд.\n");
+        }
+    }
 
-                        while (saved == 0)
-                        {
-                            char filename[DEFAULT_FILENAME_LEN];
-
-                            printf("Введите имя файла (Enter — puzzle%d.txt): ", generated + 1);
-
-                            if (fgets(filename, sizeof(filename), stdin) == NULL)
-                            {
-                                printf("Ошибка ввода имени файла. Попробуйте снова.\n");
-                                continue;
-                            }
-
-                            if (filename[0] == '\n')
-                            {
-                                strcpy(filename, "puzzle0.txt");
-                                filename[6] = (char)('0' + (generated + 1));
-                            }
-                            else
-                            {
-                                trim_newline(filename);
-                            }
-
-                            if (save_to_file(puzzle, rows, cols, filename) == 0)
-                            {
-                                saved = 1;
-                            }
-                            else
-                            {
-                                printf("Не удалось сохранить поле. Попробуйте другое имя файла.\n");
-                            }
-                        }
+    printf("\nПараметры приняты: %d x %d\n", rows, cols);
+    printf("Начинается генерация 3 полей...\n");
+
+    memset(&prefetch, 0, sizeof(prefetch));
+    prefetch.rows = rows;
+    prefetch.cols = cols;
+    prefetch.seed = (unsigned long long)time(NULL);
+    prefetch.budget = budget;
+    puzzle = create_field(rows, cols);
+    is_data_ok = puzzle != NULL;
+
+    for (int i = 0; i < PREFETCH_QUEUE; i++)
+    {
+        prefetch.fields[i] = create_field(rows, cols);
+        is_data_ok = is_data_ok && prefetch.fields[i] != NULL;
+    }
+
+    mutex_init(&prefetch.lock);
+    cond_init(&prefetch.ready);
+    cond_init(&prefetch.space);
+
+    if (!is_data_ok)
+    {
+        printf("Ошибка выделения памяти для очереди полей\n");
+    }
+    else if (thread_create(&producer, prefetch_worker, &prefetch) != 0)
+    {
+        printf("Ошибка создания потока генерации\n");
+    }
+    else
+    {
+        is_started = 1;
+    }
+
+    while (is_started && generated < 3)
+    {
+        long long attempt;
+        int accepted = 0;
+
+        mutex_lock(&prefetch.lock);
+
+        if (prefetch.count == 0 && !prefetch.finished)
+        {
+            double wait_start;
+            double last_progress;
+
+            wait_start = get_time_sec();
+            last_progress = wait_start;
+            cancel_requested = 0;
+            signal(SIGINT, on_cancel_signal);
+
+            while (prefetch.count == 0 && !prefetch.finished && !cancel_requested)
+            {
+                double now;
+
+                cond_wait_timeout(&prefetch.ready, &prefetch.lock, WAIT_SLICE_MS);
+                now = get_time_sec();
+
+                if (now - last_progress >= PROGRESS_INTERVAL)
+                {
+                    printf("\rИдёт поиск поля: попыток %lld, прошло %.0f с (Ctrl+C — прервать) ", prefetch.attempts, now - wait_start);
+                    fflush(stdout);
+                    last_progress = now;
+                }
+            }
+
+            signal(SIGINT, SIG_DFL);
+
+            if (last_progress > wait_start)
+            {
+                printf("\n");
+            }
+        }
+
+        if (prefetch.count == 0)
+        {
+            /* фоновый поток исчерпал предел времени или MAX_ATTEMPTS попыток, или поиск прерван по Ctrl+C */
+            mutex_unlock(&prefetch.lock);
+
+            if (cancel_requested)
+            {
+                printf("Поиск поля прерван.\n");
+            }
+            else if (budget > 0.0)
+            {
+                printf("Поле не найдено за %.0f с.\n", budget);
+            }
+            else
+            {
+                printf("Поле не найдено за %d попыток.\n", MAX_ATTEMPTS);
+            }
+
+            break;
+        }
+
+        copy_field(puzzle, prefetch.fields[prefetch.head]);
+        attempt = prefetch.attempt[prefetch.head];
+        latency_add(&latency, prefetch.seconds[prefetch.head]);
+        prefetch.head = (prefetch.head + 1) % PREFETCH_QUEUE;
+        prefetch.count--;
+        cond_broadcast(&prefetch.space);
+        mutex_unlock(&prefetch.lock);
+
+        printf("\n========================================\n");
+        printf("Поле %d из 3 (попытка %lld, seed %llu)\n", generated + 1, attempt, prefetch.seed);
+        printf("========================================\n");
+        print_field(puzzle);
+
+        if (rate_field(puzzle, &rating) == 0)
+        {
+            printf("Сложность: %s (очков %lld, проходов логики %d)\n", rating_name(rating.tier), rating.score, rating.rounds);
+        }
+
+        while (accepted == 0)
+        {
+            char yn;
+
+            printf("\nПоле подходит? (y/n): ");
+            scanf(" %c", &yn);
+            flush_line();
+
+            if (yn == 'n' || yn == 'N')
+            {
+                printf("Вариант отклонён. Генерация нового варианта...\n");
+                accepted = 1;
+            }
+            else if (yn == 'y' || yn == 'Y')
+            {
+                int saved = 0;
+
+                while (saved == 0)
+                {
+                    char filename[DEFAULT_FILENAME_LEN];
+
+                    printf("Введите имя файла (Enter — puzzle%d.txt): ", generated + 1);
+
+                    if (fgets(filename, sizeof(filename), stdin) == NULL)
+                    {
+                        printf("Ошибка ввода имени файла. Попробуйте снова.\n");
+                        continue;
+                    }
+
+                    if (filename[0] == '\n')
+                    {
+                        strcpy(filename, "puzzle0.txt");
+                        filename[6] = (char)('0' + (generated + 1));
+                    }
+                    else
+                    {
+                        trim_newline(filename);
+                    }
 
-                        generated++;
-                        accepted = 1;
+                    if (save_to_file(puzzle, filename) == 0)
+                    {
+                        saved = 1;
                     }
                     else
                     {
-                        printf("Ошибка: введите только y или n.\n");
+                        printf("Не удалось сохранить поле. Попробуйте другое имя файла.\n");
                     }
                 }
-            }
 
-            free_field(puzzle, rows);
+                generated++;
+                accepted = 1;
+            }
+            else
+            {
+                printf("Ошибка: введите только y или n.\n");
+            }
         }
     }
 
+    if (is_started)
+    {
+        /* остановка фонового потока: он ждёт места в очереди или проверяет stop между попытками */
+        mutex_lock(&prefetch.lock);
+        prefetch.stop = 1;
+        cond_broadcast(&prefetch.space);
+        mutex_unlock(&prefetch.lock);
+        thread_join(producer);
+        add_gen_stats(&gen_stats, &prefetch.stats);
+    }
+
+    cond_destroy(&prefetch.space);
+    cond_destroy(&prefetch.ready);
+    mutex_destroy(&prefetch.lock);
+    free_field(puzzle);
+
+    for (int i = 0; i < PREFETCH_QUEUE; i++)
+    {
+        free_field(prefetch.fields[i]);
+    }
+
     printf("\n----------------------------------------\n");
     printf("Сохранено полей: %d\n", generated);
 
@@ -291,474 +1688,9144 @@ int run_generator()
         printf("Сформирован неполный набор полей.\n");
     }
 
+    latency_print(&latency);
+    latency_free(&latency);
+    print_gen_stats(&gen_stats);
     printf("Возврат в меню...\n");
 
     return 0;
 }
 
 /**
-* Создаёт динамическое поле (матрицу) заданного размера
-* Все клетки инициализируются значением EMPTY
-* @param rows количество строк
-* @param cols количество столбцов
-* @return указатель на поле (int**), либо NULL при ошибке выделения памяти
+* Фоновый поток интерактивного режима
+* Генерирует поля (generate_field, ENGINE_REJECTION) до первого с единственным
+* решением и копирует его в свободное место очереди Prefetch; когда очередь
+* заполнена, ждёт, пока пользователь возьмёт поле. Поля генерируются через
+* встраиваемый интерфейс (windrose_generate) порциями до BATCH_STOP_CHECK попыток
+* с рабочей областью, выделенной один раз. Вместе с полем записывается время
+* его поиска, а число попыток обновляется в prefetch->attempts при каждой проверке
+* флага stop. Пока пользователь рассматривает поле, остальные ядра свободны,
+* поэтому долгий подсчёт решений может занять все потоки (split_threads).
+* Завершается по флагу stop, если поиск одного поля длится дольше prefetch->budget
+* секунд или (при budget == 0) после MAX_ATTEMPTS попыток; статистика попыток
+* переносится в prefetch->stats
+* @param arg указатель на Prefetch
+* @return THREAD_RETURN
+*/
+THREAD_FUNC prefetch_worker(void* arg)
+{
+    Prefetch* prefetch;
+    long long attempts;
+    long long max_attempts;
+    int expired;
+    size_t workspace_size;
+    void* workspace;
+    signed char* cells;
+
+    prefetch = (Prefetch*)arg;
+    attempts = 0;
+    max_attempts = prefetch->budget > 0.0 ? LLONG_MAX : MAX_ATTEMPTS;
+    expired = 0;
+    split_threads = cpu_count();
+    memset(&gen_stats, 0, sizeof(gen_stats));
+    workspace_size = windrose_workspace_size(prefetch->rows, prefetch->cols);
+    workspace = malloc(workspace_size);
+    cells = (signed char*)malloc((size_t)prefetch->rows * (size_t)prefetch->cols);
+
+    mutex_lock(&prefetch->lock);
+
+    while (!prefetch->stop && !expired && attempts < max_attempts && workspace != NULL && cells != NULL)
+    {
+        long long attempt;
+        double search_start;
+        int result;
+        int slot;
+
+        while (!prefetch->stop && prefetch->count == PREFETCH_QUEUE)
+        {
+            cond_wait(&prefetch->space, &prefetch->lock);
+        }
+
+        if (prefetch->stop)
+        {
+            break;
+        }
+
+        mutex_unlock(&prefetch->lock);
+        result = WINDROSE_ERROR_ATTEMPTS;
+        search_start = get_time_sec();
+
+        while (result == WINDROSE_ERROR_ATTEMPTS && attempts < max_attempts)
+        {
+            long long chunk;
+            int stop;
+
+            /* порция заканчивается на номере, кратном BATCH_STOP_CHECK: там проверяются stop и предел времени */
+            chunk = BATCH_STOP_CHECK - attempts % BATCH_STOP_CHECK;
+            chunk = chunk < max_attempts - attempts ? chunk : max_attempts - attempts;
+            result = windrose_generate(prefetch->rows, prefetch->cols, ENGINE_REJECTION, prefetch->seed, 0,
+                attempts + 1, chunk, workspace, workspace_size, cells, &attempt);
+            attempts = result == WINDROSE_OK ? attempt : attempts + chunk;
+
+            if (result == WINDROSE_ERROR_ATTEMPTS)
+            {
+                mutex_lock(&prefetch->lock);
+                prefetch->attempts = attempts;
+                stop = prefetch->stop;
+                mutex_unlock(&prefetch->lock);
+
+                if (stop)
+                {
+                    break;
+                }
+
+                if (prefetch->budget > 0.0 && get_time_sec() - search_start >= prefetch->budget)
+                {
+                    expired = 1;
+                    break;
+                }
+            }
+        }
+
+        mutex_lock(&prefetch->lock);
+        prefetch->attempts = attempts;
+
+        if (result == WINDROSE_OK)
+        {
+            slot = (prefetch->head + prefetch->count) % PREFETCH_QUEUE;
+            field_from_cells(prefetch->fields[slot], cells);
+            prefetch->attempt[slot] = attempts;
+            prefetch->seconds[slot] = get_time_sec() - search_start;
+            prefetch->count++;
+            cond_broadcast(&prefetch->ready);
+        }
+    }
+
+    add_gen_stats(&prefetch->stats, &gen_stats);
+    prefetch->finished = 1;
+    cond_broadcast(&prefetch->ready);
+    mutex_unlock(&prefetch->lock);
+
+    free(workspace);
+    free(cells);
+
+    return THREAD_RETURN;
+}
+
+/**
+* Разбирает аргументы командной строки пакетного режима
+* Формат: --batch -r <строки> -c <столбцы> -n <количество> -o <файл> [-s <seed>] [-t <потоки>]
+* [-e rejection|constructive] [-i <номер первого поля>] [-a <номер первой попытки>] [-d <файл хешей>]
+* [-f text|binary] [-T <секунд>]
+* При заданном сроке -T количество -n можно не указывать: тогда поля генерируются
+* до истечения срока (options->count = BATCH_UNLIMITED)
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @param options структура, в которую записываются параметры
+* @return 0 при успешном разборе, -1 при ошибке в аргументах
+*/
+int parse_batch_options(int argc, char* argv[], BatchOptions* options)
+{
+    int i;
+
+    options->rows = 0;
+    options->cols = 0;
+    options->count = 0;
+    options->output = NULL;
+    options->dedup = NULL;
+    options->seed = 0;
+    options->has_seed = 0;
+    options->first_index = 0;
+    options->first_attempt = 1;
+    options->threads = cpu_count();
+    options->engine = ENGINE_REJECTION;
+    options->format = FORMAT_TEXT;
+    options->budget = 0.0;
+
+    if (strcmp(argv[1], "--batch") != 0)
+    {
+        printf("Неизвестный режим: %s\n", argv[1]);
+        printf("Использование: %s --batch -r <строки> -c <столбцы> -n <количество> -o <файл> [-s <seed>] [-t <потоки>] [-e rejection|constructive] [-i <номер>] [-a <попытка>] [-d <файл хешей>] [-f text|binary] [-T <секунд>]\n", argv[0]);
+        return -1;
+    }
+
+    for (i = 2; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("Ошибка: для ключа %s не указано значение.\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            options->rows = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            options->cols = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            options->count = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            options->output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            options->seed = strtoull(argv[++i], NULL, 10);
+            options->has_seed = 1;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            options->dedup = argv[++i];
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            i++;
+
+            if (strcmp(argv[i], "text") == 0)
+            {
+                options->format = FORMAT_TEXT;
+            }
+            else if (strcmp(argv[i], "binary") == 0)
+            {
+                options->format = FORMAT_BINARY;
+            }
+            else
+            {
+                printf("Ошибка: неизвестный формат файла %s.\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-i") == 0)
+        {
+            options->first_index = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-a") == 0)
+        {
+            options->first_attempt = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            options->threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-T") == 0)
+        {
+            options->budget = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            i++;
+
+            if (strcmp(argv[i], "rejection") == 0)
+            {
+                options->engine = ENGINE_REJECTION;
+            }
+            else if (strcmp(argv[i], "constructive") == 0)
+            {
+                options->engine = ENGINE_CONSTRUCTIVE;
+            }
+            else
+            {
+                printf("Ошибка: неизвестный способ генерации %s.\n", argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("Ошибка: неизвестный ключ %s.\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (options->rows < MIN_FIELD_SIZE || options->cols < MIN_FIELD_SIZE || options->rows > LARGE_MAX_SIZE || options->cols > LARGE_MAX_SIZE)
+    {
+        printf("Ошибка: размеры должны быть в диапазоне от 3 до 500.\n");
+        return -1;
+    }
+
+    if (options->budget < 0.0)
+    {
+        printf("Ошибка: срок генерации не может быть отрицательным.\n");
+        return -1;
+    }
+
+    if (options->count == 0 && options->budget > 0.0)
+    {
+        options->count = BATCH_UNLIMITED;
+    }
+
+    if (options->count <= 0)
+    {
+        printf("Ошибка: количество полей должно быть положительным (или задайте срок -T).\n");
+        return -1;
+    }
+
+    if (options->output == NULL)
+    {
+        printf("Ошибка: не указан выходной файл (-o).\n");
+        return -1;
+    }
+
+    if (options->threads <= 0)
+    {
+        printf("Ошибка: число потоков должно быть положительным.\n");
+        return -1;
+    }
+
+    if (options->first_index < 0 || options->first_attempt <= 0)
+    {
+        printf("Ошибка: номер поля не может быть отрицательным, номер попытки должен быть положительным.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Возвращает текущее время в секундах (для замеров производительности)
+* @return время в секундах с дробной частью
+*/
+double get_time_sec()
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+* Обработчик Ctrl+C (SIGINT) на время генерации: только ставит флаг
+* cancel_requested, а генерация останавливается сама, сохранив готовые поля.
+* Повторное нажатие завершает программу обычным образом
+* @param sig номер сигнала
 */
-int** create_field(int rows, int cols)
+void on_cancel_signal(int sig)
 {
-    int** field;
-    int row_index;
-    int col_index;
+    cancel_requested = 1;
+    signal(sig, SIG_DFL);
+}
+
+/**
+* Пакетная генерация полей без диалога с пользователем
+* Запускает options->threads рабочих потоков. Потоки получают номера полей
+* по порядку, а главный поток дописывает готовые поля в выходной файл строго
+* в порядке номеров, каждое со строкой-комментарием "# seed ... index ... attempt ..."
+* и оценкой сложности поля "tier ... score ..." (rate_field).
+* Поле с номером index зависит только от (seed, rows, cols, index), поэтому
+* результат не зависит от числа потоков (rng_seed_puzzle).
+* Если задан файл хешей (options->dedup), поля, совпадающие с уже записанными
+* с точностью до поворотов и отражений (field_canonical_hash), пропускаются,
+* а потоки берут номера, пока не наберётся options->count разных полей;
+* множество хешей загружается из этого файла и сохраняется в него в конце.
+* При options->format == FORMAT_BINARY поля записываются в двоичную библиотеку
+* (library_append) без строк-комментариев.
+* Генерация останавливается по сроку options->budget (ключ -T) или по Ctrl+C
+* (on_cancel_signal); уже готовые поля при этом записываются. Пока главный поток
+* ждёт поле, раз в PROGRESS_INTERVAL секунд он выводит ход генерации в stderr.
+* В конце выводит статистику скорости, процентили времени до принятого поля
+* (latency_print) и причины отказа, собранные со всех потоков
+* @param options параметры пакетного режима
+* @return 0 при успехе, -4 если файл открыть не удалось или запись в него не удалась,
+* -5 если не хватило попыток или набор -n не собран до остановки, -6 при ошибке создания потоков или выделения памяти
+*/
+int run_batch(BatchOptions* options)
+{
+    FILE* file;
+    BatchQueue queue;
+    BatchWorker* workers;
+    thread_handle* threads;
+    LibraryWriter library;
+    HashSet seen;
+    LatencyLog latency;
+    long long tiers[RATING_GUESS + 1];
+    long long generated;
+    long long duplicates;
+    long long duplicate_streak;
+    double start_time;
+    double last_progress;
+    double elapsed;
+    int write_error;
+    int is_expired;
+    int started;
+    int i;
+
+    if (options->format == FORMAT_BINARY)
+    {
+        /* запись библиотеки буферизована внутри library_create */
+        file = library_create(&library, options->output, options->rows, options->cols,
+            library_max_clue(options->rows, options->cols)) == 0 ? library.file : NULL;
+    }
+    else
+    {
+        file = fopen(options->output, "w");
+
+        if (file != NULL)
+        {
+            setvbuf(file, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+        }
+    }
+
+    if (file == NULL)
+    {
+        printf("Ошибка открытия файла!\n");
+        return -4;
+    }
+
+    if (options->dedup != NULL)
+    {
+        if (hash_set_init(&seen) != 0 || hash_set_load(&seen, options->dedup) == -1)
+        {
+            printf("Ошибка выделения памяти для множества хешей\n");
+            hash_set_free(&seen);
+            batch_close_output(options, file, &library);
+            return -6;
+        }
+
+        printf("Загружено хешей полей: %llu\n", (unsigned long long)seen.count);
+    }
+
+    queue.options = options;
+    queue.capacity = options->threads * 4 > BATCH_QUEUE_MIN ? options->threads * 4 : BATCH_QUEUE_MIN;
+    queue.next_ticket = 0;
+    queue.next_write = 0;
+    queue.attempts = 0;
+    queue.allocs = 0;
+    memset(&queue.stats, 0, sizeof(queue.stats));
+    queue.workers_alive = 0;
+    queue.stop = 0;
+    queue.slots = (BatchSlot*)calloc((size_t)queue.capacity, sizeof(BatchSlot));
+    workers = (BatchWorker*)malloc((size_t)options->threads * sizeof(BatchWorker));
+    threads = (thread_handle*)malloc((size_t)options->threads * sizeof(thread_handle));
+
+    for (i = 0; queue.slots != NULL && i < queue.capacity; i++)
+    {
+        /* поля ячеек выделяются один раз: потоки копируют в них принятые поля */
+        queue.slots[i].puzzle = create_field(options->rows, options->cols);
+        if (queue.slots[i].puzzle == NULL)
+        {
+            break;
+        }
+    }
+
+    if (queue.slots == NULL || i < queue.capacity || workers == NULL || threads == NULL)
+    {
+        printf("Ошибка выделения памяти для очереди полей\n");
+
+        for (i = 0; queue.slots != NULL && i < queue.capacity; i++)
+        {
+            free_field(queue.slots[i].puzzle);
+        }
+
+        free(queue.slots);
+        free(workers);
+        free(threads);
+        batch_close_output(options, file, &library);
+
+        if (options->dedup != NULL)
+        {
+            hash_set_free(&seen);
+        }
+
+        return -6;
+    }
+
+    mutex_init(&queue.lock);
+    cond_init(&queue.slot_ready);
+    cond_init(&queue.slot_free);
+
+    if (!options->has_seed)
+    {
+        options->seed = (unsigned long long)time(NULL);
+        options->has_seed = 1;
+    }
+
+    memset(&latency, 0, sizeof(latency));
+    memset(tiers, 0, sizeof(tiers));
+    cancel_requested = 0;
+    signal(SIGINT, on_cancel_signal);
+    start_time = get_time_sec();
+    last_progress = start_time;
+    is_expired = 0;
+
+    started = 0;
+    for (i = 0; i < options->threads; i++)
+    {
+        workers[i].queue = &queue;
+
+        mutex_lock(&queue.lock);
+        queue.workers_alive++;
+        mutex_unlock(&queue.lock);
+
+        if (thread_create(&threads[i], batch_worker, &workers[i]) != 0)
+        {
+            mutex_lock(&queue.lock);
+            queue.workers_alive--;
+            mutex_unlock(&queue.lock);
+            break;
+        }
+
+        started++;
+    }
+
+    generated = 0;
+    duplicates = 0;
+    duplicate_streak = 0;
+    write_error = 0;
+
+    while (generated < options->count && duplicate_streak < DEDUP_MAX_STREAK)
+    {
+        BatchSlot* slot;
+        int is_new;
+
+        mutex_lock(&queue.lock);
+
+        slot = &queue.slots[queue.next_write % queue.capacity];
+
+        /* срок и отмена проверяются и между полями, и во время ожидания (не реже WAIT_SLICE_MS);
+           после остановки дописываются только уже готовые поля */
+        while (!queue.stop)
+        {
+            double now;
+
+            now = get_time_sec();
+
+            if (cancel_requested || (options->budget > 0.0 && now - start_time >= options->budget))
+            {
+                is_expired = !cancel_requested;
+                queue.stop = 1;
+                cond_broadcast(&queue.slot_free);
+            }
+            else if (slot->is_ready || queue.workers_alive == 0)
+            {
+                break;
+            }
+            else
+            {
+                cond_wait_timeout(&queue.slot_ready, &queue.lock, WAIT_SLICE_MS);
+            }
+
+            if (now - last_progress >= PROGRESS_INTERVAL)
+            {
+                fprintf(stderr, "\rПолей: %lld, попыток: %lld, прошло %.0f с ", generated, queue.attempts, now - start_time);
+                last_progress = now;
+            }
+        }
+
+        if (!slot->is_ready)
+        {
+            mutex_unlock(&queue.lock);
+            break;
+        }
+
+        mutex_unlock(&queue.lock);
+
+        is_new = 1;
+
+        if (options->dedup != NULL)
+        {
+            is_new = hash_set_insert(&seen, field_canonical_hash(slot->puzzle));
+        }
+
+        if (is_new < 0)
+        {
+            printf("Ошибка выделения памяти для множества хешей\n");
+            break;
+        }
+
+        if (is_new && latency_add(&latency, slot->seconds) != 0)
+        {
+            printf("Ошибка выделения памяти для журнала времени\n");
+            break;
+        }
+
+        if (is_new && slot->tier >= RATING_EASY && slot->tier <= RATING_GUESS)
+        {
+            tiers[slot->tier]++;
+        }
+
+        if (is_new && options->format == FORMAT_BINARY)
+        {
+            /* числа сгенерированного поля не больше library_max_clue */
+            if (library_append(&library, slot->puzzle) != 0)
+            {
+                printf("Ошибка записи файла %s\n", options->output);
+                write_error = 1;
+                break;
+            }
+
+            generated++;
+            duplicate_streak = 0;
+        }
+        else if (is_new)
+        {
+            if (generated > 0)
+            {
+                fprintf(file, "\n");
+            }
+
+            /* по этой строке поле можно получить заново: --batch -s seed -i index -a attempt -n 1 */
+            fprintf(file, "# seed %llu index %lld attempt %lld engine %s tier %d score %lld\n", options->seed,
+                options->first_index + queue.next_write, slot->attempt, options->engine == ENGINE_CONSTRUCTIVE ? "constructive" : "rejection",
+                slot->tier, slot->score);
+            /* ячейка освобождается только после записи: до этого её поле не перезаписывается */
+            write_field(file, slot->puzzle);
+            generated++;
+            duplicate_streak = 0;
+        }
+        else
+        {
+            duplicates++;
+            duplicate_streak++;
+        }
+
+        mutex_lock(&queue.lock);
+        slot->is_ready = 0;
+        queue.next_write++;
+        cond_broadcast(&queue.slot_free);
+        mutex_unlock(&queue.lock);
+    }
+
+    mutex_lock(&queue.lock);
+    queue.stop = 1;
+    cond_broadcast(&queue.slot_free);
+    mutex_unlock(&queue.lock);
+
+    for (i = 0; i < started; i++)
+    {
+        thread_join(threads[i]);
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+    if (last_progress > start_time)
+    {
+        fprintf(stderr, "\n");
+    }
+
+    for (i = 0; i < queue.capacity; i++)
+    {
+        free_field(queue.slots[i].puzzle);
+    }
+
+    if (batch_close_output(options, file, &library) != 0 && !write_error)
+    {
+        printf("Ошибка записи файла %s\n", options->output);
+        write_error = 1;
+    }
+
+    elapsed = get_time_sec() - start_time;
+    queue.stats.rejected_duplicate += duplicates;
+
+    if (elapsed <= 0.0)
+    {
+        elapsed = 1e-9;
+    }
+
+    printf("----------------------------------------\n");
+    printf("Размер поля: %d x %d\n", options->rows, options->cols);
+    printf("Потоков: %d\n", started);
+    printf("Начальное значение (seed): %llu\n", options->seed);
+
+    if (options->count == BATCH_UNLIMITED)
+    {
+        printf("Сгенерировано полей: %lld\n", generated);
+    }
+    else
+    {
+        printf("Сгенерировано полей: %lld из %lld\n", generated, options->count);
+    }
+
+    printf("Попыток: %lld\n", queue.attempts);
+    printf("Время: %.3f с\n", elapsed);
+    printf("Полей в секунду: %.2f\n", (double)generated / elapsed);
+    printf("Попыток в секунду: %.2f\n", (double)queue.attempts / elapsed);
+    printf("Доля принятых попыток: %.6f%%\n", queue.attempts > 0 ? 100.0 * (double)generated / (double)queue.attempts : 0.0);
+    printf("Выделений памяти в цикле генерации: %lld\n", queue.allocs);
+    printf("Файл: %s\n", options->output);
+    latency_print(&latency);
+    printf("Сложность полей: %s %lld, %s %lld, %s %lld, %s %lld\n",
+        rating_name(RATING_EASY), tiers[RATING_EASY], rating_name(RATING_MEDIUM), tiers[RATING_MEDIUM],
+        rating_name(RATING_HARD), tiers[RATING_HARD], rating_name(RATING_GUESS), tiers[RATING_GUESS]);
+    print_gen_stats(&queue.stats);
+
+    if (cancel_requested)
+    {
+        printf("Генерация прервана (Ctrl+C), готовые поля сохранены.\n");
+    }
+    else if (is_expired)
+    {
+        printf("Генерация остановлена: истёк срок %.3f с.\n", options->budget);
+    }
+
+    if (options->dedup != NULL)
+    {
+        if (duplicate_streak >= DEDUP_MAX_STREAK)
+        {
+            printf("Среди %d принятых полей подряд нет новых: похоже, разные поля этого размера закончились.\n", DEDUP_MAX_STREAK);
+        }
+
+        if (hash_set_save(&seen, options->dedup) == 0)
+        {
+            printf("Хешей полей сохранено: %llu (%s)\n", (unsigned long long)seen.count, options->dedup);
+        }
+
+        hash_set_free(&seen);
+    }
+
+    cond_destroy(&queue.slot_free);
+    cond_destroy(&queue.slot_ready);
+    mutex_destroy(&queue.lock);
+    free(queue.slots);
+    free(workers);
+    free(threads);
+    latency_free(&latency);
+
+    if (started == 0)
+    {
+        printf("Ошибка создания рабочих потоков\n");
+        return -6;
+    }
+
+    if (write_error)
+    {
+        return -4;
+    }
+
+    /* без -n срок -T — обычный способ завершения, а не ошибка */
+    if (generated < options->count && options->count != BATCH_UNLIMITED)
+    {
+        printf("Сформирован неполный набор полей.\n");
+        return -5;
+    }
+
+    return 0;
+}
+
+/**
+* Закрывает выходной файл пакетного режима: текстовый файл — fclose,
+* двоичную библиотеку — library_finish (с записью числа полей в заголовок)
+* @param options параметры пакетного режима
+* @param file открытый выходной файл
+* @param library состояние записи библиотеки (для FORMAT_BINARY)
+* @return 0 при успехе, -4 при ошибке записи в файл
+*/
+int batch_close_output(BatchOptions* options, FILE* file, LibraryWriter* library)
+{
+    if (options->format == FORMAT_BINARY)
+    {
+        return library_finish(library);
+    }
+
+    return fclose(file) == 0 ? 0 : -4;
+}
+
+/**
+* Рабочий поток пакетного режима
+* Берёт очередной номер поля и генерирует поля до первого прошедшего проверку
+* через встраиваемый интерфейс (windrose_generate: перед каждой попыткой генератор
+* инициализируется по (seed, rows, cols, номер, попытка)), затем копирует его
+* в поле ячейки очереди с этим номером. Попытки идут порциями до BATCH_STOP_CHECK,
+* между порциями проверяется остановка очереди. Рабочая область попыток выделяется
+* один раз, поэтому в цикле генерации нет обращений к куче (счётчик alloc_count).
+* Время поиска поля (от взятия номера до принятия) записывается в ячейку
+* для процентилей, попытки добавляются в queue->attempts по ходу поиска.
+* Сложность принятого поля оценивается здесь же (windrose_rate), поэтому
+* оценка идёт параллельно по полям.
+* При заданном сроке (-T) число попыток на поле не ограничено MAX_ATTEMPTS.
+* Если полей меньше, чем потоков, лишние ядра отдаются долгим подсчётам
+* решений (split_threads).
+* Завершается, когда все номера розданы, либо при остановке очереди
+* (при отбрасывании повторов номера раздаются до остановки)
+* @param arg указатель на BatchWorker
+* @return THREAD_RETURN
+*/
+THREAD_FUNC batch_worker(void* arg)
+{
+    BatchWorker* worker;
+    BatchQueue* queue;
+    BatchOptions* options;
+    long long max_attempts;
+    long long allocs;
+    long long ticket;
+    size_t workspace_size;
+    void* workspace;
+    signed char* cells;
+
+    worker = (BatchWorker*)arg;
+    queue = worker->queue;
+    options = queue->options;
+    max_attempts = options->budget > 0.0 ? LLONG_MAX : MAX_ATTEMPTS;
+    workspace_size = windrose_workspace_size(options->rows, options->cols);
+    workspace = malloc(workspace_size);
+    cells = (signed char*)malloc((size_t)options->rows * (size_t)options->cols);
+    allocs = alloc_count;
+
+    if (options->count > 0 && options->count < options->threads)
+    {
+        split_threads = options->threads / (int)options->count;
+    }
+
+    mutex_lock(&queue->lock);
+
+    if (workspace == NULL || cells == NULL)
+    {
+        printf("Ошибка выделения памяти для рабочей области потока\n");
+        queue->stop = 1;
+    }
+
+    /* при отбрасывании повторов номера раздаются, пока главный поток не остановит очередь */
+    while (!queue->stop && (options->dedup != NULL || queue->next_ticket < options->count))
+    {
+        long long ticket_attempts;
+        long long reported;
+        long long first_attempt;
+        long long attempt;
+        long long score;
+        double ticket_start;
+        double seconds;
+        int result;
+        int tier;
+
+        ticket = queue->next_ticket++;
+        mutex_unlock(&queue->lock);
+
+        result = WINDROSE_ERROR_ATTEMPTS;
+        ticket_attempts = 0;
+        reported = 0;
+        ticket_start = get_time_sec();
+        /* начальная попытка задаётся только для первого поля (повторная генерация по -a) */
+        first_attempt = ticket == 0 ? options->first_attempt : 1;
+
+        while (result == WINDROSE_ERROR_ATTEMPTS && ticket_attempts < max_attempts)
+        {
+            long long chunk;
+            int stop;
+
+            chunk = BATCH_STOP_CHECK < max_attempts - ticket_attempts ? BATCH_STOP_CHECK : max_attempts - ticket_attempts;
+            result = windrose_generate(options->rows, options->cols, options->engine, options->seed,
+                options->first_index + ticket, first_attempt + ticket_attempts, chunk,
+                workspace, workspace_size, cells, &attempt);
+            ticket_attempts = result == WINDROSE_OK ? attempt - first_attempt + 1 : ticket_attempts + chunk;
+
+            if (result == WINDROSE_ERROR_ATTEMPTS)
+            {
+                mutex_lock(&queue->lock);
+                queue->attempts += ticket_attempts - reported;
+                reported = ticket_attempts;
+                stop = queue->stop;
+                mutex_unlock(&queue->lock);
+
+                if (stop)
+                {
+                    break;
+                }
+            }
+        }
+
+        /* время поиска без ожидания свободной ячейки очереди */
+        seconds = get_time_sec() - ticket_start;
+        tier = 0;
+        score = 0;
+
+        if (result == WINDROSE_OK)
+        {
+            tier = windrose_rate(options->rows, options->cols, cells, workspace, workspace_size, &score);
+        }
+
+        mutex_lock(&queue->lock);
+        queue->attempts += ticket_attempts - reported;
+
+        if (result != WINDROSE_OK)
+        {
+            queue->stop = 1;
+            break;
+        }
+
+        while (!queue->stop && ticket >= queue->next_write + queue->capacity)
+        {
+            cond_wait(&queue->slot_free, &queue->lock);
+        }
+
+        if (queue->stop)
+        {
+            break;
+        }
+
+        field_from_cells(queue->slots[ticket % queue->capacity].puzzle, cells);
+        queue->slots[ticket % queue->capacity].attempt = attempt;
+        queue->slots[ticket % queue->capacity].seconds = seconds;
+        queue->slots[ticket % queue->capacity].tier = tier;
+        queue->slots[ticket % queue->capacity].score = score;
+        queue->slots[ticket % queue->capacity].is_ready = 1;
+        cond_broadcast(&queue->slot_ready);
+    }
+
+    queue->allocs += alloc_count - allocs;
+    add_gen_stats(&queue->stats, &gen_stats);
+    queue->workers_alive--;
+    cond_broadcast(&queue->slot_ready);
+    mutex_unlock(&queue->lock);
+
+    free(workspace);
+    free(cells);
+
+    return THREAD_RETURN;
+}
+
+/**
+* Разбирает аргументы командной строки режима замера
+* Формат: --bench [-s <seed>] [-b <секунд на размер>] [-o <файл>] [-e rejection|constructive]
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @param options структура, в которую записываются параметры
+* @return 0 при успешном разборе, -1 при ошибке в аргументах
+*/
+int parse_bench_options(int argc, char* argv[], BenchOptions* options)
+{
+    options->seed = BENCH_DEFAULT_SEED;
+    options->budget = BENCH_DEFAULT_BUDGET;
+    options->output = NULL;
+    options->engine = ENGINE_REJECTION;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("Ошибка: для ключа %s не указано значение.\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            options->seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            options->budget = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            options->output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            i++;
+
+            if (strcmp(argv[i], "rejection") == 0)
+            {
+                options->engine = ENGINE_REJECTION;
+            }
+            else if (strcmp(argv[i], "constructive") == 0)
+            {
+                options->engine = ENGINE_CONSTRUCTIVE;
+            }
+            else
+            {
+                printf("Ошибка: неизвестный способ генерации %s.\n", argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("Ошибка: неизвестный ключ %s.\n", argv[i]);
+            printf("Использование: %s --bench [-s <seed>] [-b <секунд на размер>] [-o <файл>] [-e rejection|constructive]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (options->budget <= 0.0)
+    {
+        printf("Ошибка: время замера должно быть положительным.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Замер скорости этапов генерации для всех размеров поля
+* от MIN_FIELD_SIZE до MAX_FIELD_SIZE (квадратные поля). Для каждого размера
+* генератор случайных чисел инициализируется seed + размер, поэтому повторный
+* запуск проходит те же попытки. Результат — строки CSV с заголовком
+* (в файл options->output или в стандартный вывод)
+* @param options параметры замера
+* @return 0 при успехе, -4 если файл открыть не удалось
+*/
+int run_bench(BenchOptions* options)
+{
+    FILE* out;
+
+    out = stdout;
+
+    if (options->output != NULL)
+    {
+        out = fopen(options->output, "w");
+        if (out == NULL)
+        {
+            printf("Ошибка открытия файла!\n");
+            return -4;
+        }
+    }
+
+    fprintf(out, "rows,cols,seed,engine,attempts,accepted,attempts_per_puzzle,generate_ns,solve_ns,draw_line_ns,is_fully_covered_ns,write_field_ns,allocs_per_attempt,"
+        "rejected_boxed,rejected_uncovered,rejected_dead_end,rejected_unsolvable,rejected_ambiguous\n");
+
+    for (int size = MIN_FIELD_SIZE; size <= MAX_FIELD_SIZE; size++)
+    {
+        bench_size(options, size, out);
+        fflush(out);
+    }
+
+    arena_destroy(&scratch);
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    return 0;
+}
+
+/**
+* Замеряет этапы генерации для поля size x size и выводит одну строку CSV
+* 1) попытки генерации (generate_field) и проверка единственности решения
+*    (is_solvable) в течение options->budget секунд: время на попытку и на
+*    одну проверку, попыток на принятое поле, выделений памяти на попытку
+*    (вместе с проверкой) и число отказов по причинам (gen_stats);
+*    если не принято ни одного поля, attempts_per_puzzle = -1;
+* 2) draw_line: линии всех чёрных клеток на BENCH_BOARDS заранее
+*    расставленных полях, время на один вызов;
+* 3) is_fully_covered на тех же полях после проведения линий;
+* 4) write_field (запись поля в файл, как в save_to_file, но без сообщения
+*    в консоль) во временный файл
+* Если за отведённое время не получилось ни одного поля, для записи
+* берётся поле конструктивной генерации
+* @param options параметры замера
+* @param size размер поля
+* @param out поток для вывода результата
+* @return 0
+*/
+int bench_size(BenchOptions* options, int size, FILE* out)
+{
+    static Bitboard boards[BENCH_BOARDS];
+    static Point blacks[BENCH_BOARDS][MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+    int black_counts[BENCH_BOARDS];
+    GenStats stats;
+    Field* sample;
+    FILE* sink_file;
+    Rng rng;
+    int has_sample;
+    long long attempts;
+    long long solved;
+    long long accepted;
+    long long allocs;
+    long long draw_calls;
+    double generate_time;
+    double solve_time;
+    double draw_time;
+    double cover_time;
+    double write_time;
+    double start;
+    double t0;
+    volatile int cover_sink;
+
+    rng_seed(&rng, (unsigned long long)options->seed + (unsigned long long)size);
+
+    attempts = 0;
+    solved = 0;
+    accepted = 0;
+    generate_time = 0.0;
+    solve_time = 0.0;
+    has_sample = 0;
+    sample = create_field(size, size);
+    arena_reserve(&scratch, scratch_size(size, size));
+    allocs = alloc_count;
+    memset(&gen_stats, 0, sizeof(gen_stats));
+    start = get_time_sec();
+    t0 = start;
+
+    while (t0 - start < options->budget)
+    {
+        Field* puzzle;
+        double t1;
+
+        arena_release(&scratch, 0);
+        puzzle = generate_field(size, size, options->engine, &rng);
+        t1 = get_time_sec();
+        generate_time += t1 - t0;
+        t0 = t1;
+        attempts++;
+
+        if (puzzle != NULL)
+        {
+            int is_unique = is_solvable(puzzle);
+
+            t0 = get_time_sec();
+            solve_time += t0 - t1;
+            solved++;
+
+            if (is_unique)
+            {
+                accepted++;
+            }
+
+            if (!has_sample && sample != NULL)
+            {
+                copy_field(sample, puzzle);
+                has_sample = 1;
+            }
+
+            free_field(puzzle);
+        }
+    }
+
+    allocs = alloc_count - allocs;
+    stats = gen_stats;
+
+    for (int b = 0; b < BENCH_BOARDS; b++)
+    {
+        int count = pick_black_count(size, size, options->engine, &rng);
+        int placed = 0;
+
+        if (count > size * size)
+        {
+            count = size * size;
+        }
+
+        bitboard_init(&boards[b], size, size);
+
+        while (placed < count)
+        {
+            int x = rng_range(&rng, size);
+            int y = rng_range(&rng, size);
+
+            if (!bitboard_is_set(&boards[b], x, y))
+            {
+                bitboard_set(&boards[b], x, y);
+                blacks[b][placed].x = x;
+                blacks[b][placed].y = y;
+                placed++;
+            }
+        }
+
+        black_counts[b] = count;
+    }
+
+    draw_calls = 0;
+    start = get_time_sec();
+
+    for (int b = 0; b < BENCH_BOARDS; b++)
+    {
+        for (int i = 0; i < black_counts[b]; i++)
+        {
+            for (int d = 0; d < 4; d++)
+            {
+                draw_line(&boards[b], blacks[b][i].x, blacks[b][i].y, d, &rng);
+            }
+        }
+
+        draw_calls += black_counts[b] * 4;
+    }
+
+    draw_time = get_time_sec() - start;
+
+    cover_sink = 0;
+    start = get_time_sec();
+
+    for (int r = 0; r < BENCH_REPEAT; r++)
+    {
+        for (int b = 0; b < BENCH_BOARDS; b++)
+        {
+            cover_sink += is_fully_covered(&boards[b]);
+        }
+    }
+
+    cover_time = get_time_sec() - start;
+
+    while (!has_sample && sample != NULL)
+    {
+        Field* puzzle;
+
+        arena_release(&scratch, 0);
+        puzzle = generate_puzzle_constructive(size, size, pick_black_count(size, size, ENGINE_CONSTRUCTIVE, &rng), &rng);
+
+        if (puzzle != NULL)
+        {
+            copy_field(sample, puzzle);
+            free_field(puzzle);
+            has_sample = 1;
+        }
+    }
+
+    arena_release(&scratch, 0);
+    write_time = 0.0;
+    sink_file = has_sample ? tmpfile() : NULL;
+
+    if (sink_file != NULL)
+    {
+        start = get_time_sec();
+
+        for (int r = 0; r < BENCH_REPEAT; r++)
+        {
+            write_field(sink_file, sample);
+        }
+
+        fflush(sink_file);
+        write_time = get_time_sec() - start;
+        fclose(sink_file);
+    }
+
+    free_field(sample);
+
+    fprintf(out, "%d,%d,%u,%s,%lld,%lld,%.2f,%.1f,%.1f,%.2f,%.2f,%.1f,%.3f,%lld,%lld,%lld,%lld,%lld\n",
+        size, size, options->seed + (unsigned int)size,
+        options->engine == ENGINE_CONSTRUCTIVE ? "constructive" : "rejection",
+        attempts, accepted,
+        accepted > 0 ? (double)attempts / (double)accepted : -1.0,
+        attempts > 0 ? generate_time * 1e9 / (double)attempts : 0.0,
+        solved > 0 ? solve_time * 1e9 / (double)solved : 0.0,
+        draw_calls > 0 ? draw_time * 1e9 / (double)draw_calls : 0.0,
+        cover_time * 1e9 / (double)(BENCH_REPEAT * BENCH_BOARDS),
+        write_time * 1e9 / (double)BENCH_REPEAT,
+        attempts > 0 ? (double)allocs / (double)attempts : 0.0,
+        stats.rejected_boxed, stats.rejected_uncovered, stats.rejected_dead_end,
+        stats.rejected_unsolvable, stats.rejected_ambiguous);
+
+    return 0;
+}
+
+/**
+* Разбирает аргументы командной строки режима подбора плотности
+* Формат: --tune [-r <строки> -c <столбцы>] [-s <seed>] [-b <секунд на размер>] [-o <файл>]
+* [-e rejection|constructive]
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @param options структура, в которую записываются параметры
+* @return 0 при успешном разборе, -1 при ошибке в аргументах
+*/
+int parse_tune_options(int argc, char* argv[], TuneOptions* options)
+{
+    options->rows = 0;
+    options->cols = 0;
+    options->seed = TUNE_DEFAULT_SEED;
+    options->budget = TUNE_DEFAULT_BUDGET;
+    options->output = DENSITY_FILENAME;
+    options->engine = ENGINE_REJECTION;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("Ошибка: для ключа %s не указано значение.\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            options->rows = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            options->cols = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            options->seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            options->budget = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            options->output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            i++;
+
+            if (strcmp(argv[i], "rejection") == 0)
+            {
+                options->engine = ENGINE_REJECTION;
+            }
+            else if (strcmp(argv[i], "constructive") == 0)
+            {
+                options->engine = ENGINE_CONSTRUCTIVE;
+            }
+            else
+            {
+                printf("Ошибка: неизвестный способ генерации %s.\n", argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("Ошибка: неизвестный ключ %s.\n", argv[i]);
+            printf("Использование: %s --tune [-r <строки> -c <столбцы>] [-s <seed>] [-b <секунд на размер>] [-o <файл>] [-e rejection|constructive]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if ((options->rows == 0) != (options->cols == 0))
+    {
+        printf("Ошибка: размеры поля задаются вместе (-r и -c).\n");
+        return -1;
+    }
+
+    if (options->rows != 0 && (options->rows < MIN_FIELD_SIZE || options->cols < MIN_FIELD_SIZE
+        || options->rows > MAX_FIELD_SIZE || options->cols > MAX_FIELD_SIZE))
+    {
+        printf("Ошибка: размеры должны быть в диапазоне от 3 до 12.\n");
+        return -1;
+    }
+
+    if (options->budget <= 0.0)
+    {
+        printf("Ошибка: время подбора должно быть положительным.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Подбирает плотность чёрных клеток для поля options->rows x options->cols
+* (или для всех размеров от MIN_FIELD_SIZE до MAX_FIELD_SIZE, если размер не задан),
+* записывает найденные диапазоны в density_table и сохраняет всю таблицу
+* в options->output. Перед подбором загружает options->output, поэтому
+* записи для других размеров и способов генерации сохраняются
+* @param options параметры подбора
+* @return 0 при успехе, -4 если файл результата открыть не удалось
+*/
+int run_tune(TuneOptions* options)
+{
+    density_load(options->output);
+
+    printf("Подбор плотности чёрных клеток (%s), %.1f с на размер\n",
+        options->engine == ENGINE_CONSTRUCTIVE ? "constructive" : "rejection", options->budget);
+
+    if (options->rows != 0)
+    {
+        tune_size(options, options->rows, options->cols);
+    }
+    else
+    {
+        for (int rows = MIN_FIELD_SIZE; rows <= MAX_FIELD_SIZE; rows++)
+        {
+            for (int cols = MIN_FIELD_SIZE; cols <= MAX_FIELD_SIZE; cols++)
+            {
+                tune_size(options, rows, cols);
+            }
+        }
+    }
+
+    if (density_save(options->output) != 0)
+    {
+        return -4;
+    }
+
+    printf("Таблица плотности сохранена в файл: %s\n", options->output);
+
+    return 0;
+}
+
+/**
+* Подбирает количество чёрных клеток для поля rows x cols методом
+* последовательного отсева:
+* 1) кандидаты — все количества от 1 до 2/3 площади поля;
+* 2) в каждом раунде все оставшиеся кандидаты получают поровну времени
+*    (tune_measure), результаты раундов складываются; лучшая половина
+*    (tune_is_better) переходит в следующий раунд, пока не останется
+*    TUNE_KEEP кандидатов;
+* 3) последний раунд уточняет оставшихся; в таблицу записывается диапазон
+*    от наименьшего до наибольшего количества среди тех, кто даёт не меньше
+*    3/4 полей в секунду лучшего
+* Бюджет options->budget делится поровну между раундами и замером прежней
+* плотности (pick_black_count до подбора). Если ни одного поля не принято
+* или прежняя плотность не хуже лучшего кандидата, таблица не меняется
+* @param options параметры подбора
+* @param rows количество строк
+* @param cols количество столбцов
+* @return 1 если запись таблицы обновлена, 0 если нет
+*/
+int tune_size(TuneOptions* options, int rows, int cols)
+{
+    TuneCandidate candidates[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+    TuneCandidate baseline;
+    DensityEntry* entry;
+    TuneCandidate* best;
+    Rng rng;
+    double round_budget;
+    double best_rate;
+    int count;
+    int alive;
+    int rounds;
+
+    rng_seed(&rng, (unsigned long long)options->seed + (unsigned long long)(rows * (MAX_FIELD_SIZE + 1) + cols));
+
+    count = rows * cols * 2 / 3;
+    memset(candidates, 0, sizeof(candidates));
+
+    for (int i = 0; i < count; i++)
+    {
+        candidates[i].black_count = i + 1;
+    }
+
+    rounds = 1;
+
+    for (alive = count; alive > TUNE_KEEP; alive = (alive + 1) / 2)
+    {
+        rounds++;
+    }
+
+    round_budget = options->budget / (double)(rounds + 1);
+
+    memset(&baseline, 0, sizeof(baseline));
+    tune_measure(&baseline, rows, cols, options->engine, round_budget, &rng);
+
+    alive = count;
+
+    for (int round = 0; round < rounds; round++)
+    {
+        for (int i = 0; i < alive; i++)
+        {
+            tune_measure(&candidates[i], rows, cols, options->engine, round_budget / (double)alive, &rng);
+        }
+
+        for (int i = 1; i < alive; i++)
+        {
+            TuneCandidate current = candidates[i];
+            int j = i;
+
+            while (j > 0 && tune_is_better(&current, &candidates[j - 1]))
+            {
+                candidates[j] = candidates[j - 1];
+                j--;
+            }
+
+            candidates[j] = current;
+        }
+
+        if (alive > TUNE_KEEP)
+        {
+            alive = (alive + 1) / 2;
+        }
+    }
+
+    best = &candidates[0];
+    entry = &density_table[options->engine][rows][cols];
+
+    if (best->accepted == 0)
+    {
+        printf("%2d x %-2d: принятых полей нет, таблица не изменена\n", rows, cols);
+        return 0;
+    }
+
+    best_rate = (double)best->accepted / best->time;
+
+    if ((double)baseline.accepted / baseline.time >= best_rate)
+    {
+        printf("%2d x %-2d: прежняя плотность не хуже (%.1f полей/с), таблица не изменена\n",
+            rows, cols, (double)baseline.accepted / baseline.time);
+        return 0;
+    }
+
+    entry->min = best->black_count;
+    entry->max = best->black_count;
+    entry->rate = best_rate;
+
+    for (int i = 1; i < alive; i++)
+    {
+        if ((double)candidates[i].accepted / candidates[i].time * 4.0 >= best_rate * 3.0)
+        {
+            if (candidates[i].black_count < entry->min)
+            {
+                entry->min = candidates[i].black_count;
+            }
+
+            if (candidates[i].black_count > entry->max)
+            {
+                entry->max = candidates[i].black_count;
+            }
+        }
+    }
+
+    printf("%2d x %-2d: чёрных клеток %d..%d, %.1f полей/с (было %.1f полей/с)\n",
+        rows, cols, entry->min, entry->max, best_rate, (double)baseline.accepted / baseline.time);
+
+    return 1;
+}
+
+/**
+* Генерирует поля rows x cols с количеством чёрных клеток candidate->black_count
+* (0 — по pick_black_count) в течение seconds секунд и прибавляет к кандидату
+* число попыток, покрытых полей, принятых полей (с единственным решением) и время
+* @param candidate замеряемый кандидат
+* @param rows количество строк
+* @param cols количество столбцов
+* @param engine способ генерации
+* @param seconds время замера
+* @param rng генератор случайных чисел
+* @return 0
+*/
+int tune_measure(TuneCandidate* candidate, int rows, int cols, int engine, double seconds, Rng* rng)
+{
+    double start;
+    double now;
+    size_t mark;
+
+    arena_reserve(&scratch, scratch_size(rows, cols));
+    mark = scratch.used;
+    start = get_time_sec();
+    now = start;
+
+    while (now - start < seconds)
+    {
+        Field* puzzle;
+
+        for (int i = 0; i < 16; i++)
+        {
+            if (candidate->black_count == 0)
+            {
+                puzzle = generate_field(rows, cols, engine, rng);
+            }
+            else if (engine == ENGINE_CONSTRUCTIVE)
+            {
+                puzzle = generate_puzzle_constructive(rows, cols, candidate->black_count, rng);
+            }
+            else
+            {
+                puzzle = generate_puzzle(rows, cols, candidate->black_count, rng);
+            }
+
+            candidate->attempts++;
+
+            if (puzzle != NULL)
+            {
+                candidate->generated++;
+
+                if (is_solvable(puzzle))
+                {
+                    candidate->accepted++;
+                }
+
+                free_field(puzzle);
+            }
+
+            arena_release(&scratch, mark);
+        }
+
+        now = get_time_sec();
+    }
+
+    candidate->time += now - start;
+
+    return 0;
+}
+
+/**
+* Сравнивает двух кандидатов подбора по числу принятых полей в секунду;
+* пока принятых полей нет ни у одного — по числу покрытых полей в секунду
+* (покрытие — необходимое условие принятия)
+* @param a первый кандидат
+* @param b второй кандидат
+* @return 1 если a лучше b, иначе 0
+*/
+int tune_is_better(TuneCandidate* a, TuneCandidate* b)
+{
+    if (a->accepted > 0 || b->accepted > 0)
+    {
+        return (double)a->accepted * b->time > (double)b->accepted * a->time;
+    }
+
+    return (double)a->generated * b->time > (double)b->generated * a->time;
+}
+
+/**
+* Разбирает аргументы командной строки режима преобразования
+* Формат: --convert <вход> <выход> [-i <номер первого поля>] [-n <количество>]
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @param options структура, в которую записываются параметры
+* @return 0 при успешном разборе, -1 при ошибке в аргументах
+*/
+int parse_convert_options(int argc, char* argv[], ConvertOptions* options)
+{
+    options->first = 0;
+    options->count = -1;
+
+    if (argc < 4)
+    {
+        printf("Использование: %s --convert <вход> <выход> [-i <номер>] [-n <количество>]\n", argv[0]);
+        return -1;
+    }
+
+    options->input = argv[2];
+    options->output = argv[3];
+
+    for (int i = 4; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("Ошибка: для ключа %s не указано значение.\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-i") == 0)
+        {
+            options->first = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            options->count = atoll(argv[++i]);
+        }
+        else
+        {
+            printf("Ошибка: неизвестный ключ %s.\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (options->first < 0 || options->count == 0 || options->count < -1)
+    {
+        printf("Ошибка: номер поля не может быть отрицательным, количество должно быть положительным.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Преобразует поля между текстовым форматом (раздел 7) и двоичной библиотекой
+* Если входной файл — библиотека (library_open), поля с номерами first..first+count-1
+* выгружаются в текстовый файл, иначе текстовый файл отображается в память и разбирается
+* (parse_field), а поля
+* с этими номерами записываются в библиотеку. Все поля текстового файла должны
+* быть одного размера; ширина клетки выбирается по наибольшему числу в них
+* @param options параметры преобразования
+* @return 0 при успехе, -1 при ошибке формата входного файла, -4 если файл открыть
+* не удалось, -6 при ошибке выделения памяти
+*/
+int run_convert(ConvertOptions* options)
+{
+    LibraryReader reader;
+    LibraryWriter writer;
+    MappedFile map;
+    FILE* file;
+    Field* field;
+    const char* cursor;
+    const char* end;
+    long long index;
+    long long converted;
+    long long last;
+    double start_time;
+    int result;
+    int rows;
+    int cols;
+    int max_clue;
+
+    start_time = get_time_sec();
+    last = options->count < 0 ? -1 : options->first + options->count;
+    converted = 0;
+    result = library_open(&reader, options->input);
+
+    if (result == 0)
+    {
+        field = create_field((int)reader.header.rows, (int)reader.header.cols);
+        file = fopen(options->output, "w");
+
+        if (field == NULL || file == NULL)
+        {
+            printf(file == NULL ? "Ошибка открытия файла!\n" : "Ошибка выделения памяти\n");
+            free_field(field);
+            library_close(&reader);
+
+            if (file != NULL)
+            {
+                fclose(file);
+            }
+
+            return field == NULL ? -6 : -4;
+        }
+
+        setvbuf(file, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+
+        /* записи читаются по номеру прямо из отображения файла */
+        for (index = options->first; (last < 0 || index < last) && library_get(&reader, index, field) == 0; index++)
+        {
+            if (converted > 0)
+            {
+                fprintf(file, "\n");
+            }
+
+            write_field(file, field);
+            converted++;
+        }
+
+        printf("Библиотека %s: %u x %u, %u бит на клетку, полей: %llu\n", options->input,
+            reader.header.rows, reader.header.cols, reader.header.cell_bits, reader.header.count);
+        printf("Выгружено полей в текстовый файл %s: %lld\n", options->output, converted);
+
+        fclose(file);
+        free_field(field);
+        library_close(&reader);
+    }
+    else if (result == -4)
+    {
+        printf("Ошибка открытия файла!\n");
+        return -4;
+    }
+    else
+    {
+        if (file_map(&map, options->input) != 0)
+        {
+            printf("Ошибка открытия файла!\n");
+            return -4;
+        }
+
+        cursor = map.data;
+        end = map.data + map.size;
+
+        /* первый проход: размер полей и наибольшее число в клетке */
+        rows = 0;
+        cols = 0;
+        max_clue = 0;
+
+        for (index = 0; (result = parse_field(&cursor, end, &field)) == 1; index++)
+        {
+            if (index == 0)
+            {
+                rows = field->rows;
+                cols = field->cols;
+            }
+
+            if (field->rows != rows || field->cols != cols)
+            {
+                printf("Ошибка: поле %lld имеет размер %d x %d, а не %d x %d.\n", index, field->rows, field->cols, rows, cols);
+                result = -2;
+                free_field(field);
+                break;
+            }
+
+            for (int i = 0; i < rows; i++)
+            {
+                for (int j = 0; j < cols; j++)
+                {
+                    max_clue = FIELD_AT(field, i, j) > max_clue ? FIELD_AT(field, i, j) : max_clue;
+                }
+            }
+
+            free_field(field);
+        }
+
+        if (result < 0 || index == 0)
+        {
+            if (result == -1)
+            {
+                printf("Ошибка формата: поле %lld в файле %s прочитать не удалось.\n", index, options->input);
+            }
+            else if (result == 0)
+            {
+                printf("Ошибка: в файле %s нет полей.\n", options->input);
+            }
+
+            file_unmap(&map);
+            return -1;
+        }
+
+        result = library_create(&writer, options->output, rows, cols, max_clue);
+        if (result != 0)
+        {
+            printf(result == -4 ? "Ошибка открытия файла!\n" : "Ошибка выделения памяти\n");
+            file_unmap(&map);
+            return result;
+        }
+
+        cursor = map.data;
+
+        for (index = 0; parse_field(&cursor, end, &field) == 1; index++)
+        {
+            result = 0;
+
+            if (index >= options->first && (last < 0 || index < last))
+            {
+                result = library_append(&writer, field);
+                converted += result == 0;
+            }
+
+            free_field(field);
+
+            if (result != 0)
+            {
+                if (result == -4)
+                {
+                    printf("Ошибка записи файла %s\n", options->output);
+                }
+                else
+                {
+                    printf("Ошибка: поле %lld не помещается в библиотеку %s.\n", index, options->output);
+                }
+
+                file_unmap(&map);
+                library_finish(&writer);
+                return result;
+            }
+        }
+
+        file_unmap(&map);
+
+        if (library_finish(&writer) != 0)
+        {
+            printf("Ошибка записи файла %s\n", options->output);
+            return -4;
+        }
+
+        printf("Записано полей в библиотеку %s: %lld (%d x %d, %u бит на клетку)\n", options->output,
+            converted, rows, cols, writer.header.cell_bits);
+    }
+
+    printf("Время: %.3f с\n", get_time_sec() - start_time);
+
+    return 0;
+}
+
+/**
+* Разбирает аргументы командной строки режима проверки
+* Формат: --validate <каталог или файл> [-t <потоки>] [-o <файл отчёта>]
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @param options структура, в которую записываются параметры
+* @return 0 при успешном разборе, -1 при ошибке в аргументах
+*/
+int parse_validate_options(int argc, char* argv[], ValidateOptions* options)
+{
+    options->output = NULL;
+    options->threads = cpu_count();
+
+    if (argc < 3)
+    {
+        printf("Использование: %s --validate <каталог или файл> [-t <потоки>] [-o <файл отчёта>]\n", argv[0]);
+        return -1;
+    }
+
+    options->path = argv[2];
+
+    for (int i = 3; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("Ошибка: для ключа %s не указано значение.\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-t") == 0)
+        {
+            options->threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            options->output = argv[++i];
+        }
+        else
+        {
+            printf("Ошибка: неизвестный ключ %s.\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (options->threads <= 0)
+    {
+        printf("Ошибка: число потоков должно быть положительным.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Перечисляет обычные файлы каталога (без подкаталогов и скрытых файлов)
+* в порядке имён
+* @param path каталог
+* @param names сюда записывается массив путей «каталог/имя»; его и строки освобождает вызывающий
+* @return количество файлов, -4 если каталог открыть не удалось, -6 при ошибке выделения памяти
+*/
+int list_directory(char* path, char*** names)
+{
+    char** list;
+    int count;
+    int capacity;
+    int result;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find;
+    char pattern[MAX_PATH];
+#else
+    struct dirent* entry;
+    DIR* dir;
+#endif
+
+    list = NULL;
+    count = 0;
+    capacity = 0;
+    result = 0;
+
+#ifdef _WIN32
+    snprintf(pattern, sizeof(pattern), "%s\\*", path);
+    find = FindFirstFileA(pattern, &entry);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return -4;
+    }
+
+    do
+    {
+        char* name = entry.cFileName;
+
+        if (name[0] == '.' || (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+        {
+            continue;
+        }
+#else
+    dir = opendir(path);
+    if (dir == NULL)
+    {
+        return -4;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char* name = entry->d_name;
+        struct stat info;
+#endif
+        char* full;
+        size_t len;
+
+        len = strlen(path) + strlen(name) + 2;
+        full = (char*)malloc(len);
+
+        if (full == NULL)
+        {
+            result = -6;
+            break;
+        }
+
+        snprintf(full, len, "%s/%s", path, name);
+
+#ifndef _WIN32
+        if (name[0] == '.' || stat(full, &info) != 0 || !S_ISREG(info.st_mode))
+        {
+            free(full);
+            continue;
+        }
+#endif
+
+        if (count == capacity)
+        {
+            char** grown;
+
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            grown = (char**)realloc(list, (size_t)capacity * sizeof(char*));
+
+            if (grown == NULL)
+            {
+                free(full);
+                result = -6;
+                break;
+            }
+
+            list = grown;
+        }
+
+        list[count++] = full;
+#ifdef _WIN32
+    } while (FindNextFileA(find, &entry));
+
+    FindClose(find);
+#else
+    }
+
+    closedir(dir);
+#endif
+
+    if (result != 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            free(list[i]);
+        }
+
+        free(list);
+        return result;
+    }
+
+    /* сортировка вставками: отчёт не зависит от порядка файлов в каталоге */
+    for (int i = 1; i < count; i++)
+    {
+        char* name = list[i];
+        int k = i - 1;
+
+        while (k >= 0 && strcmp(list[k], name) > 0)
+        {
+            list[k + 1] = list[k];
+            k--;
+        }
+
+        list[k + 1] = name;
+    }
+
+    *names = list;
+
+    return count;
+}
+
+/**
+* Открывает файл и добавляет его поля в очередь проверки
+* Библиотека даёт по заданию на запись; текстовый файл отображается в память
+* и просматривается без создания полей (parse_field с field == NULL), чтобы найти
+* начала полей. Поле с ошибкой формата тоже становится заданием (его результат —
+* VALIDATE_BAD_FORMAT), после него файл дальше не просматривается
+* @param queue очередь проверки (files[file].name уже заполнено)
+* @param file номер файла
+* @param capacity текущий размер массива queue->jobs, увеличивается при необходимости
+* @return 0 при успехе, -4 если файл открыть не удалось, -6 при ошибке выделения памяти
+*/
+int validate_add_file(ValidateQueue* queue, int file, long long* capacity)
+{
+    ValidateFile* entry;
+    const char* cursor;
+    const char* end;
+    long long count;
+    int result;
+
+    entry = &queue->files[file];
+    entry->first_job = queue->job_count;
+    entry->jobs = 0;
+    entry->max_rows = MIN_FIELD_SIZE;
+    entry->max_cols = MIN_FIELD_SIZE;
+
+    result = library_open(&entry->reader, entry->name);
+    entry->is_library = result == 0;
+
+    if (result == -4 || (result == -1 && file_map(&entry->reader.map, entry->name) != 0))
+    {
+        return -4;
+    }
+
+    if (entry->is_library)
+    {
+        entry->max_rows = (int)entry->reader.header.rows;
+        entry->max_cols = (int)entry->reader.header.cols;
+        count = (long long)entry->reader.header.count;
+    }
+    else
+    {
+        count = 0;
+    }
+
+    cursor = entry->reader.map.data;
+    end = cursor + entry->reader.map.size;
+
+    for (long long i = 0; !entry->is_library || i < count; i++)
+    {
+        long long offset = i;
+
+        if (!entry->is_library)
+        {
+            const char* header;
+            int rows;
+            int cols;
+
+            cursor = scan_space(cursor, end);
+            if (cursor == end)
+            {
+                break;
+            }
+
+            offset = (long long)(cursor - entry->reader.map.data);
+            header = cursor;
+
+            if (scan_number(&header, end, &rows) == 0 && scan_number(&header, end, &cols) == 0)
+            {
+                entry->max_rows = rows > entry->max_rows && rows <= LARGE_MAX_SIZE ? rows : entry->max_rows;
+                entry->max_cols = cols > entry->max_cols && cols <= LARGE_MAX_SIZE ? cols : entry->max_cols;
+            }
+
+            /* поле с ошибкой формата проверяется ещё раз в рабочем потоке и попадает в отчёт */
+            if (parse_field(&cursor, end, NULL) != 1)
+            {
+                cursor = end;
+            }
+        }
+
+        if (queue->job_count == *capacity)
+        {
+            ValidateJob* grown;
+
+            *capacity = *capacity > 0 ? *capacity * 2 : 1024;
+            grown = (ValidateJob*)realloc(queue->jobs, (size_t)*capacity * sizeof(ValidateJob));
+
+            if (grown == NULL)
+            {
+                return -6;
+            }
+
+            queue->jobs = grown;
+        }
+
+        queue->jobs[queue->job_count].file = file;
+        queue->jobs[queue->job_count].offset = offset;
+        queue->job_count++;
+        entry->jobs++;
+    }
+
+    return 0;
+}
+
+/**
+* Рабочий поток режима проверки
+* Берёт задания очереди порциями по VALIDATE_CHUNK, разбирает поле прямо
+* из отображения файла (library_get или parse_field) и считает его решения
+* (count_solutions, не больше SOLUTION_LIMIT). Поле и память решателя берутся
+* из рабочей области потока (scratch). Долгий подсчёт может занять
+* queue->split_threads потоков
+* @param arg указатель на ValidateQueue
+* @return THREAD_RETURN
+*/
+THREAD_FUNC validate_worker(void* arg)
+{
+    ValidateQueue* queue;
+
+    queue = (ValidateQueue*)arg;
+    split_threads = queue->split_threads;
+
+    for (;;)
+    {
+        long long first;
+        long long last;
+
+        mutex_lock(&queue->lock);
+        first = queue->next_job;
+        queue->next_job += VALIDATE_CHUNK;
+        mutex_unlock(&queue->lock);
+
+        if (first >= queue->job_count)
+        {
+            break;
+        }
+
+        last = first + VALIDATE_CHUNK < queue->job_count ? first + VALIDATE_CHUNK : queue->job_count;
+
+        for (long long k = first; k < last; k++)
+        {
+            ValidateJob* job = &queue->jobs[k];
+            ValidateFile* file = &queue->files[job->file];
+            Field* field;
+            int solutions;
+
+            arena_release(&scratch, 0);
+            arena_reserve(&scratch, scratch_size(file->max_rows, file->max_cols));
+
+            if (file->is_library)
+            {
+                field = create_scratch_field(file->max_rows, file->max_cols);
+
+                if (field != NULL && library_get(&file->reader, job->offset, field) != 0)
+                {
+                    field = NULL;
+                }
+            }
+            else
+            {
+                const char* cursor = file->reader.map.data + job->offset;
+
+                if (parse_field(&cursor, file->reader.map.data + file->reader.map.size, &field) != 1)
+                {
+                    field = NULL;
+                }
+            }
+
+            if (field == NULL)
+            {
+                queue->results[k] = VALIDATE_BAD_FORMAT;
+                continue;
+            }
+
+            solutions = count_solutions(field, SOLUTION_LIMIT);
+
+            if (solutions == 1)
+            {
+                queue->results[k] = VALIDATE_UNIQUE;
+            }
+            else if (solutions == 0)
+            {
+                queue->results[k] = VALIDATE_UNSOLVABLE;
+            }
+            else if (solutions > 1)
+            {
+                queue->results[k] = VALIDATE_AMBIGUOUS;
+            }
+            else
+            {
+                queue->results[k] = VALIDATE_BAD_FORMAT;
+            }
+
+            free_field(field);
+        }
+    }
+
+    arena_destroy(&scratch);
+
+    return THREAD_RETURN;
+}
+
+/**
+* Проверяет все поля в каталоге (каждый обычный файл) или в одном файле
+* Файлы могут быть текстовыми (формат раздела 7, в том числе несколько полей
+* в файле) или двоичными библиотеками. Поля проверяются options->threads
+* потоками (validate_worker); для каждого файла выводится, сколько полей
+* имеют единственное решение, несколько решений, ни одного, и сколько
+* не удалось разобрать, затем общая скорость проверки
+* @param options параметры проверки
+* @return 0 если все поля имеют единственное решение, -1 если есть неверные поля
+* или файлы, -4 если путь или файл отчёта открыть не удалось, -6 при ошибке
+* выделения памяти или создания потоков
+*/
+int run_validate(ValidateOptions* options)
+{
+    ValidateQueue queue;
+    thread_handle* threads;
+    char** names;
+    char* single[1];
+    FILE* out;
+    double elapsed;
+    double start_time;
+    long long capacity;
+    long long totals[VALIDATE_BAD_FORMAT + 1];
+    int file_count;
+    int started;
+    int result;
+
+    start_time = get_time_sec();
+    file_count = list_directory(options->path, &names);
+
+    if (file_count == -4)
+    {
+        /* не каталог — проверяется один файл */
+        single[0] = options->path;
+        names = single;
+        file_count = 1;
+    }
+    else if (file_count < 0)
+    {
+        printf("Ошибка выделения памяти\n");
+        return -6;
+    }
+
+    out = options->output != NULL ? fopen(options->output, "w") : stdout;
+    memset(&queue, 0, sizeof(queue));
+    memset(totals, 0, sizeof(totals));
+    queue.files = (ValidateFile*)calloc(file_count > 0 ? (size_t)file_count : 1, sizeof(ValidateFile));
+    threads = (thread_handle*)malloc((size_t)options->threads * sizeof(thread_handle));
+    capacity = 0;
+    started = 0;
+    result = out == NULL ? -4 : (queue.files == NULL || threads == NULL ? -6 : 0);
+
+    for (int i = 0; result == 0 && i < file_count; i++)
+    {
+        queue.files[i].name = names[i];
+        queue.files[i].status = validate_add_file(&queue, i, &capacity);
+
+        if (queue.files[i].status == -6)
+        {
+            result = -6;
+        }
+    }
+
+    if (result == 0)
+    {
+        queue.results = (signed char*)calloc(queue.job_count > 0 ? (size_t)queue.job_count : 1, 1);
+        result = queue.results != NULL ? 0 : -6;
+    }
+
+    if (result == 0)
+    {
+        /* полей меньше, чем потоков: свободные потоки помогают в долгих подсчётах */
+        queue.split_threads = queue.job_count > 0 && queue.job_count < options->threads
+            ? options->threads / (int)queue.job_count : 1;
+        mutex_init(&queue.lock);
+
+        for (int i = 0; i < options->threads; i++)
+        {
+            if (thread_create(&threads[i], validate_worker, &queue) != 0)
+            {
+                break;
+            }
+
+            started++;
+        }
+
+        for (int i = 0; i < started; i++)
+        {
+            thread_join(threads[i]);
+        }
+
+        mutex_destroy(&queue.lock);
+        result = started > 0 ? 0 : -6;
+    }
+
+    if (result == -4)
+    {
+        printf("Ошибка открытия файла!\n");
+    }
+    else if (result == -6)
+    {
+        printf(started == 0 && queue.results != NULL ? "Ошибка создания рабочих потоков\n" : "Ошибка выделения памяти\n");
+    }
+    else
+    {
+        elapsed = get_time_sec() - start_time;
+
+        if (elapsed <= 0.0)
+        {
+            elapsed = 1e-9;
+        }
+
+        for (int i = 0; i < file_count; i++)
+        {
+            ValidateFile* file = &queue.files[i];
+            signed char* results = queue.results + file->first_job;
+            long long counts[VALIDATE_BAD_FORMAT + 1];
+            int listed = 0;
+
+            if (file->status != 0)
+            {
+                fprintf(out, "%s: файл открыть не удалось\n", file->name);
+                result = -1;
+                continue;
+            }
+
+            memset(counts, 0, sizeof(counts));
+
+            for (long long k = 0; k < file->jobs; k++)
+            {
+                counts[results[k]]++;
+                totals[results[k]]++;
+            }
+
+            if (file->jobs == 1)
+            {
+                fprintf(out, "%s: %s\n", file->name,
+                    results[0] == VALIDATE_UNIQUE ? "верно (решение единственно)"
+                    : results[0] == VALIDATE_AMBIGUOUS ? "решение не единственно"
+                    : results[0] == VALIDATE_UNSOLVABLE ? "нет решения" : "ошибка формата");
+            }
+            else
+            {
+                fprintf(out, "%s: полей %lld, решение единственно %lld, не единственно %lld, нет решения %lld, ошибка формата %lld",
+                    file->name, file->jobs, counts[VALIDATE_UNIQUE], counts[VALIDATE_AMBIGUOUS],
+                    counts[VALIDATE_UNSOLVABLE], counts[VALIDATE_BAD_FORMAT]);
+
+                /* номера первых неверных полей (с 0), чтобы их можно было найти в файле */
+                for (long long k = 0; k < file->jobs && listed < VALIDATE_LIST; k++)
+                {
+                    if (results[k] != VALIDATE_UNIQUE)
+                    {
+                        fprintf(out, listed == 0 ? " (неверные: %lld" : ", %lld", k);
+                        listed++;
+                    }
+                }
+
+                fprintf(out, listed > 0 ? ")\n" : "\n");
+            }
+
+            if (file->jobs == 0 || counts[VALIDATE_UNIQUE] < file->jobs)
+            {
+                result = -1;
+            }
+        }
+
+        fprintf(out, "----------------------------------------\n");
+        fprintf(out, "Файлов: %d, полей: %lld, потоков: %d\n", file_count, queue.job_count, started);
+        fprintf(out, "Решение единственно: %lld, не единственно: %lld, нет решения: %lld, ошибка формата: %lld\n",
+            totals[VALIDATE_UNIQUE], totals[VALIDATE_AMBIGUOUS], totals[VALIDATE_UNSOLVABLE], totals[VALIDATE_BAD_FORMAT]);
+        fprintf(out, "Время: %.3f с\n", elapsed);
+        fprintf(out, "Полей в секунду: %.2f\n", (double)queue.job_count / elapsed);
+    }
+
+    for (int i = 0; queue.files != NULL && i < file_count; i++)
+    {
+        if (queue.files[i].name != NULL)
+        {
+            library_close(&queue.files[i].reader);
+        }
+    }
+
+    if (out != NULL && out != stdout)
+    {
+        fclose(out);
+    }
+
+    if (names != single)
+    {
+        for (int i = 0; i < file_count; i++)
+        {
+            free(names[i]);
+        }
+
+        free(names);
+    }
+
+    free(queue.files);
+    free(queue.jobs);
+    free(queue.results);
+    free(threads);
+
+    return result;
+}
+
+/**
+* Разбирает аргументы командной строки режима сервера
+* Формат: --serve <сокет> [-z <строки>x<столбцы>]... [-p <запас>] [-t <потоки>] [-s <seed>] [-e rejection|constructive]
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @param options структура, в которую записываются параметры
+* @return 0 при успешном разборе, -1 при ошибке в аргументах
+*/
+int parse_serve_options(int argc, char* argv[], ServeOptions* options)
+{
+    memset(options, 0, sizeof(*options));
+    options->depth = SERVE_DEFAULT_DEPTH;
+    options->threads = cpu_count();
+    options->engine = ENGINE_REJECTION;
+
+    if (argc < 3)
+    {
+        printf("Использование: %s --serve <сокет> [-z <строки>x<столбцы>]... [-p <запас>] [-t <потоки>] [-s <seed>] [-e rejection|constructive]\n", argv[0]);
+        return -1;
+    }
+
+    options->socket_path = argv[2];
+
+    for (int i = 3; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("Ошибка: для ключа %s не указано значение.\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-z") == 0)
+        {
+            int rows;
+            int cols;
+
+            int k;
+
+            if (sscanf(argv[++i], "%dx%d", &rows, &cols) != 2 || rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE
+                || rows > LARGE_MAX_SIZE || cols > LARGE_MAX_SIZE)
+            {
+                printf("Ошибка: размер %s должен быть вида <строки>x<столбцы>, от %d до %d.\n", argv[i], MIN_FIELD_SIZE, LARGE_MAX_SIZE);
+                return -1;
+            }
+
+            for (k = 0; k < options->size_count; k++)
+            {
+                if (options->size_rows[k] == rows && options->size_cols[k] == cols)
+                {
+                    break;
+                }
+            }
+
+            if (k == SERVE_SIZES)
+            {
+                printf("Ошибка: можно задать не больше %d размеров.\n", SERVE_SIZES);
+                return -1;
+            }
+
+            options->size_rows[k] = rows;
+            options->size_cols[k] = cols;
+            options->size_count += k == options->size_count;
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            options->depth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            options->threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            options->seed = strtoull(argv[++i], NULL, 10);
+            options->has_seed = 1;
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            i++;
+
+            if (strcmp(argv[i], "rejection") == 0)
+            {
+                options->engine = ENGINE_REJECTION;
+            }
+            else if (strcmp(argv[i], "constructive") == 0)
+            {
+                options->engine = ENGINE_CONSTRUCTIVE;
+            }
+            else
+            {
+                printf("Ошибка: неизвестный способ генерации %s.\n", argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("Ошибка: неизвестный ключ %s.\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (options->depth <= 0 || options->threads <= 0)
+    {
+        printf("Ошибка: запас полей и число потоков должны быть положительными.\n");
+        return -1;
+    }
+
+    for (int k = 0; k < options->size_count; k++)
+    {
+        if (!serve_can_generate(options->engine, options->size_rows[k], options->size_cols[k]))
+        {
+            printf("Ошибка: поле %dx%d способом rejection не генерируется (нет выученной плотности), используйте -e constructive.\n",
+                options->size_rows[k], options->size_cols[k]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#ifndef _WIN32
+/**
+* Сервер полей: слушает локальный сокет (AF_UNIX) и выдаёт поля по запросам
+* Для каждого размера поля держится запас из options->depth проверенных полей
+* (ServePool), который пополняют options->threads фоновых потоков (serve_generator).
+* Запросы обслуживают SERVE_HANDLERS потоков (serve_handler): поле берётся
+* из запаса, а если запас пуст — ищется на месте не дольше SERVE_MISS_BUDGET секунд
+* (иначе клиент получает BUSY). Главный поток принимает
+* соединения и раз в WAIT_SLICE_MS проверяет флаг остановки (Ctrl+C или SIGTERM).
+* Поле с номером index зависит только от (seed, rows, cols, index), как в пакетном режиме.
+* При остановке выводит счётчики запасов (serve_print_stats) и удаляет файл сокета
+* @param options параметры сервера
+* @return 0 при успехе, -1 при слишком длинном пути сокета, -4 если сокет открыть
+* не удалось, -6 при ошибке выделения памяти или создания потоков
+*/
+int run_serve(ServeOptions* options)
+{
+    ServeState state;
+    ServeHandler handlers[SERVE_HANDLERS];
+    thread_handle handler_threads[SERVE_HANDLERS];
+    thread_handle* generator_threads;
+    struct sockaddr_un address;
+    struct stat info;
+    int listener;
+    int generators;
+    int handler_count;
+    int result;
+
+    if (strlen(options->socket_path) >= sizeof(address.sun_path))
+    {
+        printf("Ошибка: слишком длинный путь сокета %s.\n", options->socket_path);
+        return -1;
+    }
+
+    if (!options->has_seed)
+    {
+        options->seed = (unsigned long long)time(NULL);
+        options->has_seed = 1;
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.options = options;
+    result = 0;
+
+    for (int i = 0; i < SERVE_HANDLERS; i++)
+    {
+        state.active[i] = -1;
+    }
+
+    for (int i = 0; i < options->size_count && result == 0; i++)
+    {
+        ServePool* pool = serve_open(&state, options->size_rows[i], options->size_cols[i]);
+
+        if (pool == NULL)
+        {
+            result = -6;
+        }
+        else
+        {
+            pool->is_pinned = 1;
+        }
+    }
+
+    generator_threads = (thread_handle*)malloc((size_t)options->threads * sizeof(thread_handle));
+    if (result != 0 || generator_threads == NULL)
+    {
+        printf("Ошибка выделения памяти\n");
+        result = -6;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, options->socket_path);
+    listener = -1;
+
+    if (result == 0)
+    {
+        /* сокет, оставшийся от прежнего запуска, удаляется */
+        if (stat(options->socket_path, &info) == 0 && S_ISSOCK(info.st_mode))
+        {
+            unlink(options->socket_path);
+        }
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0
+            || listen(listener, SERVE_BACKLOG) != 0)
+        {
+            printf("Ошибка: не удалось открыть сокет %s.\n", options->socket_path);
+            result = -4;
+        }
+    }
+
+    if (result != 0)
+    {
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+
+        for (int i = 0; i < SERVE_SIZES; i++)
+        {
+            serve_close(&state.pools[i]);
+        }
+
+        free(generator_threads);
+        return result;
+    }
+
+    mutex_init(&state.lock);
+    cond_init(&state.refill);
+    cond_init(&state.client_ready);
+    cancel_requested = 0;
+    signal(SIGINT, on_cancel_signal);
+    signal(SIGTERM, on_cancel_signal);
+    /* клиент может закрыть соединение, не дочитав ответ */
+    signal(SIGPIPE, SIG_IGN);
+
+    generators = 0;
+    handler_count = 0;
+
+    for (int i = 0; i < options->threads; i++)
+    {
+        if (thread_create(&generator_threads[generators], serve_generator, &state) != 0)
+        {
+            break;
+        }
+
+        generators++;
+    }
+
+    for (int i = 0; i < SERVE_HANDLERS; i++)
+    {
+        handlers[i].state = &state;
+        handlers[i].index = i;
+
+        if (thread_create(&handler_threads[handler_count], serve_handler, &handlers[i]) != 0)
+        {
+            break;
+        }
+
+        handler_count++;
+    }
+
+    if (handler_count == 0)
+    {
+        printf("Ошибка создания рабочих потоков\n");
+        cancel_requested = 1;
+        result = -6;
+    }
+    else
+    {
+        printf("Сервер запущен: сокет %s, seed %llu, потоков генерации %d, запас %d полей на размер\n",
+            options->socket_path, options->seed, generators, options->depth);
+        printf("Остановка — Ctrl+C\n");
+        fflush(stdout);
+    }
+
+    while (!cancel_requested)
+    {
+        struct pollfd waiter;
+        int client;
+
+        waiter.fd = listener;
+        waiter.events = POLLIN;
+        waiter.revents = 0;
+
+        if (poll(&waiter, 1, WAIT_SLICE_MS) <= 0)
+        {
+            continue;
+        }
+
+        client = accept(listener, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+
+        mutex_lock(&state.lock);
+
+        if (state.client_count == SERVE_BACKLOG)
+        {
+            mutex_unlock(&state.lock);
+            close(client);
+            continue;
+        }
+
+        state.clients[(state.client_head + state.client_count) % SERVE_BACKLOG] = client;
+        state.client_count++;
+        cond_broadcast(&state.client_ready);
+        mutex_unlock(&state.lock);
+    }
+
+    /* открытые соединения закрываются, чтобы потоки обслуживания не ждали запросов */
+    mutex_lock(&state.lock);
+    state.stop = 1;
+
+    for (int i = 0; i < SERVE_HANDLERS; i++)
+    {
+        if (state.active[i] >= 0)
+        {
+            shutdown(state.active[i], SHUT_RDWR);
+        }
+    }
+
+    cond_broadcast(&state.refill);
+    cond_broadcast(&state.client_ready);
+    mutex_unlock(&state.lock);
+
+    for (int i = 0; i < generators; i++)
+    {
+        thread_join(generator_threads[i]);
+    }
+
+    for (int i = 0; i < handler_count; i++)
+    {
+        thread_join(handler_threads[i]);
+    }
+
+    for (int k = 0; k < state.client_count; k++)
+    {
+        close(state.clients[(state.client_head + k) % SERVE_BACKLOG]);
+    }
+
+    close(listener);
+    unlink(options->socket_path);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    if (result == 0)
+    {
+        printf("Сервер остановлен\n");
+        serve_print_stats(&state, stdout);
+    }
+
+    for (int i = 0; i < SERVE_SIZES; i++)
+    {
+        serve_close(&state.pools[i]);
+    }
+
+    cond_destroy(&state.client_ready);
+    cond_destroy(&state.refill);
+    mutex_destroy(&state.lock);
+    free(generator_threads);
+
+    return result;
+}
+
+/**
+* Поток обслуживания соединений сервера: берёт принятое соединение из очереди
+* state->clients и выполняет запросы клиента, пока тот не закроет соединение
+* (serve_connection). Поле ответа собирается в рабочей области потока (scratch),
+* буферы генерации (ServeBuffer) растут под размер запроса
+* @param arg указатель на ServeHandler
+* @return THREAD_RETURN
+*/
+THREAD_FUNC serve_handler(void* arg)
+{
+    ServeHandler* handler;
+    ServeState* state;
+    ServeBuffer buffer;
+    int result;
+
+    handler = (ServeHandler*)arg;
+    state = handler->state;
+    memset(&buffer, 0, sizeof(buffer));
+    result = serve_reserve(&buffer, MAX_FIELD_SIZE, MAX_FIELD_SIZE);
+    arena_reserve(&scratch, scratch_size(MAX_FIELD_SIZE, MAX_FIELD_SIZE));
+
+    mutex_lock(&state->lock);
+
+    while (result == 0)
+    {
+        int client;
+
+        while (!state->stop && state->client_count == 0)
+        {
+            cond_wait(&state->client_ready, &state->lock);
+        }
+
+        if (state->stop)
+        {
+            break;
+        }
+
+        client = state->clients[state->client_head];
+        state->client_head = (state->client_head + 1) % SERVE_BACKLOG;
+        state->client_count--;
+        state->active[handler->index] = client;
+        mutex_unlock(&state->lock);
+
+        serve_connection(state, client, &buffer);
+
+        /* соединение закрывается под блокировкой: главный поток не закроет чужой номер */
+        mutex_lock(&state->lock);
+        state->active[handler->index] = -1;
+        close(client);
+    }
+
+    mutex_unlock(&state->lock);
+
+    free(buffer.workspace);
+    free(buffer.cells);
+    arena_destroy(&scratch);
+
+    return THREAD_RETURN;
+}
+
+/**
+* Выполняет запросы одного клиента построчно (serve_request), пока клиент
+* не закроет соединение или не отправит QUIT
+* @param state состояние сервера
+* @param client соединение
+* @param buffer буферы потока для генерации на месте
+* @return 0 при успехе, -6 если открыть потоки соединения не удалось
+*/
+int serve_connection(ServeState* state, int client, ServeBuffer* buffer)
+{
+    char line[SERVE_LINE];
+    FILE* in;
+    FILE* out;
+
+    in = fdopen(dup(client), "r");
+    out = fdopen(dup(client), "w");
+
+    if (in == NULL || out == NULL)
+    {
+        if (in != NULL)
+        {
+            fclose(in);
+        }
+
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+
+        return -6;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        trim_newline(line);
+
+        if (serve_request(state, line, out, buffer) != 0)
+        {
+            break;
+        }
+
+        fflush(out);
+    }
+
+    fclose(in);
+    fclose(out);
+
+    return 0;
+}
+#else
+/**
+* Сервер полей использует сокеты AF_UNIX и в Windows не поддерживается
+* @param options параметры сервера
+* @return -1
+*/
+int run_serve(ServeOptions* options)
+{
+    printf("Ошибка: режим --serve (%s) доступен только в Linux и macOS.\n", options->socket_path);
+    return -1;
+}
+
+/**
+* В Windows не используется (см. run_serve)
+* @param arg не используется
+* @return THREAD_RETURN
+*/
+THREAD_FUNC serve_handler(void* arg)
+{
+    (void)arg;
+    return THREAD_RETURN;
+}
+
+/**
+* В Windows не используется (см. run_serve)
+* @return -1
+*/
+int serve_connection(ServeState* state, int client, ServeBuffer* buffer)
+{
+    (void)state;
+    (void)client;
+    (void)buffer;
+    return -1;
+}
+#endif
+
+/**
+* Фоновый поток сервера: по кругу (state->cursor) выбирает следующий активный
+* запас, в котором есть место с учётом полей, которые уже ищут другие потоки,
+* и ищет для него поле не дольше SERVE_SLICE секунд (serve_search). Найденное
+* поле добавляется в запас; ненайденное остаётся прерванным поиском запаса
+* (serve_release) и продолжается при следующем обходе, поэтому размер, поле
+* которого ищется долго, не отнимает потоки у остальных. Если буферы под размер
+* запаса выделить не удалось, запас перестаёт пополняться (is_active = 0), а поток
+* продолжает работу. Когда все запасы полны, ждёт, пока из них возьмут поле
+* @param arg указатель на ServeState
+* @return THREAD_RETURN
+*/
+THREAD_FUNC serve_generator(void* arg)
+{
+    ServeState* state;
+    ServeBuffer buffer;
+    int depth;
+
+    state = (ServeState*)arg;
+    depth = state->options->depth;
+    memset(&buffer, 0, sizeof(buffer));
+
+    mutex_lock(&state->lock);
+
+    while (!state->stop)
+    {
+        ServePool* pool = NULL;
+        long long index;
+        long long attempt;
+        int rows;
+        int cols;
+        int result;
+
+        for (int k = 0; k < SERVE_SIZES && pool == NULL; k++)
+        {
+            ServePool* candidate = &state->pools[(state->cursor + k) % SERVE_SIZES];
+
+            if (candidate->cells != NULL && candidate->is_active && candidate->count + candidate->pending < depth)
+            {
+                pool = candidate;
+                state->cursor = (state->cursor + k + 1) % SERVE_SIZES;
+            }
+        }
+
+        if (pool == NULL)
+        {
+            cond_wait(&state->refill, &state->lock);
+            continue;
+        }
+
+        rows = pool->rows;
+        cols = pool->cols;
+        serve_claim(pool, &index, &attempt);
+        pool->pending++;
+        mutex_unlock(&state->lock);
+
+        result = serve_reserve(&buffer, rows, cols) == 0
+            ? serve_search(state, rows, cols, index, SERVE_SLICE, &buffer, &attempt) : WINDROSE_ERROR_BUFFER;
+
+        mutex_lock(&state->lock);
+        pool->pending--;
+
+        if (result == WINDROSE_OK)
+        {
+            int slot = (pool->head + pool->count) % depth;
+
+            memcpy(pool->cells + (size_t)slot * (size_t)(rows * cols), buffer.cells, (size_t)(rows * cols));
+            pool->index[slot] = index;
+            pool->attempt[slot] = attempt;
+            pool->count++;
+            pool->generated++;
+        }
+        else if (result == WINDROSE_ERROR_BUFFER)
+        {
+            /* памяти под поле этого размера нет: запас снова активирует следующий запрос размера */
+            pool->is_active = 0;
+        }
+
+        serve_release(pool, index, attempt, result);
+    }
+
+    mutex_unlock(&state->lock);
+
+    free(buffer.workspace);
+    free(buffer.cells);
+
+    return THREAD_RETURN;
+}
+
+/**
+* Выполняет один запрос клиента сервера. Каждый ответ заканчивается пустой строкой
+* - "GET <строки> <столбцы>" — поле из запаса или найденное на месте (serve_take):
+*   строка "OK pool|generated seed ... index ... attempt ...", затем поле в формате раздела 7;
+*   если поле не найдено за SERVE_MISS_BUDGET секунд — строка "BUSY ...", запрос можно повторить;
+* - "STATS" — счётчики запасов (serve_print_stats);
+* - "QUIT" — закрыть соединение.
+* На неверный запрос и размер, который способ генерации сервера не даёт
+* (serve_can_generate), отвечает строкой "ERROR ..."
+* @param state состояние сервера
+* @param line строка запроса (без '\n')
+* @param out поток ответа
+* @param buffer буферы потока для поиска на месте
+* @return 0 — продолжать обслуживание, 1 — закрыть соединение
+*/
+int serve_request(ServeState* state, char* line, FILE* out, ServeBuffer* buffer)
+{
+    int rows;
+    int cols;
+
+    if (sscanf(line, "GET %d %d", &rows, &cols) == 2)
+    {
+        Field* field;
+        long long index;
+        long long attempt;
+        int result;
+
+        if (rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE || rows > LARGE_MAX_SIZE || cols > LARGE_MAX_SIZE)
+        {
+            fprintf(out, "ERROR размеры должны быть в диапазоне от %d до %d\n\n", MIN_FIELD_SIZE, LARGE_MAX_SIZE);
+            return 0;
+        }
+
+        if (!serve_can_generate(state->options->engine, rows, cols))
+        {
+            fprintf(out, "ERROR поле %dx%d способом rejection не генерируется (нет выученной плотности), нужен сервер с -e constructive\n\n",
+                rows, cols);
+            return 0;
+        }
+
+        if (serve_reserve(buffer, rows, cols) != 0)
+        {
+            fprintf(out, "ERROR недостаточно памяти\n\n");
+            return 0;
+        }
+
+        result = serve_take(state, rows, cols, buffer, &index, &attempt);
+
+        if (result < 0)
+        {
+            fprintf(out, "ERROR не удалось завести запас поля %dx%d (заняты все %d запасов или недостаточно памяти)\n\n",
+                rows, cols, SERVE_SIZES);
+            return 0;
+        }
+
+        if (result == 2)
+        {
+            fprintf(out, "BUSY поле %dx%d ещё не готово, повторите запрос позже\n\n", rows, cols);
+            return 0;
+        }
+
+        field = create_scratch_field(rows, cols);
+
+        if (field == NULL)
+        {
+            fprintf(out, "ERROR недостаточно памяти\n\n");
+            return 0;
+        }
+
+        field_from_cells(field, buffer->cells);
+        fprintf(out, "OK %s seed %llu index %lld attempt %lld\n", result == 1 ? "pool" : "generated",
+            state->options->seed, index, attempt);
+        write_field(out, field);
+        fprintf(out, "\n");
+        free_field(field);
+
+        return 0;
+    }
+
+    if (strcmp(line, "STATS") == 0)
+    {
+        mutex_lock(&state->lock);
+        fprintf(out, "OK\n");
+        serve_print_stats(state, out);
+        mutex_unlock(&state->lock);
+        fprintf(out, "\n");
+
+        return 0;
+    }
+
+    if (strcmp(line, "QUIT") == 0)
+    {
+        return 1;
+    }
+
+    fprintf(out, "ERROR неизвестный запрос (GET <строки> <столбцы>, STATS, QUIT)\n\n");
+
+    return 0;
+}
+
+/**
+* Берёт поле размера rows x cols из запаса. Первый запрос размера заводит для него
+* запас (serve_open), и фоновые потоки начинают его пополнять. Если запас пуст,
+* поле размером до 12x12 ищется на месте не дольше SERVE_MISS_BUDGET секунд (serve_search):
+* поток обслуживания не занимается долгим поиском, а незаконченный поиск остаётся
+* в запасе (serve_release) и продолжается фоновыми потоками или следующим запросом.
+* Поля из плиток (больше 12x12) на месте не ищутся — их готовят только фоновые потоки
+* @param state состояние сервера
+* @param rows количество строк
+* @param cols количество столбцов
+* @param buffer буферы потока (serve_reserve под rows x cols); клетки поля — в buffer->cells
+* @param index номер поля (если поле выдано)
+* @param attempt номер попытки поля (если поле выдано)
+* @return 1 если поле взято из запаса, 0 если оно найдено на месте, 2 если поле
+* ещё не готово, -1 если завести запас для нового размера не удалось
+*/
+int serve_take(ServeState* state, int rows, int cols, ServeBuffer* buffer, long long* index, long long* attempt)
+{
+    ServePool* pool;
+    int depth;
+    int result;
+
+    depth = state->options->depth;
+
+    mutex_lock(&state->lock);
+
+    pool = serve_open(state, rows, cols);
+    if (pool == NULL)
+    {
+        mutex_unlock(&state->lock);
+        return -1;
+    }
+
+    pool->last_used = get_time_sec();
+
+    if (!pool->is_active)
+    {
+        pool->is_active = 1;
+        cond_broadcast(&state->refill);
+    }
+
+    if (pool->count > 0)
+    {
+        memcpy(buffer->cells, pool->cells + (size_t)pool->head * (size_t)(rows * cols), (size_t)(rows * cols));
+        *index = pool->index[pool->head];
+        *attempt = pool->attempt[pool->head];
+        pool->head = (pool->head + 1) % depth;
+        pool->count--;
+        pool->hits++;
+        cond_broadcast(&state->refill);
+        mutex_unlock(&state->lock);
+
+        return 1;
+    }
+
+    if (rows > MAX_FIELD_SIZE || cols > MAX_FIELD_SIZE)
+    {
+        pool->busy++;
+        mutex_unlock(&state->lock);
+
+        return 2;
+    }
+
+    serve_claim(pool, index, attempt);
+    mutex_unlock(&state->lock);
+
+    result = serve_search(state, rows, cols, *index, SERVE_MISS_BUDGET, buffer, attempt);
+
+    mutex_lock(&state->lock);
+
+    if (result == WINDROSE_OK)
+    {
+        pool->misses++;
+    }
+    else
+    {
+        pool->busy++;
+    }
+
+    serve_release(pool, *index, *attempt, result);
+    mutex_unlock(&state->lock);
+
+    return result == WINDROSE_OK ? 0 : 2;
+}
+
+/**
+* Находит запас размера rows x cols, а если его нет — заводит новый (serve_activate)
+* в свободной ячейке state->pools. Если свободных ячеек нет, вытесняет запас, который
+* дольше всех не запрашивали, — сначала неактивный; запасы размеров -z и запасы,
+* поле которых сейчас ищется, не вытесняются. Ячейка занимается, только если
+* память под запас выделена. Номера полей нового запаса начинаются
+* с state->opened << SERVE_INDEX_SHIFT, поэтому размер, запас которого вытеснили
+* и завели снова, не выдаёт уже выданные поля (вызывается под state->lock
+* или до запуска потоков)
+* @param state состояние сервера
+* @param rows количество строк
+* @param cols количество столбцов
+* @return запас, либо NULL если места или памяти для нового запаса нет
+*/
+ServePool* serve_open(ServeState* state, int rows, int cols)
+{
+    ServePool* slot = NULL;
+    ServePool* victim = NULL;
+
+    for (int i = 0; i < SERVE_SIZES; i++)
+    {
+        ServePool* pool = &state->pools[i];
+
+        if (pool->cells == NULL)
+        {
+            slot = slot == NULL ? pool : slot;
+        }
+        else if (pool->rows == rows && pool->cols == cols)
+        {
+            return pool;
+        }
+        else if (!pool->is_pinned && pool->searching == 0 && (victim == NULL || pool->is_active < victim->is_active
+            || (pool->is_active == victim->is_active && pool->last_used < victim->last_used)))
+        {
+            victim = pool;
+        }
+    }
+
+    if (slot == NULL && victim != NULL)
+    {
+        serve_close(victim);
+        slot = victim;
+    }
+
+    if (slot == NULL || serve_activate(slot, state->options->depth, rows, cols, state->opened << SERVE_INDEX_SHIFT) != 0)
+    {
+        return NULL;
+    }
+
+    state->opened++;
+
+    return slot;
+}
+
+/**
+* Освобождает память запаса и делает его ячейку свободной
+* @param pool запас
+* @return 0
+*/
+int serve_close(ServePool* pool)
+{
+    free(pool->cells);
+    free(pool->index);
+    free(pool->attempt);
+    free(pool->resume_index);
+    free(pool->resume_attempt);
+    memset(pool, 0, sizeof(*pool));
+
+    return 0;
+}
+
+/**
+* Выделяет кольцо запаса полей размера rows x cols и место для прерванных поисков
+* (depth + SERVE_HANDLERS: больше поисков одновременно не идёт) и делает запас активным
+* @param pool свободная ячейка запаса
+* @param depth число полей в запасе
+* @param rows количество строк
+* @param cols количество столбцов
+* @param first_index номер первого поля запаса
+* @return 0 при успехе, -6 при ошибке выделения памяти (ячейка остаётся свободной)
+*/
+int serve_activate(ServePool* pool, int depth, int rows, int cols, long long first_index)
+{
+    pool->cells = (signed char*)malloc((size_t)depth * (size_t)(rows * cols));
+    pool->index = (long long*)malloc((size_t)depth * sizeof(long long));
+    pool->attempt = (long long*)malloc((size_t)depth * sizeof(long long));
+    pool->resume_index = (long long*)malloc((size_t)(depth + SERVE_HANDLERS) * sizeof(long long));
+    pool->resume_attempt = (long long*)malloc((size_t)(depth + SERVE_HANDLERS) * sizeof(long long));
+
+    if (pool->cells == NULL || pool->index == NULL || pool->attempt == NULL
+        || pool->resume_index == NULL || pool->resume_attempt == NULL)
+    {
+        serve_close(pool);
+        return -6;
+    }
+
+    pool->rows = rows;
+    pool->cols = cols;
+    pool->next_index = first_index;
+    pool->is_active = 1;
+
+    return 0;
+}
+
+/**
+* Выдаёт поиск поля запаса: последний прерванный поиск, а если их нет —
+* следующий номер поля с первой попытки (вызывается под state->lock)
+* @param pool запас
+* @param index номер поля
+* @param attempt номер попытки, с которой продолжается поиск
+* @return 0
+*/
+int serve_claim(ServePool* pool, long long* index, long long* attempt)
+{
+    if (pool->resumed > 0)
+    {
+        pool->resumed--;
+        *index = pool->resume_index[pool->resumed];
+        *attempt = pool->resume_attempt[pool->resumed];
+    }
+    else
+    {
+        *index = pool->next_index++;
+        *attempt = 1;
+    }
+
+    pool->searching++;
+
+    return 0;
+}
+
+/**
+* Завершает поиск, выданный serve_claim: если поле не найдено, а MAX_ATTEMPTS
+* попыток ещё не проверено, поиск сохраняется в запасе как прерванный
+* (вызывается под state->lock)
+* @param pool запас
+* @param index номер поля
+* @param attempt первая непроверенная попытка (или попытка найденного поля)
+* @param result результат serve_search
+* @return 0
+*/
+int serve_release(ServePool* pool, long long index, long long attempt, int result)
+{
+    pool->searching--;
+
+    if (result != WINDROSE_OK && attempt <= MAX_ATTEMPTS)
+    {
+        pool->resume_index[pool->resumed] = index;
+        pool->resume_attempt[pool->resumed] = attempt;
+        pool->resumed++;
+    }
+
+    return 0;
+}
+
+/**
+* Увеличивает буферы потока сервера, если они меньше нужных для поля rows x cols
+* @param buffer буферы потока
+* @param rows количество строк
+* @param cols количество столбцов
+* @return 0 при успехе, -6 при ошибке выделения памяти (прежние буферы сохраняются)
+*/
+int serve_reserve(ServeBuffer* buffer, int rows, int cols)
+{
+    size_t workspace_size = windrose_workspace_size(rows, cols);
+    size_t cells_size = (size_t)rows * (size_t)cols;
+
+    if (buffer->workspace_size < workspace_size)
+    {
+        void* workspace = malloc(workspace_size);
+
+        if (workspace == NULL)
+        {
+            return -6;
+        }
+
+        free(buffer->workspace);
+        buffer->workspace = workspace;
+        buffer->workspace_size = workspace_size;
+    }
+
+    if (buffer->cells_size < cells_size)
+    {
+        signed char* cells = (signed char*)malloc(cells_size);
+
+        if (cells == NULL)
+        {
+            return -6;
+        }
+
+        free(buffer->cells);
+        buffer->cells = cells;
+        buffer->cells_size = cells_size;
+    }
+
+    return 0;
+}
+
+/**
+* Продолжает поиск поля с номером index с попытки *attempt (windrose_generate
+* порциями по SERVE_CHUNK попыток, для полей из плиток — по одной), пока поле
+* не найдено, не прошло budget секунд, не проверено MAX_ATTEMPTS попыток
+* или сервер не остановлен
+* @param state состояние сервера
+* @param rows количество строк
+* @param cols количество столбцов
+* @param index номер поля
+* @param budget сколько секунд искать
+* @param buffer буферы потока (serve_reserve под rows x cols); клетки поля — в buffer->cells
+* @param attempt номер первой непроверенной попытки; при успехе — попытка найденного поля
+* @return WINDROSE_OK, если поле найдено, WINDROSE_ERROR_ATTEMPTS, если нет,
+* иначе код ошибки windrose_generate
+*/
+int serve_search(ServeState* state, int rows, int cols, long long index, double budget, ServeBuffer* buffer, long long* attempt)
+{
+    ServeOptions* options = state->options;
+    long long chunk = rows > MAX_FIELD_SIZE || cols > MAX_FIELD_SIZE ? 1 : SERVE_CHUNK;
+    double start = get_time_sec();
+    int result = WINDROSE_ERROR_ATTEMPTS;
+
+    while (result == WINDROSE_ERROR_ATTEMPTS && *attempt <= MAX_ATTEMPTS)
+    {
+        long long found;
+        int stop;
+
+        result = windrose_generate(rows, cols, options->engine, options->seed, index, *attempt, chunk,
+            buffer->workspace, buffer->workspace_size, buffer->cells, &found);
+
+        if (result == WINDROSE_OK)
+        {
+            *attempt = found;
+            break;
+        }
+
+        if (result != WINDROSE_ERROR_ATTEMPTS)
+        {
+            break;
+        }
+
+        *attempt += chunk;
+
+        mutex_lock(&state->lock);
+        stop = state->stop;
+        mutex_unlock(&state->lock);
+
+        if (stop || get_time_sec() - start >= budget)
+        {
+            break;
+        }
+    }
+
+    return result;
+}
+
+/**
+* Проверяет, даёт ли способ генерации engine поля размера rows x cols за разумное
+* время: способу rejection для полей до 12x12 нужна выученная плотность (density_table) —
+* без неё (10x12–12x12) подбор --tune не нашёл ни одного поля. Поля из плиток
+* и способ constructive генерируются для любых размеров
+* @param engine способ генерации
+* @param rows количество строк
+* @param cols количество столбцов
+* @return 1 если поле генерируется, 0 если нет
+*/
+int serve_can_generate(int engine, int rows, int cols)
+{
+    return engine != ENGINE_REJECTION || rows > MAX_FIELD_SIZE || cols > MAX_FIELD_SIZE
+        || density_table[ENGINE_REJECTION][rows][cols].max > 0;
+}
+
+/**
+* Выводит счётчики запасов сервера: на каждый заведённый запас строку
+* "size RxC depth <в запасе>/<запас> hits ... misses ... busy ... generated ...", затем итог
+* (вызывается под state->lock или после остановки потоков)
+* @param state состояние сервера
+* @param out поток вывода
+* @return 0
+*/
+int serve_print_stats(ServeState* state, FILE* out)
+{
+    long long hits = 0;
+    long long misses = 0;
+    long long busy = 0;
+
+    for (int i = 0; i < SERVE_SIZES; i++)
+    {
+        ServePool* pool = &state->pools[i];
+
+        if (pool->cells != NULL)
+        {
+            fprintf(out, "size %dx%d depth %d/%d hits %lld misses %lld busy %lld generated %lld\n", pool->rows, pool->cols,
+                pool->count, state->options->depth, pool->hits, pool->misses, pool->busy, pool->generated);
+            hits += pool->hits;
+            misses += pool->misses;
+            busy += pool->busy;
+        }
+    }
+
+    fprintf(out, "total hits %lld misses %lld busy %lld\n", hits, misses, busy);
+
+    return 0;
+}
+
+#ifndef _WIN32
+/**
+* Клиент сервера полей: отправляет один запрос (аргументы после пути сокета,
+* соединённые пробелами) и выводит ответ до пустой строки
+* Формат: --client <сокет> GET <строки> <столбцы> | STATS
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @return 0 если сервер ответил OK, -1 при ошибке в ответе или аргументах,
+* -4 если подключиться не удалось
+*/
+int run_client(int argc, char* argv[])
+{
+    struct sockaddr_un address;
+    char request[SERVE_LINE];
+    char line[SERVE_LINE];
+    size_t length;
+    FILE* in;
+    FILE* out;
+    int client;
+    int result;
+
+    if (argc < 4 || strlen(argv[2]) >= sizeof(address.sun_path))
+    {
+        printf("Использование: %s --client <сокет> GET <строки> <столбцы> | STATS\n", argv[0]);
+        return -1;
+    }
+
+    length = 0;
+    request[0] = '\0';
+
+    for (int i = 3; i < argc; i++)
+    {
+        if (length + strlen(argv[i]) + 2 > sizeof(request))
+        {
+            printf("Ошибка: слишком длинный запрос.\n");
+            return -1;
+        }
+
+        length += (size_t)sprintf(request + length, i > 3 ? " %s" : "%s", argv[i]);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, argv[2]);
+    client = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (client < 0 || connect(client, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        printf("Ошибка: не удалось подключиться к %s.\n", argv[2]);
+
+        if (client >= 0)
+        {
+            close(client);
+        }
+
+        return -4;
+    }
+
+    in = fdopen(client, "r");
+    out = fdopen(dup(client), "w");
+
+    if (in == NULL || out == NULL)
+    {
+        printf("Ошибка выделения памяти\n");
+
+        if (in != NULL)
+        {
+            fclose(in);
+        }
+        else
+        {
+            close(client);
+        }
+
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+
+        return -1;
+    }
+
+    fprintf(out, "%s\n", request);
+    fflush(out);
+    result = -1;
+
+    for (int is_first = 1; fgets(line, sizeof(line), in) != NULL && line[0] != '\n'; is_first = 0)
+    {
+        if (is_first)
+        {
+            result = strncmp(line, "OK", 2) == 0 ? 0 : -1;
+        }
+
+        fputs(line, stdout);
+    }
+
+    fclose(in);
+    fclose(out);
+
+    return result;
+}
+#else
+/**
+* Клиент сервера полей в Windows не поддерживается (см. run_serve)
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @return -1
+*/
+int run_client(int argc, char* argv[])
+{
+    (void)argc;
+    printf("Ошибка: режим %s доступен только в Linux и macOS.\n", argv[1]);
+    return -1;
+}
+#endif
+
+/**
+* Разбирает аргументы командной строки режима шардов
+* Формат: --shards -r <строки> -c <столбцы> -n <количество> -k <шардов> -o <префикс> -s <seed>
+* [-j <номер шарда>] [-t <потоки>] [-e rejection|constructive] [-f text|binary] [-C <секунд>]
+* @param argc количество аргументов
+* @param argv аргументы командной строки
+* @param options структура, в которую записываются параметры
+* @return 0 при успешном разборе, -1 при ошибке в аргументах
+*/
+int parse_shard_options(int argc, char* argv[], ShardOptions* options)
+{
+    options->rows = 0;
+    options->cols = 0;
+    options->count = 0;
+    options->shards = 0;
+    options->shard = -1;
+    options->output = NULL;
+    options->seed = 0;
+    options->has_seed = 0;
+    options->threads = cpu_count();
+    options->engine = ENGINE_REJECTION;
+    options->format = FORMAT_TEXT;
+    options->interval = SHARD_CHECKPOINT_INTERVAL;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            printf("Ошибка: для ключа %s не указано значение.\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            options->rows = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            options->cols = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            options->count = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-k") == 0)
+        {
+            options->shards = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            options->shard = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            options->output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            options->seed = strtoull(argv[++i], NULL, 10);
+            options->has_seed = 1;
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            options->threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-C") == 0)
+        {
+            options->interval = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            i++;
+
+            if (strcmp(argv[i], "text") == 0)
+            {
+                options->format = FORMAT_TEXT;
+            }
+            else if (strcmp(argv[i], "binary") == 0)
+            {
+                options->format = FORMAT_BINARY;
+            }
+            else
+            {
+                printf("Ошибка: неизвестный формат файла %s.\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            i++;
+
+            if (strcmp(argv[i], "rejection") == 0)
+            {
+                options->engine = ENGINE_REJECTION;
+            }
+            else if (strcmp(argv[i], "constructive") == 0)
+            {
+                options->engine = ENGINE_CONSTRUCTIVE;
+            }
+            else
+            {
+                printf("Ошибка: неизвестный способ генерации %s.\n", argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("Ошибка: неизвестный ключ %s.\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (options->rows < MIN_FIELD_SIZE || options->cols < MIN_FIELD_SIZE || options->rows > LARGE_MAX_SIZE || options->cols > LARGE_MAX_SIZE)
+    {
+        printf("Ошибка: размеры должны быть в диапазоне от 3 до 500.\n");
+        printf("Использование: %s --shards -r <строки> -c <столбцы> -n <количество> -k <шардов> -o <префикс> -s <seed> [-j <номер шарда>] [-t <потоки>] [-e rejection|constructive] [-f text|binary] [-C <секунд>]\n", argv[0]);
+        return -1;
+    }
+
+    if (options->count <= 0 || options->shards <= 0 || options->shards > options->count)
+    {
+        printf("Ошибка: количество полей и шардов должно быть положительным, шардов — не больше полей.\n");
+        return -1;
+    }
+
+    if (options->shard < -1 || options->shard >= options->shards)
+    {
+        printf("Ошибка: номер шарда должен быть от 0 до %d.\n", options->shards - 1);
+        return -1;
+    }
+
+    if (options->output == NULL)
+    {
+        printf("Ошибка: не указан префикс файлов шардов (-o).\n");
+        return -1;
+    }
+
+    /* без общего seed шарды разных запусков и процессов не сложатся в один набор */
+    if (!options->has_seed)
+    {
+        printf("Ошибка: для генерации по шардам нужен seed (-s).\n");
+        return -1;
+    }
+
+    if (options->threads <= 0 || options->interval <= 0.0)
+    {
+        printf("Ошибка: число потоков и промежуток между контрольными точками должны быть положительными.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Генерация большого набора полей по шардам с контрольными точками
+* Поля с номерами 0..count-1 делятся на options->shards шардов подряд идущих
+* номеров (shard_range); шард пишется в свой файл <префикс>-<шард>.txt
+* (или .bin для двоичной библиотеки) рядом с контрольной точкой
+* <префикс>-<шард>.ckpt. Поле с номером index зависит только от
+* (seed, rows, cols, index), поэтому состояние генератора шарда — это номер
+* следующего поля, и повторный запуск той же команды продолжает каждый шард
+* с его контрольной точки без пропусков и повторов (shard_run).
+* Потоки (shard_worker) берут шарды по одному; с ключом -j запуск выполняет
+* только один шард, так что шарды можно раздать разным процессам и машинам.
+* Пока главный поток ждёт потоки, раз в PROGRESS_INTERVAL секунд он выводит ход
+* генерации в stderr; по Ctrl+C потоки сохраняют контрольные точки и завершаются
+* @param options параметры режима
+* @return 0 если все шарды запуска готовы, -1 если контрольная точка не подходит
+* к параметрам, -4 при ошибке файлов, -5 если генерация прервана или поле не найдено
+* за MAX_ATTEMPTS попыток, -6 при ошибке выделения памяти или создания потоков
+*/
+int run_shards(ShardOptions* options)
+{
+    ShardQueue queue;
+    thread_handle* threads;
+    long long total;
+    long long first;
+    double start_time;
+    double last_progress;
+    double elapsed;
+    int workers;
+    int started;
+
+    if (options->shard >= 0)
+    {
+        queue.next_shard = options->shard;
+        queue.last_shard = options->shard;
+        shard_range(options, options->shard, &first, &total);
+    }
+    else
+    {
+        queue.next_shard = 0;
+        queue.last_shard = options->shards - 1;
+        total = options->count;
+    }
+
+    workers = queue.last_shard - queue.next_shard + 1 < options->threads ? queue.last_shard - queue.next_shard + 1 : options->threads;
+    threads = (thread_handle*)malloc((size_t)workers * sizeof(thread_handle));
+
+    if (threads == NULL)
+    {
+        printf("Ошибка выделения памяти для потоков\n");
+        return -6;
+    }
+
+    /* если шардов меньше, чем потоков, лишние ядра отдаются долгим подсчётам решений */
+    queue.options = options;
+    queue.split_threads = options->threads / workers;
+    queue.resumed = 0;
+    queue.generated = 0;
+    queue.attempts = 0;
+    queue.workers_alive = 0;
+    queue.result = 0;
+    queue.stop = 0;
+    mutex_init(&queue.lock);
+    cond_init(&queue.finished);
+
+    cancel_requested = 0;
+    signal(SIGINT, on_cancel_signal);
+    start_time = get_time_sec();
+    last_progress = start_time;
+
+    started = 0;
+    for (int i = 0; i < workers; i++)
+    {
+        mutex_lock(&queue.lock);
+        queue.workers_alive++;
+        mutex_unlock(&queue.lock);
+
+        if (thread_create(&threads[i], shard_worker, &queue) != 0)
+        {
+            mutex_lock(&queue.lock);
+            queue.workers_alive--;
+            mutex_unlock(&queue.lock);
+            break;
+        }
+
+        started++;
+    }
+
+    mutex_lock(&queue.lock);
+
+    while (queue.workers_alive > 0)
+    {
+        double now;
+
+        if (cancel_requested)
+        {
+            queue.stop = 1;
+        }
+
+        cond_wait_timeout(&queue.finished, &queue.lock, WAIT_SLICE_MS);
+        now = get_time_sec();
+
+        if (now - last_progress >= PROGRESS_INTERVAL)
+        {
+            fprintf(stderr, "\rПолей: %lld из %lld, попыток: %lld, прошло %.0f с ", queue.resumed + queue.generated, total,
+                queue.attempts, now - start_time);
+            last_progress = now;
+        }
+    }
+
+    mutex_unlock(&queue.lock);
+
+    for (int i = 0; i < started; i++)
+    {
+        thread_join(threads[i]);
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+    if (last_progress > start_time)
+    {
+        fprintf(stderr, "\n");
+    }
+
+    elapsed = get_time_sec() - start_time;
+
+    if (elapsed <= 0.0)
+    {
+        elapsed = 1e-9;
+    }
+
+    printf("----------------------------------------\n");
+    printf("Размер поля: %d x %d\n", options->rows, options->cols);
+    printf("Начальное значение (seed): %llu\n", options->seed);
+
+    if (options->shard >= 0)
+    {
+        printf("Шард: %d из %d\n", options->shard, options->shards);
+    }
+    else
+    {
+        printf("Шардов: %d\n", options->shards);
+    }
+
+    printf("Потоков: %d\n", started);
+    printf("Готово полей: %lld из %lld (до этого запуска: %lld)\n", queue.resumed + queue.generated, total, queue.resumed);
+    printf("Сгенерировано в этом запуске: %lld\n", queue.generated);
+    printf("Попыток: %lld\n", queue.attempts);
+    printf("Время: %.3f с\n", elapsed);
+    printf("Полей в секунду: %.2f\n", (double)queue.generated / elapsed);
+
+    if (cancel_requested)
+    {
+        printf("Генерация прервана (Ctrl+C), контрольные точки сохранены: повторите команду, чтобы продолжить.\n");
+    }
+
+    cond_destroy(&queue.finished);
+    mutex_destroy(&queue.lock);
+    free(threads);
+
+    if (started == 0)
+    {
+        printf("Ошибка создания рабочих потоков\n");
+        return -6;
+    }
+
+    if (queue.result != 0)
+    {
+        return queue.result;
+    }
+
+    if (queue.resumed + queue.generated < total)
+    {
+        printf("Сформирован неполный набор полей.\n");
+        return -5;
+    }
+
+    return 0;
+}
+
+/**
+* Рабочий поток режима шардов: берёт из очереди номер следующего шарда
+* и генерирует его (shard_run), пока шарды не кончатся или очередь
+* не остановят. При ошибке шарда останавливает остальные потоки
+* @param arg указатель на ShardQueue
+* @return THREAD_RETURN
+*/
+THREAD_FUNC shard_worker(void* arg)
+{
+    ShardQueue* queue;
+    ShardOptions* options;
+    size_t workspace_size;
+    void* workspace;
+    signed char* cells;
+    Field* field;
+
+    queue = (ShardQueue*)arg;
+    options = queue->options;
+    split_threads = queue->split_threads;
+    workspace_size = windrose_workspace_size(options->rows, options->cols);
+    workspace = malloc(workspace_size);
+    cells = (signed char*)malloc((size_t)options->rows * (size_t)options->cols);
+    field = create_field(options->rows, options->cols);
+
+    mutex_lock(&queue->lock);
+
+    if (workspace == NULL || cells == NULL || field == NULL)
+    {
+        printf("Ошибка выделения памяти для рабочей области потока\n");
+        queue->result = -6;
+        queue->stop = 1;
+    }
+
+    while (!queue->stop && queue->next_shard <= queue->last_shard)
+    {
+        int shard;
+        int result;
+
+        shard = queue->next_shard++;
+        mutex_unlock(&queue->lock);
+
+        result = shard_run(queue, shard, workspace, workspace_size, cells, field);
+
+        mutex_lock(&queue->lock);
+
+        if (result != 0 && queue->result == 0)
+        {
+            queue->result = result;
+            queue->stop = 1;
+        }
+    }
+
+    queue->workers_alive--;
+    cond_broadcast(&queue->finished);
+    mutex_unlock(&queue->lock);
+
+    free(workspace);
+    free(cells);
+    free_field(field);
+
+    return THREAD_RETURN;
+}
+
+/**
+* Генерирует один шард с его контрольной точки (или с начала, если её нет)
+* Выходной файл сначала обрезается до длины из контрольной точки: поля,
+* записанные после неё до сбоя, могли остаться неполными и генерируются заново.
+* Поля пишутся как в пакетном режиме (текст со строками-комментариями
+* или двоичная библиотека); попытки идут порциями по BATCH_STOP_CHECK
+* с проверкой остановки, но не больше MAX_ATTEMPTS на поле. Раз в
+* options->interval секунд, а также в конце и при остановке сохраняется
+* контрольная точка (shard_save)
+* @param queue очередь шардов
+* @param shard номер шарда
+* @param workspace рабочая область потока
+* @param workspace_size размер рабочей области
+* @param cells клетки поля (рабочий буфер)
+* @param field поле для записи в файл
+* @return 0 если шард готов или остановлен с сохранённой контрольной точкой,
+* -1 если контрольная точка не подходит к параметрам или к файлу шарда,
+* -4 при ошибке файлов, -5 если поле не найдено за MAX_ATTEMPTS попыток,
+* -6 при ошибке выделения памяти
+*/
+int shard_run(ShardQueue* queue, int shard, void* workspace, size_t workspace_size, signed char* cells, Field* field)
+{
+    ShardOptions* options;
+    ShardCheckpoint checkpoint;
+    LibraryWriter library;
+    FILE* file;
+    char* output;
+    char* path;
+    long long first;
+    long long count;
+    long long saved;
+    double last_save;
+    int stop;
+    int result;
+
+    options = queue->options;
+    shard_range(options, shard, &first, &count);
+    output = shard_path(options->output, shard, options->format == FORMAT_BINARY ? ".bin" : ".txt");
+    path = shard_path(options->output, shard, ".ckpt");
+
+    if (output == NULL || path == NULL)
+    {
+        printf("Ошибка выделения памяти для имени файла шарда\n");
+        free(output);
+        free(path);
+        return -6;
+    }
+
+    result = checkpoint_load(path, &checkpoint);
+
+    if (result == 0 && (checkpoint.seed != options->seed || checkpoint.rows != options->rows || checkpoint.cols != options->cols
+        || checkpoint.engine != options->engine || checkpoint.format != options->format || checkpoint.count != options->count
+        || checkpoint.shards != options->shards || checkpoint.shard != shard || checkpoint.next < first || checkpoint.next > first + count
+        || checkpoint.density != density_hash(options->engine)))
+    {
+        result = -1;
+    }
+
+    if (result < 0)
+    {
+        printf("Ошибка: контрольная точка %s повреждена или записана с другими параметрами.\n", path);
+        free(output);
+        free(path);
+        return -1;
+    }
+
+    if (result == 0 && checkpoint.next == first + count)
+    {
+        mutex_lock(&queue->lock);
+        queue->resumed += count;
+        mutex_unlock(&queue->lock);
+
+        printf("Шард %d уже готов: %s\n", shard, output);
+        free(output);
+        free(path);
+        return 0;
+    }
+
+    if (result == 1)
+    {
+        /* контрольной точки нет: шард пишется с начала */
+        checkpoint.seed = options->seed;
+        checkpoint.rows = options->rows;
+        checkpoint.cols = options->cols;
+        checkpoint.engine = options->engine;
+        checkpoint.format = options->format;
+        checkpoint.count = options->count;
+        checkpoint.shards = options->shards;
+        checkpoint.shard = shard;
+        checkpoint.next = first;
+        checkpoint.offset = 0;
+        checkpoint.attempts = 0;
+        checkpoint.density = density_hash(options->engine);
+
+        if (options->format == FORMAT_BINARY)
+        {
+            result = library_create(&library, output, options->rows, options->cols, library_max_clue(options->rows, options->cols));
+            file = result == 0 ? library.file : NULL;
+        }
+        else
+        {
+            file = fopen(output, "wb");
+        }
+    }
+    else if (options->format == FORMAT_BINARY)
+    {
+        result = library_resume(&library, output, options->rows, options->cols, library_max_clue(options->rows, options->cols),
+            (unsigned long long)(checkpoint.next - first));
+        file = result == 0 ? library.file : NULL;
+    }
+    else
+    {
+        /* в режиме дописывания запись идёт в конец обрезанного файла */
+        result = file_truncate(output, checkpoint.offset);
+        file = result == 0 ? fopen(output, "ab") : NULL;
+    }
+
+    if (file == NULL)
+    {
+        printf("Ошибка: файл шарда %s не открыт или короче контрольной точки.\n", output);
+        free(output);
+        free(path);
+        return result == -1 ? -1 : -4;
+    }
+
+    if (options->format != FORMAT_BINARY)
+    {
+        setvbuf(file, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+    }
+
+    mutex_lock(&queue->lock);
+    queue->resumed += checkpoint.next - first;
+    stop = queue->stop;
+    mutex_unlock(&queue->lock);
+
+    saved = checkpoint.next;
+    last_save = get_time_sec();
+    result = 0;
+
+    while (!stop && checkpoint.next < first + count)
+    {
+        long long tried;
+        long long attempt;
+        long long score;
+        int status;
+        int tier;
+
+        tried = 0;
+        status = WINDROSE_ERROR_ATTEMPTS;
+
+        while (status == WINDROSE_ERROR_ATTEMPTS && tried < MAX_ATTEMPTS && !stop)
+        {
+            long long before = tried;
+
+            status = windrose_generate(options->rows, options->cols, options->engine, options->seed, checkpoint.next,
+                1 + tried, BATCH_STOP_CHECK, workspace, workspace_size, cells, &attempt);
+            tried = status == WINDROSE_OK ? attempt : tried + BATCH_STOP_CHECK;
+
+            mutex_lock(&queue->lock);
+            queue->attempts += tried - before;
+            stop = queue->stop;
+            mutex_unlock(&queue->lock);
+        }
+
+        if (status != WINDROSE_OK)
+        {
+            if (!stop)
+            {
+                printf("Ошибка: поле %lld не найдено за %d попыток.\n", checkpoint.next, MAX_ATTEMPTS);
+                result = -5;
+            }
+
+            break;
+        }
+
+        tier = windrose_rate(options->rows, options->cols, cells, workspace, workspace_size, &score);
+        field_from_cells(field, cells);
+
+        if (options->format == FORMAT_BINARY && library_append(&library, field) != 0)
+        {
+            result = -4;
+            break;
+        }
+
+        if (options->format != FORMAT_BINARY)
+        {
+            if (checkpoint.next > first)
+            {
+                fprintf(file, "\n");
+            }
+
+            fprintf(file, "# seed %llu index %lld attempt %lld engine %s tier %d score %lld\n", options->seed,
+                checkpoint.next, attempt, options->engine == ENGINE_CONSTRUCTIVE ? "constructive" : "rejection", tier, score);
+            write_field(file, field);
+        }
+
+        checkpoint.next++;
+        checkpoint.attempts += tried;
+
+        mutex_lock(&queue->lock);
+        queue->generated++;
+        mutex_unlock(&queue->lock);
+
+        if (get_time_sec() - last_save >= options->interval)
+        {
+            if (shard_save(file, options->format == FORMAT_BINARY ? &library : NULL, &checkpoint, path) != 0)
+            {
+                result = -4;
+                break;
+            }
+
+            saved = checkpoint.next;
+            last_save = get_time_sec();
+        }
+    }
+
+    if (result != -4 && checkpoint.next > saved
+        && shard_save(file, options->format == FORMAT_BINARY ? &library : NULL, &checkpoint, path) != 0)
+    {
+        result = -4;
+    }
+
+    if (result == -4)
+    {
+        printf("Ошибка записи файла шарда %s или контрольной точки %s\n", output, path);
+    }
+
+    if ((options->format == FORMAT_BINARY ? library_finish(&library) : fclose(file)) != 0 && result == 0)
+    {
+        printf("Ошибка записи файла %s\n", output);
+        result = -4;
+    }
+
+    if (result == 0 && checkpoint.next == first + count)
+    {
+        printf("Шард %d готов: %s (%lld полей)\n", shard, output, count);
+    }
+
+    free(output);
+    free(path);
+
+    return result;
+}
+
+/**
+* Вычисляет номера полей шарда: count полей набора делятся на шарды
+* подряд идущих номеров, первые count % shards шардов на поле длиннее
+* @param options параметры режима
+* @param shard номер шарда
+* @param first номер первого поля шарда (результат)
+* @param count количество полей шарда (результат)
+* @return 0
+*/
+int shard_range(ShardOptions* options, int shard, long long* first, long long* count)
+{
+    long long base = options->count / options->shards;
+    long long extra = options->count % options->shards;
+
+    *first = base * shard + (shard < extra ? shard : extra);
+    *count = base + (shard < extra ? 1 : 0);
+
+    return 0;
+}
+
+/**
+* Составляет имя файла шарда "<префикс>-<шард><суффикс>"
+* @param prefix префикс имён файлов (ключ -o)
+* @param shard номер шарда
+* @param suffix окончание имени (".txt", ".bin", ".ckpt")
+* @return строка, которую освобождает вызывающий, или NULL при ошибке выделения памяти
+*/
+char* shard_path(char* prefix, int shard, const char* suffix)
+{
+    size_t size = strlen(prefix) + strlen(suffix) + 16;
+    char* path = (char*)malloc(size);
+
+    if (path != NULL)
+    {
+        snprintf(path, size, "%s-%d%s", prefix, shard, suffix);
+    }
+
+    return path;
+}
+
+/**
+* Сохраняет контрольную точку шарда: сначала сбрасывает на диск выходной
+* файл (для библиотеки — вместе с заголовком, library_sync), затем записывает
+* его длину и номер следующего поля в файл контрольной точки. Поэтому
+* контрольная точка никогда не опережает данные в файле шарда
+* @param file выходной файл шарда
+* @param library состояние записи библиотеки или NULL для текстового файла
+* @param checkpoint контрольная точка (offset обновляется)
+* @param path имя файла контрольной точки
+* @return 0 при успехе, -4 при ошибке записи
+*/
+int shard_save(FILE* file, LibraryWriter* library, ShardCheckpoint* checkpoint, char* path)
+{
+    int result;
+
+    result = library != NULL ? library_sync(library) : file_sync(file);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    checkpoint->offset = file_tell(file);
+    if (checkpoint->offset < 0)
+    {
+        return -4;
+    }
+
+    return checkpoint_save(path, checkpoint);
+}
+
+/**
+* Загружает контрольную точку шарда (формат checkpoint_save)
+* @param filename имя файла
+* @param checkpoint контрольная точка (результат)
+* @return 0 при успехе, 1 если файла нет, -1 если формат файла неверный
+*/
+int checkpoint_load(char* filename, ShardCheckpoint* checkpoint)
+{
+    FILE* file;
+    char line[SERVE_LINE];
+    char engine[16];
+    char format[16];
+    int result;
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    result = -1;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#')
+        {
+            continue;
+        }
+
+        if (sscanf(line, "%llu %d %d %15s %15s %lld %d %d %lld %lld %lld %llx", &checkpoint->seed, &checkpoint->rows, &checkpoint->cols,
+            engine, format, &checkpoint->count, &checkpoint->shards, &checkpoint->shard, &checkpoint->next,
+            &checkpoint->offset, &checkpoint->attempts, &checkpoint->density) == 12
+            && (strcmp(engine, "rejection") == 0 || strcmp(engine, "constructive") == 0)
+            && (strcmp(format, "text") == 0 || strcmp(format, "binary") == 0) && checkpoint->offset >= 0)
+        {
+            checkpoint->engine = strcmp(engine, "constructive") == 0 ? ENGINE_CONSTRUCTIVE : ENGINE_REJECTION;
+            checkpoint->format = strcmp(format, "binary") == 0 ? FORMAT_BINARY : FORMAT_TEXT;
+            result = 0;
+        }
+
+        break;
+    }
+
+    fclose(file);
+
+    return result;
+}
+
+/**
+* Сохраняет контрольную точку шарда: строка-комментарий с названиями полей
+* и строка "seed rows cols engine format count shards shard next offset attempts density"
+* (density — шестнадцатеричный хеш таблицы плотности).
+* Файл пишется во временный "<имя>.tmp", сбрасывается на диск и заменяет
+* прежний (file_replace), поэтому при сбое остаётся старая или новая точка целиком
+* @param filename имя файла
+* @param checkpoint контрольная точка
+* @return 0 при успехе, -4 при ошибке записи, -6 при ошибке выделения памяти
+*/
+int checkpoint_save(char* filename, ShardCheckpoint* checkpoint)
+{
+    FILE* file;
+    char* temp;
+    size_t size;
+    int result;
+
+    size = strlen(filename) + 5;
+    temp = (char*)malloc(size);
+    if (temp == NULL)
+    {
+        return -6;
+    }
+
+    snprintf(temp, size, "%s.tmp", filename);
+
+    file = fopen(temp, "w");
+    if (file == NULL)
+    {
+        free(temp);
+        return -4;
+    }
+
+    fprintf(file, "# seed rows cols engine format count shards shard next offset attempts density\n");
+    fprintf(file, "%llu %d %d %s %s %lld %d %d %lld %lld %lld %016llx\n", checkpoint->seed, checkpoint->rows, checkpoint->cols,
+        checkpoint->engine == ENGINE_CONSTRUCTIVE ? "constructive" : "rejection",
+        checkpoint->format == FORMAT_BINARY ? "binary" : "text", checkpoint->count, checkpoint->shards,
+        checkpoint->shard, checkpoint->next, checkpoint->offset, checkpoint->attempts, checkpoint->density);
+
+    result = file_sync(file);
+
+    if (fclose(file) != 0)
+    {
+        result = -4;
+    }
+
+    if (result == 0)
+    {
+        result = file_replace(temp, filename);
+    }
+
+    free(temp);
+
+    return result;
+}
+
+/**
+* Возвращает количество логических процессоров
+* @return число процессоров (не меньше 1)
+*/
+int cpu_count()
+{
+    int count;
+
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    count = (int)info.dwNumberOfProcessors;
+#else
+    count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return count > 0 ? count : 1;
+}
+
+/**
+* Запускает поток
+* @param thread дескриптор создаваемого потока
+* @param func функция потока
+* @param arg аргумент функции потока
+* @return 0 при успехе, -1 при ошибке
+*/
+int thread_create(thread_handle* thread, THREAD_FUNC (*func)(void*), void* arg)
+{
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return *thread != NULL ? 0 : -1;
+#else
+    return pthread_create(thread, NULL, func, arg) == 0 ? 0 : -1;
+#endif
+}
+
+/**
+* Ожидает завершения потока и освобождает его дескриптор
+* @param thread дескриптор потока
+* @return 0
+*/
+int thread_join(thread_handle thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+
+    return 0;
+}
+
+/**
+* Функции-обёртки над мьютексом (критической секцией в Windows)
+* @param mutex мьютекс
+* @return 0
+*/
+int mutex_init(mutex_handle* mutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+
+    return 0;
+}
+
+int mutex_lock(mutex_handle* mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+
+    return 0;
+}
+
+int mutex_unlock(mutex_handle* mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+
+    return 0;
+}
+
+int mutex_destroy(mutex_handle* mutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+
+    return 0;
+}
+
+/**
+* Функции-обёртки над условной переменной
+* cond_wait_timeout ждёт не дольше ms миллисекунд (ожидающий поток может
+* проверить срок и флаг отмены, даже если сигнала не было)
+* @param cond условная переменная
+* @param mutex захваченный мьютекс, который освобождается на время ожидания
+* @param ms наибольшее время ожидания в миллисекундах
+* @return 0
+*/
+int cond_init(cond_handle* cond)
+{
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+
+    return 0;
+}
+
+int cond_wait(cond_handle* cond, mutex_handle* mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+
+    return 0;
+}
+
+int cond_wait_timeout(cond_handle* cond, mutex_handle* mutex, int ms)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, (DWORD)ms);
+#else
+    struct timespec deadline;
+
+    /* pthread_cond_timedwait ждёт до момента времени, а не заданное число миллисекунд */
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_cond_timedwait(cond, mutex, &deadline);
+#endif
+
+    return 0;
+}
+
+int cond_broadcast(cond_handle* cond)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+
+    return 0;
+}
+
+int cond_destroy(cond_handle* cond)
+{
+#ifdef _WIN32
+    (void)cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+
+    return 0;
+}
+
+/**
+* Перемешивает 64-битное значение (финализатор splitmix64): значения,
+* отличающиеся одним битом, дают независимые на вид результаты
+* @param z исходное значение
+* @return перемешанное значение
+*/
+ALWAYS_INLINE unsigned long long rng_mix(unsigned long long z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+/**
+* Инициализирует генератор случайных чисел (splitmix64) начальным значением
+* Начальное значение перемешивается (rng_mix), поэтому близкие seed
+* дают независимые последовательности
+* @param rng состояние генератора
+* @param seed начальное значение
+* @return 0
+*/
+int rng_seed(Rng* rng, unsigned long long seed)
+{
+    rng->state = rng_mix(seed + 0x9E3779B97F4A7C15ULL);
+    return 0;
+}
+
+/**
+* Инициализирует генератор для попытки attempt поля с номером index
+* Состояние — функция только от (seed, rows, cols, index, attempt), поэтому
+* любое поле можно получить заново одной попыткой, зная эти значения,
+* а потоки пакетного режима не зависят друг от друга
+* @param rng состояние генератора
+* @param seed начальное значение набора
+* @param rows количество строк поля
+* @param cols количество столбцов поля
+* @param index номер поля в наборе
+* @param attempt номер попытки (с 1)
+* @return 0
+*/
+int rng_seed_puzzle(Rng* rng, unsigned long long seed, int rows, int cols, long long index, long long attempt)
+{
+    unsigned long long z;
+
+    z = rng_mix(seed + 0x9E3779B97F4A7C15ULL);
+    z = rng_mix(z ^ ((unsigned long long)rows << 32 | (unsigned long long)(unsigned int)cols));
+    z = rng_mix(z + (unsigned long long)index);
+    rng->state = rng_mix(z ^ (unsigned long long)attempt);
+
+    return 0;
+}
+
+/**
+* Возвращает очередное 32-битное случайное число (splitmix64: счётчик
+* state увеличивается на константу, результат — перемешанный счётчик)
+* @param rng состояние генератора
+* @return случайное число
+*/
+ALWAYS_INLINE unsigned int rng_next(Rng* rng)
+{
+    rng->state += 0x9E3779B97F4A7C15ULL;
+
+    return (unsigned int)(rng_mix(rng->state) >> 32);
+}
+
+/**
+* Возвращает случайное число в диапазоне [0, n)
+* Без деления в обычном случае: старшие 32 бита произведения rng_next * n,
+* а редкие значения, дающие перекос в пользу малых чисел, отбрасываются
+* @param rng состояние генератора
+* @param n верхняя граница (n > 0)
+* @return случайное число от 0 до n - 1
+*/
+ALWAYS_INLINE int rng_range(Rng* rng, int n)
+{
+    unsigned long long m;
+    unsigned int bound;
+
+    bound = (unsigned int)n;
+    m = (unsigned long long)rng_next(rng) * bound;
+
+    if ((unsigned int)m < bound)
+    {
+        unsigned int threshold = (0u - bound) % bound;
+
+        while ((unsigned int)m < threshold)
+        {
+            m = (unsigned long long)rng_next(rng) * bound;
+        }
+    }
+
+    return (int)(m >> 32);
+}
+
+/**
+* malloc с подсчётом вызовов в alloc_count
+* Используется в генерации и проверке полей, чтобы замер (run_bench)
+* мог показать число выделений памяти на одну попытку
+* @param size размер блока в байтах
+* @return указатель на блок, либо NULL при ошибке выделения памяти
+*/
+void* counted_malloc(size_t size)
+{
+    void* block;
+
+    alloc_count++;
+    block = malloc(size);
+
+    if (block == NULL)
+    {
+        gen_stats.rejected_alloc++;
+    }
+
+    return block;
+}
+
+/**
+* Готовит арену к работе с полями одного размера: если она пуста и меньше
+* size байт, выделяет новый блок (единственное выделение памяти арены).
+* Непустая арена не меняется — её блок могут использовать
+* @param arena арена
+* @param size нужный размер блока в байтах (см. scratch_size)
+* @return 0 при успехе, -1 при ошибке выделения памяти
+*/
+int arena_reserve(Arena* arena, size_t size)
+{
+    char* base;
+
+    if (arena->used > 0 || arena->size >= size)
+    {
+        return 0;
+    }
+
+    base = (char*)counted_malloc(size);
+    if (base == NULL)
+    {
+        return -1;
+    }
+
+    free(arena->base);
+    arena->base = base;
+    arena->size = size;
+
+    return 0;
+}
+
+/**
+* Выделяет блок памяти из арены (с выравниванием ARENA_ALIGN).
+* Если блок не помещается, он выделяется в куче (counted_malloc),
+* и его нужно освободить функцией arena_free
+* @param arena арена
+* @param size размер блока в байтах
+* @return указатель на блок, либо NULL при ошибке выделения памяти
+*/
+void* arena_alloc(Arena* arena, size_t size)
+{
+    void* block;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (size > arena->size - arena->used)
+    {
+        return counted_malloc(size);
+    }
+
+    block = arena->base + arena->used;
+    arena->used += size;
+
+    return block;
+}
+
+/**
+* Освобождает блок, полученный из arena_alloc: блок из кучи возвращается
+* в кучу, блок из самой арены освобождается только вместе с ареной
+* (arena_release)
+* @param arena арена
+* @param block указатель на блок (допускается NULL)
+* @return 0
+*/
+int arena_free(Arena* arena, void* block)
+{
+    char* bytes = (char*)block;
+
+    if (arena->base == NULL || bytes < arena->base || bytes >= arena->base + arena->size)
+    {
+        free(block);
+    }
+
+    return 0;
+}
+
+/**
+* Освобождает всю память арены, выделенную после отметки
+* @param arena арена
+* @param mark отметка (значение arena->used, запомненное раньше)
+* @return 0
+*/
+int arena_release(Arena* arena, size_t mark)
+{
+    arena->used = mark;
+    return 0;
+}
+
+/**
+* Освобождает блок арены
+* @param arena арена
+* @return 0
+*/
+int arena_destroy(Arena* arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+
+    return 0;
+}
+
+/**
+* Делает блок вызывающего рабочей областью арены: память выдаётся из него,
+* начиная с ближайшего адреса, кратного ARENA_ALIGN. Блок не освобождается
+* ареной, поэтому arena_destroy для такой арены не вызывается
+* @param arena арена
+* @param block блок памяти
+* @param size размер блока в байтах (больше ARENA_ALIGN)
+* @return 0
+*/
+int arena_attach(Arena* arena, void* block, size_t size)
+{
+    size_t offset;
+
+    offset = (ARENA_ALIGN - (size_t)((uintptr_t)block % ARENA_ALIGN)) % ARENA_ALIGN;
+    arena->base = (char*)block + offset;
+    arena->size = size - offset;
+    arena->used = 0;
+
+    return 0;
+}
+
+/**
+* Оценивает сверху память одной попытки для поля rows x cols: само поле,
+* чёрные клетки и длины линий generate_puzzle и массивы решателя
+* (чёрных и белых клеток вместе не больше rows * cols, записей журнала
+* не больше четырёх на белую клетку). Для полей из плиток добавляются
+* флаги плиток и окно из 3 x 3 плиток с его решателем (generate_tiled)
+* @param rows количество строк
+* @param cols количество столбцов
+* @return размер в байтах
+*/
+size_t scratch_size(int rows, int cols)
+{
+    size_t cells = (size_t)rows * (size_t)cols;
+    size_t total = (size_t)(rows + 2) * (size_t)(cols + 2);
+    size_t size;
+
+    size = field_bytes(rows, cols)
+        + (cells + REPAIR_MAX_CELLS) * (sizeof(Point) + 4 * sizeof(int))
+        + total * sizeof(int)
+        + (cells + 1) * (sizeof(int) + 8 * sizeof(int) + 8 * sizeof(short))
+        + (4 * cells + 2) * (sizeof(int) + sizeof(short))
+        + 16 * ARENA_ALIGN;
+
+    if (rows > MAX_FIELD_SIZE || cols > MAX_FIELD_SIZE)
+    {
+        /* окно не больше 3 * TILE_SIZE = 24 клеток в сторону — вчетверо больше поля 12 x 12 */
+        size += cells + 4 * scratch_size(MAX_FIELD_SIZE, MAX_FIELD_SIZE);
+    }
+
+    return size;
+}
+
+/**
+* Возвращает счётчик тактов процессора (rdtsc) для замера этапов генерации
+* На процессорах без rdtsc возвращает время в наносекундах
+* @return текущее значение счётчика
+*/
+unsigned long long read_cycles()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return (unsigned long long)(get_time_sec() * 1e9);
+#endif
+}
+
+/**
+* Прибавляет статистику part к статистике total
+* @param total итоговая статистика
+* @param part статистика, которая добавляется (например, одного потока)
+* @return 0
+*/
+int add_gen_stats(GenStats* total, GenStats* part)
+{
+    total->attempts += part->attempts;
+    total->rejected_boxed += part->rejected_boxed;
+    total->rejected_uncovered += part->rejected_uncovered;
+    total->rejected_dead_end += part->rejected_dead_end;
+    total->rejected_unsolvable += part->rejected_unsolvable;
+    total->rejected_ambiguous += part->rejected_ambiguous;
+    total->rejected_alloc += part->rejected_alloc;
+    total->rejected_seam += part->rejected_seam;
+    total->rejected_duplicate += part->rejected_duplicate;
+    total->accepted += part->accepted;
+    total->place_cycles += part->place_cycles;
+    total->draw_cycles += part->draw_cycles;
+    total->finish_cycles += part->finish_cycles;
+    total->create_cycles += part->create_cycles;
+
+    return 0;
+}
+
+/**
+* Выводит сводку причин отказа (в процентах от числа попыток)
+* и, при сборке с GEN_PROFILE, среднее число тактов на попытку по этапам
+* @param stats статистика генерации
+* @return 0
+*/
+int print_gen_stats(GenStats* stats)
+{
+    double attempts;
+
+    attempts = stats->attempts > 0 ? (double)stats->attempts : 1.0;
+
+    printf("Попыток генерации: %lld, принято: %lld\n", stats->attempts, stats->accepted);
+    printf("Причины отказа:\n");
+    printf("  чёрная клетка заперта (число 0): %lld (%.2f%%)\n", stats->rejected_boxed, 100.0 * (double)stats->rejected_boxed / attempts);
+    printf("  поле не покрыто: %lld (%.2f%%)\n", stats->rejected_uncovered, 100.0 * (double)stats->rejected_uncovered / attempts);
+    printf("  тупик конструктивной генерации: %lld (%.2f%%)\n", stats->rejected_dead_end, 100.0 * (double)stats->rejected_dead_end / attempts);
+    printf("  нет решения: %lld (%.2f%%)\n", stats->rejected_unsolvable, 100.0 * (double)stats->rejected_unsolvable / attempts);
+    printf("  решение не единственно: %lld (%.2f%%)\n", stats->rejected_ambiguous, 100.0 * (double)stats->rejected_ambiguous / attempts);
+    printf("  ошибка выделения памяти: %lld\n", stats->rejected_alloc);
+
+    if (stats->rejected_seam > 0)
+    {
+        printf("  плитка большого поля не стыкуется с соседками: %lld\n", stats->rejected_seam);
+    }
+
+    if (stats->rejected_duplicate > 0)
+    {
+        printf("  повтор ранее записанного поля (с учётом поворотов и отражений): %lld\n", stats->rejected_duplicate);
+    }
+
+#ifdef GEN_PROFILE
+    printf("Тактов на попытку: размещение %.0f, линии %.0f, покрытие %.0f, create_field %.0f\n",
+        (double)stats->place_cycles / attempts, (double)stats->draw_cycles / attempts,
+        (double)stats->finish_cycles / attempts, (double)stats->create_cycles / attempts);
+#endif
+
+    return 0;
+}
+
+/**
+* Добавляет время поиска одного принятого поля в журнал
+* @param log журнал времени (нулевой журнал пуст)
+* @param seconds время от начала поиска поля до его принятия
+* @return 0 при успехе, -1 при ошибке выделения памяти
+*/
+int latency_add(LatencyLog* log, double seconds)
+{
+    if (log->count == log->capacity)
+    {
+        long long capacity;
+        double* values;
+
+        capacity = log->capacity > 0 ? log->capacity * 2 : 256;
+        values = (double*)realloc(log->values, (size_t)capacity * sizeof(double));
+
+        if (values == NULL)
+        {
+            return -1;
+        }
+
+        log->values = values;
+        log->capacity = capacity;
+    }
+
+    log->values[log->count++] = seconds;
+
+    return 0;
+}
+
+/**
+* Сравнивает два значения double (для qsort)
+* @param a указатель на первое значение
+* @param b указатель на второе значение
+* @return -1, 0 или 1
+*/
+int compare_double(const void* a, const void* b)
+{
+    double x;
+    double y;
+
+    x = *(const double*)a;
+    y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+* Выводит процентили p50/p95/p99 и наибольшее время до принятого поля
+* (процентиль по ближайшему рангу: значение с номером ceil(p * n / 100)
+* в отсортированном журнале). Журнал при этом сортируется
+* @param log журнал времени
+* @return 0
+*/
+int latency_print(LatencyLog* log)
+{
+    int percents[3] = { 50, 95, 99 };
+    int i;
+
+    if (log->count == 0)
+    {
+        return 0;
+    }
+
+    qsort(log->values, (size_t)log->count, sizeof(double), compare_double);
+
+    printf("Время до принятого поля, мс:");
+
+    for (i = 0; i < 3; i++)
+    {
+        long long rank;
+
+        rank = (percents[i] * log->count + 99) / 100;
+        printf(" p%d %.3f,", percents[i], 1000.0 * log->values[rank - 1]);
+    }
+
+    printf(" макс %.3f (полей: %lld)\n", 1000.0 * log->values[log->count - 1], log->count);
+
+    return 0;
+}
+
+/**
+* Освобождает память журнала времени
+* @param log журнал времени
+* @return 0
+*/
+int latency_free(LatencyLog* log)
+{
+    free(log->values);
+    log->values = NULL;
+    log->count = 0;
+    log->capacity = 0;
+
+    return 0;
+}
+
+/**
+* Создаёт поле заданного размера одним блоком памяти в куче (init_field)
+* Такое поле живёт, пока его не освободят функцией free_field
+* @param rows количество строк
+* @param cols количество столбцов
+* @return указатель на поле, либо NULL при ошибке выделения памяти
+*/
+Field* create_field(int rows, int cols)
+{
+    void* block;
+
+    block = counted_malloc(field_bytes(rows, cols));
+    if (block == NULL)
+    {
+        printf("Ошибка выделения памяти для поля\n");
+        return NULL;
+    }
+
+    return init_field(block, rows, cols);
+}
+
+/**
+* Создаёт поле заданного размера в рабочей области потока (scratch)
+* Поле живёт до освобождения арены до отметки, сделанной раньше
+* (arena_release); free_field для него ничего не делает
+* @param rows количество строк
+* @param cols количество столбцов
+* @return указатель на поле, либо NULL при ошибке выделения памяти
+*/
+Field* create_scratch_field(int rows, int cols)
+{
+    void* block;
+
+    block = arena_alloc(&scratch, field_bytes(rows, cols));
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    return init_field(block, rows, cols);
+}
+
+/**
+* Размечает блок памяти под поле
+* Клетки хранятся построчно в массиве байтов с рамкой шириной в одну клетку:
+* клетки рамки равны BORDER, все внутренние клетки инициализируются значением EMPTY.
+* Благодаря рамке обход луча останавливается на ней без проверки координат
+* @param block блок размером field_bytes(rows, cols)
+* @param rows количество строк
+* @param cols количество столбцов
+* @return указатель на поле (начало блока)
+*/
+Field* init_field(void* block, int rows, int cols)
+{
+    Field* field;
+    int stride;
+    int total;
+
+    stride = cols + 2;
+    total = (rows + 2) * stride;
+
+    PROFILE_START(create_start);
+    field = (Field*)block;
+    field->rows = rows;
+    field->cols = cols;
+    field->stride = stride;
+    field->cells = (Cell*)(field + 1);
+
+    memset(field->cells, BORDER, (size_t)total * sizeof(Cell));
+
+    for (int row_index = 0; row_index < rows; row_index++)
+    {
+        memset(&FIELD_AT(field, row_index, 0), EMPTY, (size_t)cols * sizeof(Cell));
+    }
+
+    PROFILE_STOP(create_start, create_cycles);
+
+    return field;
+}
+
+/**
+* Возвращает размер блока памяти поля вместе с рамкой
+* @param rows количество строк
+* @param cols количество столбцов
+* @return размер в байтах
+*/
+size_t field_bytes(int rows, int cols)
+{
+    return sizeof(Field) + (size_t)(rows + 2) * (size_t)(cols + 2) * sizeof(Cell);
+}
+
+/**
+* Копирует клетки поля в другое поле того же размера
+* @param target поле, в которое копируются клетки
+* @param source исходное поле
+* @return 0 при успехе, -1 если размеры полей различаются
+*/
+int copy_field(Field* target, Field* source)
+{
+    if (target->rows != source->rows || target->cols != source->cols)
+    {
+        return -1;
+    }
+
+    memcpy(target->cells, source->cells, (size_t)(source->rows + 2) * (size_t)source->stride * sizeof(Cell));
+
+    return 0;
+}
+
+/**
+* Заполняет внутренние клетки поля из массива клеток интерфейса windrose.h
+* (построчно, без рамки)
+* @param field поле нужного размера
+* @param cells rows * cols клеток: 0 — белая, больше 0 — число чёрной клетки
+* @return 0 при успехе, -1 если в массиве есть отрицательное значение
+*/
+int field_from_cells(Field* field, const signed char* cells)
+{
+    for (int i = 0; i < field->rows; i++)
+    {
+        for (int j = 0; j < field->cols; j++)
+        {
+            if (cells[i * field->cols + j] < WHITE)
+            {
+                return -1;
+            }
+
+            FIELD_AT(field, i, j) = cells[i * field->cols + j];
+        }
+    }
+
+    return 0;
+}
+
+/**
+* Копирует внутренние клетки поля в массив клеток интерфейса windrose.h
+* @param field поле
+* @param cells массив из rows * cols клеток
+* @return 0
+*/
+int field_to_cells(Field* field, signed char* cells)
+{
+    for (int i = 0; i < field->rows; i++)
+    {
+        memcpy(&cells[i * field->cols], &FIELD_AT(field, i, 0), (size_t)field->cols * sizeof(Cell));
+    }
+
+    return 0;
+}
+
+/**
+* Освобождает память, выделенную под поле (поле из рабочей области
+* потока освобождается вместе с ней, см. create_scratch_field)
+* @param field указатель на поле (допускается NULL)
+* @return 0
+*/
+int free_field(Field* field)
+{
+    arena_free(&scratch, field);
+    return 0;
+}
+
+/**
+* Возвращает номер младшего установленного бита маски
+* @param mask маска (не равна 0)
+* @return номер бита
+*/
+ALWAYS_INLINE int lowest_bit(Mask mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/**
+* Возвращает номер старшего установленного бита маски
+* @param mask маска (не равна 0)
+* @return номер бита
+*/
+ALWAYS_INLINE int highest_bit(Mask mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+
+    _BitScanReverse(&index, mask);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+/**
+* Возвращает количество установленных битов маски
+* @param mask маска
+* @return количество единичных битов
+*/
+int bit_count(Mask mask)
+{
+#ifdef _MSC_VER
+    return (int)__popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+/**
+* Подготавливает битовые маски занятости пустого поля
+* Клетка (x, y) соответствует биту y + 1 в row_bits[x] и биту x + 1 в col_bits[y].
+* Крайние биты (0 и cols + 1 / rows + 1) всегда установлены и играют роль рамки
+* @param board битовые маски поля
+* @param rows количество строк
+* @param cols количество столбцов
+* @return 0
+*/
+ALWAYS_INLINE int bitboard_init(Bitboard* board, int rows, int cols)
+{
+    board->rows = rows;
+    board->cols = cols;
+
+    for (int x = 0; x < rows; x++)
+    {
+        board->row_bits[x] = 1u | (1u << (cols + 1));
+    }
+
+    for (int y = 0; y < cols; y++)
+    {
+        board->col_bits[y] = 1u | (1u << (rows + 1));
+    }
+
+    return 0;
+}
+
+/**
+* Проверяет, занята ли клетка (чёрной клеткой или линией)
+* @param board битовые маски поля
+* @param x индекс строки
+* @param y индекс столбца
+* @return 1 если клетка занята, иначе 0
+*/
+ALWAYS_INLINE int bitboard_is_set(Bitboard* board, int x, int y)
+{
+    return (int)((board->row_bits[x] >> (y + 1)) & 1u);
+}
+
+/**
+* Отмечает клетку занятой в маске строки и в маске столбца
+* @param board битовые маски поля
+* @param x индекс строки
+* @param y индекс столбца
+* @return 0
+*/
+ALWAYS_INLINE int bitboard_set(Bitboard* board, int x, int y)
+{
+    board->row_bits[x] |= 1u << (y + 1);
+    board->col_bits[y] |= 1u << (x + 1);
+
+    return 0;
+}
+
+/**
+* Вычисляет длину свободного участка от клетки (x, y) в направлении dir
+* Длина берётся из маски строки или столбца одной операцией поиска
+* ближайшего установленного бита, без обхода клеток
+* @param board битовые маски поля
+* @param x индекс строки стартовой клетки
+* @param y индекс столбца стартовой клетки
+* @param dir номер направления (0 — вверх, 1 — вниз, 2 — влево, 3 — вправо)
+* @return количество свободных клеток подряд
+*/
+ALWAYS_INLINE int free_run(Bitboard* board, int x, int y, int dir)
+{
+    switch (dir)
+    {
+    case 0:
+        return x - highest_bit(board->col_bits[y] & ((1u << (x + 1)) - 1u));
+    case 1:
+        return lowest_bit(board->col_bits[y] >> (x + 2));
+    case 2:
+        return y - highest_bit(board->row_bits[x] & ((1u << (y + 1)) - 1u));
+    default:
+        return lowest_bit(board->row_bits[x] >> (y + 2));
+    }
+}
+
+/**
+* Отмечает занятыми len клеток от клетки (x, y) в направлении dir
+* В маске вдоль линии клетки закрашиваются одним OR, в поперечных
+* масках устанавливается по одному биту на клетку
+* @param board битовые маски поля
+* @param x индекс строки стартовой клетки
+* @param y индекс столбца стартовой клетки
+* @param dir номер направления
+* @param len длина линии
+* @return 0
+*/
+ALWAYS_INLINE int paint_line(Bitboard* board, int x, int y, int dir, int len)
+{
+    Mask run;
+
+    run = (1u << len) - 1u;
+
+    switch (dir)
+    {
+    case 0:
+        board->col_bits[y] |= run << (x + 1 - len);
+        for (int k = 1; k <= len; k++)
+        {
+            board->row_bits[x - k] |= 1u << (y + 1);
+        }
+        break;
+    case 1:
+        board->col_bits[y] |= run << (x + 2);
+        for (int k = 1; k <= len; k++)
+        {
+            board->row_bits[x + k] |= 1u << (y + 1);
+        }
+        break;
+    case 2:
+        board->row_bits[x] |= run << (y + 1 - len);
+        for (int k = 1; k <= len; k++)
+        {
+            board->col_bits[y - k] |= 1u << (x + 1);
+        }
+        break;
+    default:
+        board->row_bits[x] |= run << (y + 2);
+        for (int k = 1; k <= len; k++)
+        {
+            board->col_bits[y + k] |= 1u << (x + 1);
+        }
+        break;
+    }
+
+    return 0;
+}
+
+/**
+* Проводит линию от чёрной клетки в заданном направлении по пустым клеткам
+* Доступная длина берётся из битовых масок (free_run), длина линии выбирается
+* случайно в пределах доступной
+* @param board битовые маски поля
+* @param x индекс строки стартовой (чёрной) клетки
+* @param y индекс столбца стартовой (чёрной) клетки
+* @param dir номер направления (0 — вверх, 1 — вниз, 2 — влево, 3 — вправо)
+* @param rng генератор случайных чисел
+* @return длина проведённой линии (количество закрашенных клеток), либо 0 если провести линию нельзя
+*/
+ALWAYS_INLINE int draw_line(Bitboard* board, int x, int y, int dir, Rng* rng)
+{
+    int available_len;
+    int len;
+
+    available_len = free_run(board, x, y, dir);
+
+    if (available_len == 0)
+    {
+        return 0;
+    }
+
+    len = 1 + rng_range(rng, available_len);
+    paint_line(board, x, y, dir, len);
+
+    return len;
+}
+
+/**
+* Проверяет, что поле полностью покрыто (не осталось свободных клеток)
+* Достаточно сравнить маску каждой строки с полностью заполненной
+* @param board битовые маски поля
+* @return 1 если пустых клеток нет, 0 если есть хотя бы одна
+*/
+ALWAYS_INLINE int is_fully_covered(Bitboard* board)
+{
+    Mask full;
+
+    full = (1u << (board->cols + 2)) - 1u;
+
+    for (int row_index = 0; row_index < board->rows; row_index++)
+    {
+        if (board->row_bits[row_index] != full)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+* Проверяет, что попытка уже не может удаться, не дожидаясь конца построения:
+* у необработанной чёрной клетки заняты все четыре соседа, значит её число
+* будет 0. Соседей проверяют сразу для всей строки (столбца) битовыми
+* операциями. Запертая чёрная клетка может появиться только рядом с новыми
+* линиями, поэтому проверяются лишь строки rows и столбцы cols (бит x — строка x)
+* @param board битовые маски поля
+* @param pending необработанные чёрные клетки
+* @param rows строки, которые задели новые линии
+* @param cols столбцы, которые задели новые линии
+* @return 1 если попытку нужно прервать, иначе 0
+*/
+ALWAYS_INLINE int attempt_is_dead(Bitboard* board, Pending* pending, Mask rows, Mask cols)
+{
+    Mask full_row;
+    Mask full_col;
+
+    full_row = (1u << (board->cols + 2)) - 1u;
+    full_col = (1u << (board->rows + 2)) - 1u;
+
+    for (Mask left = rows; left != 0; left &= left - 1u)
+    {
+        int x = lowest_bit(left);
+        Mask row = board->row_bits[x];
+        Mask above = x > 0 ? board->row_bits[x - 1] : full_row;
+        Mask below = x + 1 < board->rows ? board->row_bits[x + 1] : full_row;
+
+        if ((pending->row[x] & (row << 1) & (row >> 1) & above & below) != 0)
+        {
+            return 1;
+        }
+    }
+
+    for (Mask left = cols; left != 0; left &= left - 1u)
+    {
+        int y = lowest_bit(left);
+        Mask col = board->col_bits[y];
+        Mask before = y > 0 ? board->col_bits[y - 1] : full_col;
+        Mask after = y + 1 < board->cols ? board->col_bits[y + 1] : full_col;
+
+        if ((pending->col[y] & (col << 1) & (col >> 1) & before & after) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+* Выбирает количество чёрных клеток для поля. Если для этого размера и способа
+* генерации есть выученная плотность (density_table, режим --tune), количество
+* берётся из её диапазона, иначе — по статической таблице плотности по площади
+* @param rows количество строк
+* @param cols количество столбцов
+* @param engine способ генерации (ENGINE_REJECTION или ENGINE_CONSTRUCTIVE)
+* @param rng генератор случайных чисел
+* @return количество чёрных клеток
+*/
+int pick_black_count(int rows, int cols, int engine, Rng* rng)
+{
+    DensityEntry* entry;
+    int area;
+
+    entry = &density_table[engine][rows][cols];
+
+    if (entry->max > 0)
+    {
+        return entry->min + rng_range(rng, entry->max - entry->min + 1);
+    }
+
+    area = rows * cols;
+
+    typedef struct
+    {
+        int field_area;
+        int blacks_count;
+        int amount_of_rand_numbers;
+    } BlackParams;
+
+    BlackParams black_params[] = {
+        {25,  3, 3},
+        {64,  9, 4},
+        {81,  15, 5},
+        {100, 36, 6},
+        {121, 45, 7},
+        {144, 56, 8}
+    };
+
+    int black_params_count = (int)(sizeof(black_params) / sizeof(black_params[0]));
+    int i = 0;
+
+    /* поля больше таблицы берут её последнюю строку */
+    while (i < black_params_count - 1 && area > black_params[i].field_area)
+    {
+        i++;
+    }
+
+    return black_params[i].blacks_count + rng_range(rng, black_params[i].amount_of_rand_numbers);
+}
+
+/**
+* Загружает выученную плотность чёрных клеток в density_table
+* Формат файла: строки «rows cols engine min max rate», где engine —
+* rejection или constructive, rate — принятых полей в секунду при подборе;
+* пустые строки и строки, начинающиеся с '#', пропускаются, как и строки
+* с некорректными значениями
+* @param filename имя файла
+* @return количество загруженных записей, -4 если файл открыть не удалось
+*/
+int density_load(char* filename)
+{
+    FILE* file;
+    char line[128];
+    int loaded;
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return -4;
+    }
+
+    loaded = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char engine_name[16];
+        int rows;
+        int cols;
+        int engine;
+        DensityEntry entry;
+
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+
+        if (sscanf(line, "%d %d %15s %d %d %lf", &rows, &cols, engine_name, &entry.min, &entry.max, &entry.rate) != 6)
+        {
+            continue;
+        }
+
+        if (strcmp(engine_name, "rejection") == 0)
+        {
+            engine = ENGINE_REJECTION;
+        }
+        else if (strcmp(engine_name, "constructive") == 0)
+        {
+            engine = ENGINE_CONSTRUCTIVE;
+        }
+        else
+        {
+            continue;
+        }
+
+        if (rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE || rows > MAX_FIELD_SIZE || cols > MAX_FIELD_SIZE
+            || entry.min < 1 || entry.max < entry.min || entry.max >= rows * cols)
+        {
+            continue;
+        }
+
+        density_table[engine][rows][cols] = entry;
+        loaded++;
+    }
+
+    fclose(file);
+
+    return loaded;
+}
+
+/**
+* Сохраняет все выученные записи density_table в файл (формат density_load)
+* @param filename имя файла
+* @return 0 при успехе, -4 если файл открыть не удалось
+*/
+int density_save(char* filename)
+{
+    FILE* file;
+
+    file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        printf("Ошибка открытия файла!\n");
+        return -4;
+    }
+
+    fprintf(file, "# rows cols engine min max rate\n");
+
+    for (int engine = ENGINE_REJECTION; engine <= ENGINE_CONSTRUCTIVE; engine++)
+    {
+        for (int rows = MIN_FIELD_SIZE; rows <= MAX_FIELD_SIZE; rows++)
+        {
+            for (int cols = MIN_FIELD_SIZE; cols <= MAX_FIELD_SIZE; cols++)
+            {
+                DensityEntry* entry = &density_table[engine][rows][cols];
+
+                if (entry->max > 0)
+                {
+                    fprintf(file, "%d %d %s %d %d %.2f\n", rows, cols,
+                        engine == ENGINE_CONSTRUCTIVE ? "constructive" : "rejection",
+                        entry->min, entry->max, entry->rate);
+                }
+            }
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/**
+* Вычисляет хеш диапазонов min..max таблицы плотности density_table для способа
+* генерации engine по всем размерам (rng_mix). От этих диапазонов зависит количество
+* чёрных клеток, поэтому поля с одним номером совпадают только при равных хешах
+* @param engine способ генерации
+* @return хеш таблицы
+*/
+unsigned long long density_hash(int engine)
+{
+    unsigned long long h = 0;
+
+    for (int rows = MIN_FIELD_SIZE; rows <= MAX_FIELD_SIZE; rows++)
+    {
+        for (int cols = MIN_FIELD_SIZE; cols <= MAX_FIELD_SIZE; cols++)
+        {
+            DensityEntry* entry = &density_table[engine][rows][cols];
+
+            h = rng_mix(h ^ ((unsigned long long)(unsigned int)entry->min << 32 | (unsigned long long)(unsigned int)entry->max));
+        }
+    }
+
+    return h;
+}
+
+/**
+* Вычисляет хеш канонической формы поля: поле переводится всеми преобразованиями
+* симметрии (8 для квадратного поля, 4 — повороты на 180 градусов и отражения —
+* для прямоугольного), каждый вариант хешируется построчно вместе с размерами,
+* и берётся наименьший хеш. Поле и его повёрнутые и отражённые копии получают
+* одинаковый хеш
+* @param field игровое поле
+* @return хеш (не равен 0)
+*/
+unsigned long long field_canonical_hash(Field* field)
+{
+    unsigned long long best;
+    int rows;
+    int cols;
+    int symmetries;
+
+    rows = field->rows;
+    cols = field->cols;
+    symmetries = rows == cols ? 8 : 4;
+    best = ~0ULL;
+
+    /* биты t: 1 — отражение столбцов, 2 — отражение строк, 4 — транспонирование */
+    for (int t = 0; t < symmetries; t++)
+    {
+        unsigned long long h;
+        int swap = (t & 4) != 0;
+        int out_rows = swap ? cols : rows;
+        int out_cols = swap ? rows : cols;
+
+        h = rng_mix(((unsigned long long)out_rows << 32) | (unsigned long long)out_cols);
+
+        for (int i = 0; i < out_rows; i++)
+        {
+            for (int j = 0; j < out_cols; j++)
+            {
+                int x = swap ? j : i;
+                int y = swap ? i : j;
+
+                x = (t & 2) ? rows - 1 - x : x;
+                y = (t & 1) ? cols - 1 - y : y;
+
+                /* FNV-1a по значениям клеток */
+                h = (h ^ (unsigned long long)(unsigned int)FIELD_AT(field, x, y)) * 0x100000001B3ULL;
+            }
+        }
+
+        h = rng_mix(h);
+
+        if (h < best)
+        {
+            best = h;
+        }
+    }
+
+    return best != 0 ? best : 1;
+}
+
+/**
+* Создаёт пустое множество хешей на HASH_SET_MIN ячеек
+* @param set множество
+* @return 0 при успехе, -1 при ошибке выделения памяти
+*/
+int hash_set_init(HashSet* set)
+{
+    set->keys = (unsigned long long*)calloc(HASH_SET_MIN, sizeof(unsigned long long));
+    set->capacity = set->keys != NULL ? HASH_SET_MIN : 0;
+    set->count = 0;
+
+    return set->keys != NULL ? 0 : -1;
+}
+
+/**
+* Добавляет хеш в множество за O(1) в среднем
+* Когда множество заполнено на 3/4, таблица увеличивается вдвое
+* @param set множество
+* @param key хеш (не равен 0, см. field_canonical_hash)
+* @return 1 если хеш добавлен, 0 если он уже был в множестве, -1 при ошибке выделения памяти
+*/
+int hash_set_insert(HashSet* set, unsigned long long key)
+{
+    size_t mask;
+    size_t i;
+
+    if ((set->count + 1) * 4 > set->capacity * 3)
+    {
+        unsigned long long* old_keys = set->keys;
+        size_t old_capacity = set->capacity;
+        unsigned long long* keys;
+
+        keys = (unsigned long long*)calloc(old_capacity * 2, sizeof(unsigned long long));
+        if (keys == NULL)
+        {
+            return -1;
+        }
+
+        set->keys = keys;
+        set->capacity = old_capacity * 2;
+        set->count = 0;
+
+        for (i = 0; i < old_capacity; i++)
+        {
+            if (old_keys[i] != 0)
+            {
+                hash_set_insert(set, old_keys[i]);
+            }
+        }
+
+        free(old_keys);
+    }
+
+    /* хеши уже перемешаны (rng_mix), поэтому младшие биты годятся как номер ячейки */
+    mask = set->capacity - 1;
+    i = (size_t)key & mask;
+
+    while (set->keys[i] != 0)
+    {
+        if (set->keys[i] == key)
+        {
+            return 0;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    set->keys[i] = key;
+    set->count++;
+
+    return 1;
+}
+
+/**
+* Загружает хеши в множество из файла
+* Формат файла: по одному хешу на строку в шестнадцатеричном виде;
+* строки, начинающиеся с '#', и некорректные строки пропускаются
+* @param set множество
+* @param filename имя файла
+* @return количество загруженных хешей, -4 если файл открыть не удалось,
+* -1 при ошибке выделения памяти
+*/
+int hash_set_load(HashSet* set, char* filename)
+{
+    FILE* file;
+    char line[64];
+    int loaded;
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return -4;
+    }
+
+    loaded = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long long key;
+
+        if (line[0] == '#' || sscanf(line, "%llx", &key) != 1 || key == 0)
+        {
+            continue;
+        }
+
+        if (hash_set_insert(set, key) < 0)
+        {
+            fclose(file);
+            return -1;
+        }
+
+        loaded++;
+    }
+
+    fclose(file);
+
+    return loaded;
+}
+
+/**
+* Сохраняет все хеши множества в файл (формат hash_set_load)
+* @param set множество
+* @param filename имя файла
+* @return 0 при успехе, -4 если файл открыть не удалось
+*/
+int hash_set_save(HashSet* set, char* filename)
+{
+    FILE* file;
+
+    file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        printf("Ошибка открытия файла!\n");
+        return -4;
+    }
+
+    setvbuf(file, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+    fprintf(file, "# canonical field hashes\n");
+
+    for (size_t i = 0; i < set->capacity; i++)
+    {
+        if (set->keys[i] != 0)
+        {
+            fprintf(file, "%016llx\n", set->keys[i]);
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/**
+* Освобождает память множества хешей
+* @param set множество
+* @return 0
+*/
+int hash_set_free(HashSet* set)
+{
+    free(set->keys);
+    set->keys = NULL;
+    set->capacity = 0;
+    set->count = 0;
+
+    return 0;
+}
+
+/**
+* Создаёт итоговое поле: WHITE во всех клетках, кроме чёрных,
+* в чёрных клетках — суммарная длина их линий
+* @param rows количество строк
+* @param cols количество столбцов
+* @param blacks координаты чёрных клеток
+* @param line_len длины линий чёрных клеток по четырём направлениям
+* @param black_count количество чёрных клеток
+* @return указатель на поле, либо NULL при ошибке выделения памяти
+*/
+Field* build_field(int rows, int cols, Point* blacks, int (*line_len)[4], int black_count)
+{
+    Field* puzzle;
+
+    puzzle = create_scratch_field(rows, cols);
+    if (puzzle == NULL)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < rows; i++)
+    {
+        memset(&FIELD_AT(puzzle, i, 0), WHITE, (size_t)cols * sizeof(Cell));
+    }
+
+    for (int k = 0; k < black_count; k++)
+    {
+        FIELD_AT(puzzle, blacks[k].x, blacks[k].y) = (Cell)(line_len[k][0] + line_len[k][1] + line_len[k][2] + line_len[k][3]);
+    }
+
+    return puzzle;
+}
+
+/**
+* Генерирует поле выбранным способом; количество чёрных клеток
+* выбирает pick_black_count
+* @param rows количество строк
+* @param cols количество столбцов
+* @param engine способ генерации (ENGINE_REJECTION или ENGINE_CONSTRUCTIVE)
+* @param rng генератор случайных чисел
+* @return указатель на поле, либо NULL если попытка не удалась
+*/
+Field* generate_field(int rows, int cols, int engine, Rng* rng)
+{
+    int black_count;
+
+    black_count = pick_black_count(rows, cols, engine, rng);
+
+    if (engine == ENGINE_CONSTRUCTIVE)
+    {
+        return generate_puzzle_constructive(rows, cols, black_count, rng);
+    }
+
+    return generate_puzzle(rows, cols, black_count, rng);
+}
+
+/**
+* Генерирует большое поле (сторона больше MAX_FIELD_SIZE, до LARGE_MAX_SIZE)
+* из плиток со стороной не больше TILE_SIZE (tile_start):
+* 1) каждая плитка заполняется отдельным полем с единственным решением
+*    (tile_generate);
+* 2) проверяется, что распространение ограничений по всему полю определяет
+*    длину каждого луча (tiled_mark_unfixed) — тогда решение единственно.
+*    Плитки с неопределёнными лучами генерируются заново, и проверка
+*    повторяется (не больше TILE_MAX_ROUNDS раз). Если плитка отмечается
+*    TILE_STRIKES раз подряд, заново генерируются и её соседки:
+*    неоднозначность может держаться на них.
+* Распространение проходит всё поле за линейное время, а переделываются
+* только плитки с неопределёнными лучами, поэтому время и память растут
+* примерно линейно с площадью поля. Поле, решение которого единственно, но
+* не находится одним распространением, отбрасывается
+* @param rows количество строк
+* @param cols количество столбцов
+* @param engine способ генерации плиток
+* @param rng генератор случайных чисел
+* @return указатель на поле в рабочей области потока (create_scratch_field),
+* либо NULL если за TILE_MAX_ROUNDS проверок
+* не удалось добиться единственности решения, плитку не удалось
+* сгенерировать или при ошибке выделения памяти
+*/
+Field* generate_tiled(int rows, int cols, int engine, Rng* rng)
+{
+    Field* puzzle;
+    char* redo;
+    char* strikes;
+    int tile_rows;
+    int tile_cols;
+    int unfixed;
+    int round;
+    size_t mark;
+
+    tile_rows = (rows + TILE_SIZE - 1) / TILE_SIZE;
+    tile_cols = (cols + TILE_SIZE - 1) / TILE_SIZE;
+
+    mark = scratch.used;
+    puzzle = create_scratch_field(rows, cols);
+    redo = (char*)arena_alloc(&scratch, (size_t)(tile_rows * tile_cols) * 2);
+
+    if (puzzle == NULL || redo == NULL)
+    {
+        arena_free(&scratch, redo);
+        free_field(puzzle);
+        arena_release(&scratch, mark);
+        return NULL;
+    }
+
+    strikes = redo + tile_rows * tile_cols;
+    memset(redo, 1, (size_t)(tile_rows * tile_cols));
+    memset(strikes, 0, (size_t)(tile_rows * tile_cols));
+    unfixed = tile_rows * tile_cols;
+
+    for (round = 0; unfixed > 0 && round < TILE_MAX_ROUNDS; round++)
+    {
+        for (int tr = 0; tr < tile_rows && unfixed > 0; tr++)
+        {
+            for (int tc = 0; tc < tile_cols && unfixed > 0; tc++)
+            {
+                if (redo[tr * tile_cols + tc] && tile_generate(puzzle, tr, tc, tile_rows, tile_cols, engine, rng) != 0)
+                {
+                    unfixed = -1;
+                }
+            }
+        }
+
+        if (unfixed > 0)
+        {
+            unfixed = tiled_mark_unfixed(puzzle, tile_rows, tile_cols, redo);
+            gen_stats.rejected_seam += unfixed > 0 ? unfixed : 0;
+        }
+
+        for (int t = 0; t < tile_rows * tile_cols && unfixed > 0; t++)
+        {
+            strikes[t] = redo[t] == 1 ? strikes[t] + 1 : 0;
+
+            if (strikes[t] >= TILE_STRIKES)
+            {
+                int tr = t / tile_cols;
+                int tc = t % tile_cols;
+
+                for (int nr = tr - 1; nr <= tr + 1; nr++)
+                {
+                    for (int nc = tc - 1; nc <= tc + 1; nc++)
+                    {
+                        if (nr >= 0 && nc >= 0 && nr < tile_rows && nc < tile_cols && !redo[nr * tile_cols + nc])
+                        {
+                            /* 2 — соседка отмечена здесь, её счётчик не увеличивается */
+                            redo[nr * tile_cols + nc] = 2;
+                        }
+                    }
+                }
+
+                strikes[t] = 0;
+            }
+        }
+    }
+
+    arena_free(&scratch, redo);
+
+    if (unfixed != 0)
+    {
+        free_field(puzzle);
+        arena_release(&scratch, mark);
+        return NULL;
+    }
+
+    return puzzle;
+}
+
+/**
+* Возвращает начало плитки номер index, если сторону size поделить
+* на count плиток почти равной длины (длины отличаются не больше чем на 1)
+* @param size длина стороны поля
+* @param count количество плиток на стороне
+* @param index номер плитки (от 0 до count; при count — длина стороны)
+* @return номер первой строки (столбца) плитки
+*/
+int tile_start(int size, int count, int index)
+{
+    return (int)((long long)index * size / count);
+}
+
+/**
+* Заполняет плитку большого поля новым полем с единственным решением
+* (generate_field и is_solvable, не больше TILE_MAX_TRIES попыток).
+* Из первых TILE_CONTEXT_TRIES подходящих полей выбирается первое, лучи
+* которого определяются распространением ограничений вместе с соседними
+* плитками (tile_context_fixed): такие плитки почти не дают неоднозначности
+* на стыках, и tiled_mark_unfixed отмечает мало плиток
+* @param field большое поле
+* @param tr номер строки плиток
+* @param tc номер столбца плиток
+* @param tile_rows количество плиток по вертикали
+* @param tile_cols количество плиток по горизонтали
+* @param engine способ генерации
+* @param rng генератор случайных чисел
+* @return 0 при успехе, -1 если поле за TILE_MAX_TRIES попыток не получено
+*/
+int tile_generate(Field* field, int tr, int tc, int tile_rows, int tile_cols, int engine, Rng* rng)
+{
+    int x0 = tile_start(field->rows, tile_rows, tr);
+    int y0 = tile_start(field->cols, tile_cols, tc);
+    int height = tile_start(field->rows, tile_rows, tr + 1) - x0;
+    int width = tile_start(field->cols, tile_cols, tc + 1) - y0;
+    int placed = 0;
+    size_t mark = scratch.used;
+
+    for (int tries = 0; tries < TILE_MAX_TRIES && placed < TILE_CONTEXT_TRIES; tries++)
+    {
+        Field* tile;
+        int is_fixed = 0;
+
+        tile = generate_field(height, width, engine, rng);
+        if (tile == NULL)
+        {
+            arena_release(&scratch, mark);
+            continue;
+        }
+
+        if (is_solvable(tile))
+        {
+            for (int i = 0; i < height; i++)
+            {
+                memcpy(&FIELD_AT(field, x0 + i, y0), &FIELD_AT(tile, i, 0), (size_t)width * sizeof(Cell));
+            }
+
+            placed++;
+            is_fixed = tile_context_fixed(field, tr, tc, tile_rows, tile_cols);
+        }
+
+        free_field(tile);
+        arena_release(&scratch, mark);
+
+        if (is_fixed)
+        {
+            return 0;
+        }
+    }
+
+    /* ни одно поле не определилось вместе с соседками: остаётся последнее */
+    return placed > 0 ? 0 : -1;
+}
+
+/**
+* Проверяет, что распространение ограничений определяет все лучи плитки,
+* если решать её вместе с соседними плитками: окно из плитки и восьми её
+* соседок решается как отдельное поле. Окно состоит из целых плиток, поэтому
+* каждая его белая клетка может быть покрыта лучами внутри окна. Ещё не
+* заполненные клетки (EMPTY) и края окна лучи не пропускают, поэтому проверка
+* приблизительная — точную проверку делает tiled_mark_unfixed
+* @param field большое поле
+* @param tr номер строки плиток
+* @param tc номер столбца плиток
+* @param tile_rows количество плиток по вертикали
+* @param tile_cols количество плиток по горизонтали
+* @return 1 если все лучи плитки определены, иначе 0
+*/
+int tile_context_fixed(Field* field, int tr, int tc, int tile_rows, int tile_cols)
+{
+    Field* window;
+    Solver solver;
+    int x0 = tile_start(field->rows, tile_rows, tr);
+    int y0 = tile_start(field->cols, tile_cols, tc);
+    int x1 = tile_start(field->rows, tile_rows, tr + 1);
+    int y1 = tile_start(field->cols, tile_cols, tc + 1);
+    int wx0 = tile_start(field->rows, tile_rows, tr > 0 ? tr - 1 : 0);
+    int wy0 = tile_start(field->cols, tile_cols, tc > 0 ? tc - 1 : 0);
+    int wx1 = tile_start(field->rows, tile_rows, tr + 1 < tile_rows ? tr + 2 : tile_rows);
+    int wy1 = tile_start(field->cols, tile_cols, tc + 1 < tile_cols ? tc + 2 : tile_cols);
+    int fixed;
+    int b;
+    size_t mark = scratch.used;
+
+    window = create_scratch_field(wx1 - wx0, wy1 - wy0);
+    if (window == NULL)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < window->rows; i++)
+    {
+        memcpy(&FIELD_AT(window, i, 0), &FIELD_AT(field, wx0 + i, wy0), (size_t)window->cols * sizeof(Cell));
+    }
+
+    if (solver_build(&solver, window) != 0)
+    {
+        free_field(window);
+        arena_release(&scratch, mark);
+        return 0;
+    }
+
+    fixed = solver_propagate(&solver);
+    b = 0;
+
+    for (int x = wx0; x < wx1 && fixed; x++)
+    {
+        for (int y = wy0; y < wy1 && fixed; y++)
+        {
+            if (FIELD_AT(field, x, y) > 0)
+            {
+                short* bound = &solver.bounds[b * 8];
+                int inside = x >= x0 && x < x1 && y >= y0 && y < y1;
+
+                if (inside && (bound[0] < bound[1] || bound[2] < bound[3] || bound[4] < bound[5] || bound[6] < bound[7]))
+                {
+                    fixed = 0;
+                }
+
+                b++;
+            }
+        }
+    }
+
+    solver_free(&solver);
+    free_field(window);
+    arena_release(&scratch, mark);
+
+    return fixed;
+}
+
+/**
+* Проверяет единственность решения большого поля и отмечает в redo плитки,
+* которые нужно сгенерировать заново. Для всего поля выполняется
+* распространение ограничений (solver_propagate) — оно проходит поле за
+* линейное время. Если после него длина каждого луча определена, решение
+* единственно; иначе отмечаются плитки чёрных клеток с неопределёнными лучами.
+* Перебор не выполняется: на полях в тысячи чёрных клеток неопределённые лучи
+* соседних плиток сцепляются в группы, перебор по которым слишком долог
+* @param field большое поле (каждая плитка — поле с единственным решением)
+* @param tile_rows количество плиток по вертикали
+* @param tile_cols количество плиток по горизонтали
+* @param redo флаги плиток (заполняются: 1 — переделать)
+* @return количество отмеченных плиток (0 — решение единственно),
+* -1 при ошибке выделения памяти или если у поля нет решения
+*/
+int tiled_mark_unfixed(Field* field, int tile_rows, int tile_cols, char* redo)
+{
+    Solver solver;
+    int marked;
+    int b;
+    size_t mark = scratch.used;
+
+    if (solver_build(&solver, field) != 0)
+    {
+        arena_release(&scratch, mark);
+        return -1;
+    }
+
+    if (!solver_propagate(&solver))
+    {
+        solver_free(&solver);
+        arena_release(&scratch, mark);
+        return -1;
+    }
+
+    memset(redo, 0, (size_t)(tile_rows * tile_cols));
+    marked = 0;
+    b = 0;
+
+    for (int x = 0; x < field->rows; x++)
+    {
+        for (int y = 0; y < field->cols; y++)
+        {
+            if (FIELD_AT(field, x, y) > 0)
+            {
+                short* bound = &solver.bounds[b * 8];
+
+                if (bound[0] < bound[1] || bound[2] < bound[3] || bound[4] < bound[5] || bound[6] < bound[7])
+                {
+                    /* плитка номер k начинается в строке k * rows / tile_rows */
+                    int tile = ((x + 1) * tile_rows - 1) / field->rows * tile_cols + ((y + 1) * tile_cols - 1) / field->cols;
+
+                    marked += !redo[tile];
+                    redo[tile] = 1;
+                }
+
+                b++;
+            }
+        }
+    }
+
+    if (marked == 0)
+    {
+        /* все лучи определены: перебор проходит одну ветку и проверяет её */
+        solver.limit = SOLUTION_LIMIT;
+        solver_search(&solver);
+        marked = solver.solutions == 1 ? 0 : -1;
+    }
+
+    solver_free(&solver);
+    arena_release(&scratch, mark);
+
+    return marked;
+}
+
+/**
+* Генерирует одно игровое поле головоломки «Роза ветров»
+* 1) размещает чёрные клетки
+* 2) пытается провести линии от каждой чёрной клетки; перед каждой чёрной
+*    клеткой проверяет, что попытка ещё может удаться (attempt_is_dead),
+*    и прерывает обречённую попытку сразу
+* 3) проверяет покрытие поля; если свободных клеток осталось немного
+*    (не больше REPAIR_MAX_CELLS), пытается их покрыть (repair_coverage)
+* 4) создаёт поле в формате: WHITE (0) и числа в чёрных клетках
+* Занятость клеток во время генерации хранится в битовых масках (Bitboard),
+* поэтому память под поле выделяется только для удачной попытки
+* @param rows количество строк
+* @param cols количество столбцов
+* @param black_count количество чёрных клеток (меньше rows * cols)
+* @param rng генератор случайных чисел (у каждого потока свой)
+* @return указатель на сгенерированное поле, либо NULL если генерация не удалась
+*/
+Field* generate_puzzle(int rows, int cols, int black_count, Rng* rng)
+{
+    GenerateKernel kernel;
+
+    kernel = rows <= MAX_FIELD_SIZE && cols <= MAX_FIELD_SIZE ? generate_kernels[rows][cols] : NULL;
+
+    if (kernel != NULL)
+    {
+        return kernel(black_count, rng);
+    }
+
+    return generate_puzzle_body(rows, cols, black_count, rng);
+}
+
+/*
+* Ядра generate_puzzle для каждого размера поля от MIN_FIELD_SIZE до MAX_FIELD_SIZE:
+* в каждое встраивается тело generate_puzzle_body с постоянными rows и cols,
+* поэтому границы циклов, маски рамки и множители rng_range в нём известны
+* при компиляции. generate_puzzle выбирает ядро по размерам из generate_kernels
+*/
+#define GENERATE_KERNEL(r, c) \
+    Field* generate_puzzle_##r##x##c(int black_count, Rng* rng) \
+    { \
+        return generate_puzzle_body(r, c, black_count, rng); \
+    }
+
+#define GENERATE_KERNEL_ROW(r) \
+    GENERATE_KERNEL(r, 3) GENERATE_KERNEL(r, 4) GENERATE_KERNEL(r, 5) GENERATE_KERNEL(r, 6) GENERATE_KERNEL(r, 7) \
+    GENERATE_KERNEL(r, 8) GENERATE_KERNEL(r, 9) GENERATE_KERNEL(r, 10) GENERATE_KERNEL(r, 11) GENERATE_KERNEL(r, 12)
+
+#define GENERATE_KERNEL_ENTRIES(r) \
+    { NULL, NULL, NULL, generate_puzzle_##r##x3, generate_puzzle_##r##x4, generate_puzzle_##r##x5, \
+      generate_puzzle_##r##x6, generate_puzzle_##r##x7, generate_puzzle_##r##x8, generate_puzzle_##r##x9, \
+      generate_puzzle_##r##x10, generate_puzzle_##r##x11, generate_puzzle_##r##x12 }
+
+GENERATE_KERNEL_ROW(3)
+GENERATE_KERNEL_ROW(4)
+GENERATE_KERNEL_ROW(5)
+GENERATE_KERNEL_ROW(6)
+GENERATE_KERNEL_ROW(7)
+GENERATE_KERNEL_ROW(8)
+GENERATE_KERNEL_ROW(9)
+GENERATE_KERNEL_ROW(10)
+GENERATE_KERNEL_ROW(11)
+GENERATE_KERNEL_ROW(12)
+
+const GenerateKernel generate_kernels[MAX_FIELD_SIZE + 1][MAX_FIELD_SIZE + 1] = {
+    { NULL }, { NULL }, { NULL },
+    GENERATE_KERNEL_ENTRIES(3),
+    GENERATE_KERNEL_ENTRIES(4),
+    GENERATE_KERNEL_ENTRIES(5),
+    GENERATE_KERNEL_ENTRIES(6),
+    GENERATE_KERNEL_ENTRIES(7),
+    GENERATE_KERNEL_ENTRIES(8),
+    GENERATE_KERNEL_ENTRIES(9),
+    GENERATE_KERNEL_ENTRIES(10),
+    GENERATE_KERNEL_ENTRIES(11),
+    GENERATE_KERNEL_ENTRIES(12)
+};
+
+/**
+* Тело generate_puzzle (шаги 1–4): встраивается в ядро каждого размера
+* поля, а для других размеров вызывается с размерами-переменными
+* @param rows количество строк
+* @param cols количество столбцов
+* @param black_count количество чёрных клеток (меньше rows * cols)
+* @param rng генератор случайных чисел
+* @return указатель на сгенерированное поле, либо NULL если генерация не удалась
+*/
+ALWAYS_INLINE Field* generate_puzzle_body(int rows, int cols, int black_count, Rng* rng)
+{
+    Field* puzzle;
+    Bitboard board;
+    Pending pending;
+    int capacity;
+    Point* blacks;
+    int (*line_len)[4];
+    int placed;
+    int is_alive;
+
+    gen_stats.attempts++;
+    capacity = black_count + REPAIR_MAX_CELLS;
+
+    /* ошибки выделения памяти учитываются в gen_stats.rejected_alloc (counted_malloc) */
+    blacks = (Point*)arena_alloc(&scratch, (size_t)capacity * sizeof(Point));
+    if (blacks == NULL)
+    {
+        return NULL;
+    }
+
+    line_len = (int(*)[4])arena_alloc(&scratch, (size_t)capacity * sizeof(*line_len));
+    if (line_len == NULL)
+    {
+        arena_free(&scratch, blacks);
+        return NULL;
+    }
+
+    memset(line_len, 0, (size_t)capacity * sizeof(*line_len));
+
+    PROFILE_START(place_start);
+    bitboard_init(&board, rows, cols);
+    placed = 0;
+
+    while (placed < black_count)
+    {
+        int x;
+        int y;
+
+        x = rng_range(rng, rows);
+        y = rng_range(rng, cols);
+
+        if (!bitboard_is_set(&board, x, y))
+        {
+            bitboard_set(&board, x, y);
+            blacks[placed].x = x;
+            blacks[placed].y = y;
+            placed++;
+        }
+    }
+
+    memset(&pending, 0, sizeof(pending));
+
+    for (int i = 0; i < black_count; i++)
+    {
+        pending.row[blacks[i].x] |= 1u << (blacks[i].y + 1);
+        pending.col[blacks[i].y] |= 1u << (blacks[i].x + 1);
+    }
+
+    PROFILE_STOP(place_start, place_cycles);
+    PROFILE_START(draw_start);
+    is_alive = !attempt_is_dead(&board, &pending, (1u << rows) - 1u, (1u << cols) - 1u);
+
+    for (int i = 0; i < black_count && is_alive; i++)
+    {
+        int dirs[4] = { 0, 1, 2, 3 };
+        int temp;
+        int x;
+        int y;
+        Mask touched_rows;
+        Mask touched_cols;
+
+        for (int j = 0; j < 4; j++)
+        {
+            int k = rng_range(rng, 4);
+            temp = dirs[j];
+            dirs[j] = dirs[k];
+            dirs[k] = temp;
+        }
+
+        x = blacks[i].x;
+        y = blacks[i].y;
+        pending.row[x] &= ~(1u << (y + 1));
+        pending.col[y] &= ~(1u << (x + 1));
+
+        for (int d = 0; d < 4; d++)
+        {
+            line_len[i][dirs[d]] = draw_line(&board, x, y, dirs[d], rng);
+        }
+
+        if (line_len[i][0] + line_len[i][1] + line_len[i][2] + line_len[i][3] <= 0)
+        {
+            is_alive = 0;
+            break;
+        }
+
+        /* строки и столбцы, которые задели новые линии (включая клетку самой чёрной) */
+        touched_rows = ((2u << (x + line_len[i][1])) - 1u) & ~((1u << (x - line_len[i][0])) - 1u);
+        touched_cols = ((2u << (y + line_len[i][3])) - 1u) & ~((1u << (y - line_len[i][2])) - 1u);
+        is_alive = !attempt_is_dead(&board, &pending, touched_rows, touched_cols);
+    }
+
+    PROFILE_STOP(draw_start, draw_cycles);
+
+    if (!is_alive)
+    {
+        gen_stats.rejected_boxed++;
+        arena_free(&scratch, line_len);
+        arena_free(&scratch, blacks);
+        return NULL;
+    }
+
+    PROFILE_START(finish_start);
+    is_alive = is_fully_covered(&board) || repair_coverage(&board, blacks, line_len, &black_count, capacity, rng);
+    PROFILE_STOP(finish_start, finish_cycles);
+
+    if (!is_alive)
+    {
+        gen_stats.rejected_uncovered++;
+        arena_free(&scratch, line_len);
+        arena_free(&scratch, blacks);
+        return NULL;
+    }
+
+    puzzle = build_field(rows, cols, blacks, line_len, black_count);
+
+    arena_free(&scratch, line_len);
+    arena_free(&scratch, blacks);
+
+    return puzzle;
+}
+
+/**
+* Находит чёрную клетку, линия которой заканчивается точно в клетке (x, y)
+* и направлена в сторону, противоположную dir. Такая чёрная клетка может
+* стоять только дальше по направлению dir на той же строке или столбце
+* @param board битовые маски поля
+* @param black_at номера чёрных клеток по координатам (-1 — не чёрная)
+* @param blacks координаты чёрных клеток
+* @param line_len длины линий чёрных клеток по направлениям
+* @param x индекс строки клетки линии
+* @param y индекс столбца клетки линии
+* @param dir направление поиска чёрной клетки
+* @return номер чёрной клетки, либо -1 если клетка не является концом такой линии
+*/
+int repair_find_owner(Bitboard* board, short black_at[][MAX_FIELD_SIZE], Point* blacks, int (*line_len)[4], int x, int y, int dir)
+{
+    int cx;
+    int cy;
+    int b;
+
+    cx = x;
+    cy = y;
+
+    while (cx >= 0 && cx < board->rows && cy >= 0 && cy < board->cols && bitboard_is_set(board, cx, cy))
+    {
+        b = black_at[cx][cy];
+
+        if (b >= 0)
+        {
+            int dist = (cx - x) + (cy - y);
+
+            if (dist < 0)
+            {
+                dist = -dist;
+            }
+
+            if (dist > 0 && line_len[b][dir ^ 1] == dist && blacks[b].x + directions[dir ^ 1].dx * dist == x && blacks[b].y + directions[dir ^ 1].dy * dist == y)
+            {
+                return b;
+            }
+
+            return -1;
+        }
+
+        cx += directions[dir].dx;
+        cy += directions[dir].dy;
+    }
+
+    return -1;
+}
+
+/**
+* Пытается покрыть немногие оставшиеся свободные клетки, не отбрасывая попытку
+* Для каждой свободной клетки по очереди:
+* 1) продлевает луч, который может до неё дотянуться (чёрная клетка со
+*    свободным путём или конец линии, направленной к клетке);
+* 2) иначе делает клетку чёрной с линией через соседние свободные клетки;
+* 3) иначе делает клетку чёрной, забирая у соседней линии её последнюю клетку
+*    (если у владельца линии останется число не меньше 1).
+* Числа чёрных клеток пересчитываются из line_len, поэтому остаются согласованными
+* @param board битовые маски поля
+* @param blacks координаты чёрных клеток (ёмкость capacity)
+* @param line_len длины линий чёрных клеток по направлениям
+* @param black_count количество чёрных клеток (увеличивается при добавлении новых)
+* @param capacity ёмкость массивов blacks и line_len
+* @param rng генератор случайных чисел
+* @return 1 если поле стало полностью покрытым, 0 если исправить не удалось
+*/
+int repair_coverage(Bitboard* board, Point* blacks, int (*line_len)[4], int* black_count, int capacity, Rng* rng)
+{
+    short black_at[MAX_FIELD_SIZE][MAX_FIELD_SIZE];
+    Mask full;
+    int empty_cells;
+
+    full = (1u << (board->cols + 2)) - 1u;
+    empty_cells = 0;
+
+    for (int x = 0; x < board->rows; x++)
+    {
+        empty_cells += bit_count(~board->row_bits[x] & full);
+    }
+
+    if (empty_cells > REPAIR_MAX_CELLS)
+    {
+        return 0;
+    }
+
+    for (int x = 0; x < board->rows; x++)
+    {
+        for (int y = 0; y < board->cols; y++)
+        {
+            black_at[x][y] = -1;
+        }
+    }
+
+    for (int b = 0; b < *black_count; b++)
+    {
+        black_at[blacks[b].x][blacks[b].y] = (short)b;
+    }
+
+    for (int x = 0; x < board->rows; x++)
+    {
+        for (int y = 0; y < board->cols; y++)
+        {
+            int option_black[4];
+            int option_dir[4];
+            int option_count[4];
+            int options;
+            int fixed;
+
+            if (bitboard_is_set(board, x, y))
+            {
+                continue;
+            }
+
+            options = 0;
+
+            for (int e = 0; e < 4; e++)
+            {
+                int run = free_run(board, x, y, e);
+                int px = x + directions[e].dx * (run + 1);
+                int py = y + directions[e].dy * (run + 1);
+                int b;
+
+                if (px < 0 || px >= board->rows || py < 0 || py >= board->cols)
+                {
+                    continue;
+                }
+
+                b = black_at[px][py];
+                if (b < 0)
+                {
+                    b = repair_find_owner(board, black_at, blacks, line_len, px, py, e);
+                }
+
+                if (b >= 0)
+                {
+                    option_black[options] = b;
+                    option_dir[options] = e ^ 1;
+                    option_count[options] = run + 1;
+                    options++;
+                }
+            }
+
+            if (options > 0)
+            {
+                int pick = rng_range(rng, options);
+                int b = option_black[pick];
+                int dir = option_dir[pick];
+
+                paint_line(board, blacks[b].x + directions[dir].dx * line_len[b][dir], blacks[b].y + directions[dir].dy * line_len[b][dir], dir, option_count[pick]);
+                line_len[b][dir] += option_count[pick];
+                continue;
+            }
+
+            if (*black_count >= capacity)
+            {
+                return 0;
+            }
+
+            fixed = 0;
+
+            for (int e = 0; e < 4 && !fixed; e++)
+            {
+                int run = free_run(board, x, y, e);
+
+                if (run > 0)
+                {
+                    int b = (*black_count)++;
+
+                    blacks[b].x = x;
+                    blacks[b].y = y;
+                    line_len[b][0] = line_len[b][1] = line_len[b][2] = line_len[b][3] = 0;
+                    line_len[b][e] = run;
+                    black_at[x][y] = (short)b;
+                    bitboard_set(board, x, y);
+                    paint_line(board, x, y, e, run);
+                    fixed = 1;
+                }
+            }
+
+            for (int e = 0; e < 4 && !fixed; e++)
+            {
+                int nx = x + directions[e].dx;
+                int ny = y + directions[e].dy;
+                int owner;
+
+                if (nx < 0 || nx >= board->rows || ny < 0 || ny >= board->cols || black_at[nx][ny] >= 0)
+                {
+                    continue;
+                }
+
+                owner = repair_find_owner(board, black_at, blacks, line_len, nx, ny, e);
+
+                if (owner >= 0 && line_len[owner][0] + line_len[owner][1] + line_len[owner][2] + line_len[owner][3] >= 2)
+                {
+                    int b = (*black_count)++;
+
+                    line_len[owner][e ^ 1]--;
+                    blacks[b].x = x;
+                    blacks[b].y = y;
+                    line_len[b][0] = line_len[b][1] = line_len[b][2] = line_len[b][3] = 0;
+                    line_len[b][e] = 1;
+                    black_at[x][y] = (short)b;
+                    bitboard_set(board, x, y);
+                    fixed = 1;
+                }
+            }
+
+            if (!fixed)
+            {
+                return 0;
+            }
+        }
+    }
+
+    return is_fully_covered(board);
+}
+
+/**
+* Добавляет чёрную клетку в построение
+* @param build состояние конструктивной генерации
+* @param x индекс строки
+* @param y индекс столбца
+* @return номер добавленной чёрной клетки
+*/
+int construction_add_black(Construction* build, int x, int y)
+{
+    int b;
+
+    b = build->black_count++;
+    build->blacks[b].x = x;
+    build->blacks[b].y = y;
+    build->line_len[b][0] = 0;
+    build->line_len[b][1] = 0;
+    build->line_len[b][2] = 0;
+    build->line_len[b][3] = 0;
+    build->black_at[x][y] = (short)b;
+    bitboard_set(&build->board, x, y);
+
+    return b;
+}
+
+/**
+* Продлевает линию чёрной клетки b в направлении dir на count клеток
+* (клетки за концом линии должны быть свободны)
+* @param build состояние конструктивной генерации
+* @param b номер чёрной клетки
+* @param dir номер направления
+* @param count на сколько клеток продлить линию
+* @return 0
+*/
+int construction_extend(Construction* build, int b, int dir, int count)
+{
+    int x;
+    int y;
+
+    x = build->blacks[b].x + directions[dir].dx * build->line_len[b][dir];
+    y = build->blacks[b].y + directions[dir].dy * build->line_len[b][dir];
+
+    paint_line(&build->board, x, y, dir, count);
+
+    for (int k = 1; k <= count; k++)
+    {
+        build->owner[x + directions[dir].dx * k][y + directions[dir].dy * k] = (short)b;
+    }
+
+    build->line_len[b][dir] += count;
+
+    return 0;
+}
+
+/**
+* Проверяет, что клетка (x, y) — последняя клетка линии своей чёрной клетки
+* @param build состояние конструктивной генерации
+* @param x индекс строки клетки линии
+* @param y индекс столбца клетки линии
+* @param dir_out сюда записывается направление этой линии
+* @return номер чёрной клетки-владельца, либо -1 если клетка не конец линии
+*/
+int construction_line_end(Construction* build, int x, int y, int* dir_out)
+{
+    int b;
+    int dx;
+    int dy;
+    int dir;
+    int dist;
+
+    b = build->owner[x][y];
+    if (b < 0)
+    {
+        return -1;
+    }
+
+    dx = x - build->blacks[b].x;
+    dy = y - build->blacks[b].y;
+
+    if (dx != 0)
+    {
+        dir = dx < 0 ? 0 : 1;
+        dist = dx < 0 ? -dx : dx;
+    }
+    else
+    {
+        dir = dy < 0 ? 2 : 3;
+        dist = dy < 0 ? -dy : dy;
+    }
+
+    if (build->line_len[b][dir] != dist)
+    {
+        return -1;
+    }
+
+    *dir_out = dir;
+    return b;
+}
+
+/**
+* Генерирует поле конструктивно, без отбраковки по покрытию
+* 1) размещает target чёрных клеток (или сколько удастся за area * 4 проб),
+*    каждая сразу получает линию длиной 1 в случайном свободном направлении
+* 2) обходит клетки в случайном порядке; свободную клетку покрывает
+*    продолжением луча, который может до неё дотянуться (чёрная клетка
+*    со свободным путём или конец линии, направленной к клетке)
+* 3) если такого луча нет, соседняя свободная клетка становится новой
+*    чёрной клеткой с линией длиной 1; если свободных соседей нет,
+*    соседний конец чужой линии укорачивается и становится чёрной клеткой
+* Каждая белая клетка оказывается покрыта ровно одним лучом, а у каждой
+* чёрной клетки число не меньше 1, поэтому поле корректно по построению
+* @param rows количество строк
+* @param cols количество столбцов
+* @param target сколько чёрных клеток разместить на первом шаге
+* @param rng генератор случайных чисел
+* @return указатель на поле, либо NULL если попытка не удалась
+*/
+Field* generate_puzzle_constructive(int rows, int cols, int target, Rng* rng)
+{
+    Construction build;
+    int order[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+    int area;
+    int tries;
+
+    gen_stats.attempts++;
+    area = rows * cols;
+
+    bitboard_init(&build.board, rows, cols);
+    build.black_count = 0;
+
+    for (int x = 0; x < rows; x++)
+    {
+        for (int y = 0; y < cols; y++)
+        {
+            build.black_at[x][y] = -1;
+            build.owner[x][y] = -1;
+        }
+    }
+
+    tries = 0;
+
+    while (build.black_count < target && tries < area * 4)
+    {
+        int x;
+        int y;
+        int free_dirs[4];
+        int free_count;
+
+        tries++;
+        x = rng_range(rng, rows);
+        y = rng_range(rng, cols);
+
+        if (bitboard_is_set(&build.board, x, y))
+        {
+            continue;
+        }
+
+        free_count = 0;
+        for (int d = 0; d < 4; d++)
+        {
+            if (free_run(&build.board, x, y, d) > 0)
+            {
+                free_dirs[free_count++] = d;
+            }
+        }
+
+        if (free_count > 0)
+        {
+            int b = construction_add_black(&build, x, y);
+            construction_extend(&build, b, free_dirs[rng_range(rng, free_count)], 1);
+        }
+    }
+
+    for (int i = 0; i < area; i++)
+    {
+        int k = rng_range(rng, i + 1);
+        order[i] = order[k];
+        order[k] = i;
+    }
+
+    for (int i = 0; i < area; i++)
+    {
+        int x = order[i] / cols;
+        int y = order[i] % cols;
+        int option_black[4];
+        int option_dir[4];
+        int option_count[4];
+        int options;
+        int free_dirs[4];
+        int free_count;
+
+        if (bitboard_is_set(&build.board, x, y))
+        {
+            continue;
+        }
+
+        options = 0;
+        free_count = 0;
+
+        for (int e = 0; e < 4; e++)
+        {
+            int run = free_run(&build.board, x, y, e);
+            int bx = x + directions[e].dx * (run + 1);
+            int by = y + directions[e].dy * (run + 1);
+            int b;
+            int line_dir;
+
+            if (run > 0)
+            {
+                free_dirs[free_count++] = e;
+            }
+
+            if (bx < 0 || bx >= rows || by < 0 || by >= cols)
+            {
+                continue;
+            }
+
+            b = build.black_at[bx][by];
+            line_dir = e ^ 1;
+
+            if (b < 0)
+            {
+                b = construction_line_end(&build, bx, by, &line_dir);
+
+                if (b < 0 || line_dir != (e ^ 1))
+                {
+                    continue;
+                }
+            }
+
+            option_black[options] = b;
+            option_dir[options] = e ^ 1;
+            option_count[options] = run + 1;
+            options++;
+        }
+
+        if (options > 0)
+        {
+            int pick = rng_range(rng, options);
+            construction_extend(&build, option_black[pick], option_dir[pick], option_count[pick]);
+        }
+        else if (free_count > 0)
+        {
+            int e = free_dirs[rng_range(rng, free_count)];
+            int b = construction_add_black(&build, x + directions[e].dx, y + directions[e].dy);
+            construction_extend(&build, b, e ^ 1, 1);
+        }
+        else
+        {
+            int stolen = 0;
+
+            for (int e = 0; e < 4 && !stolen; e++)
+            {
+                int nx = x + directions[e].dx;
+                int ny = y + directions[e].dy;
+                int line_dir;
+                int b;
+
+                if (nx < 0 || nx >= rows || ny < 0 || ny >= cols)
+                {
+                    continue;
+                }
+
+                b = construction_line_end(&build, nx, ny, &line_dir);
+
+                if (b >= 0 && build.line_len[b][0] + build.line_len[b][1] + build.line_len[b][2] + build.line_len[b][3] >= 2)
+                {
+                    int n;
+
+                    build.line_len[b][line_dir]--;
+                    build.owner[nx][ny] = -1;
+                    n = construction_add_black(&build, nx, ny);
+                    construction_extend(&build, n, e ^ 1, 1);
+                    stolen = 1;
+                }
+            }
+
+            if (!stolen)
+            {
+                gen_stats.rejected_dead_end++;
+                return NULL;
+            }
+        }
+    }
+
+    return build_field(rows, cols, build.blacks, build.line_len, build.black_count);
+}
+
+/**
+* Выводит игровое поле в консоль в виде ASCII-таблицы
+* WHITE выводится как пустая клетка, числа выводятся в чёрных клетках
+* @param field игровое поле
+* @return 0
+*/
+int print_field(Field* field)
+{
+    printf("+");
+    for (int j = 0; j < field->cols; j++)
+    {
+        printf("-----+");
+    }
+    printf("\n");
+
+    for (int i = 0; i < field->rows; i++)
+    {
+        printf("|");
+        for (int j = 0; j < field->cols; j++)
+        {
+            if (FIELD_AT(field, i, j) == WHITE)
+            {
+                printf("     |");
+            }
+            else
+            {
+                printf(" %2d  |", FIELD_AT(field, i, j));
+            }
+        }
+        printf("\n");
+
+        printf("+");
+        for (int j = 0; j < field->cols; j++)
+        {
+            printf("-----+");
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+/**
+* Записывает поле в уже открытый поток
+* Формат: первая строка "rows cols", далее rows строк по cols чисел
+* Строка поля собирается в буфере и записывается одним вызовом fwrite
+* (вместо fprintf на каждую клетку)
+* @param file открытый для записи файл
+* @param field игровое поле
+* @return 0
+*/
+int write_field(FILE* file, Field* field)
+{
+    /* до 4 символов на значение клетки ("-128") и пробел */
+    char line[LARGE_MAX_SIZE * 5 + 1];
+
+    fprintf(file, "%d %d\n", field->rows, field->cols);
+
+    for (int i = 0; i < field->rows; i++)
+    {
+        fwrite(line, 1, (size_t)format_row(line, &FIELD_AT(field, i, 0), field->cols), file);
+    }
+
+    return 0;
+}
+
+/**
+* Записывает строку поля в буфер в формате write_field: числа через пробел
+* и '\n' в конце (не больше cols * 5 + 1 символов, без завершающего нуля)
+* @param line буфер строки
+* @param row первая клетка строки
+* @param cols количество клеток в строке
+* @return количество записанных символов
+*/
+int format_row(char* line, const Cell* row, int cols)
+{
+    int len = 0;
+
+    for (int j = 0; j < cols; j++)
+    {
+        int value = row[j];
+
+        if (value < 0)
+        {
+            line[len++] = '-';
+            value = -value;
+        }
+
+        if (value >= 100)
+        {
+            line[len++] = (char)('0' + value / 100);
+        }
+
+        if (value >= 10)
+        {
+            line[len++] = (char)('0' + value / 10 % 10);
+        }
+
+        line[len++] = (char)('0' + value % 10);
+        line[len++] = ' ';
+    }
+
+    line[len++] = '\n';
+
+    return len;
+}
+
+/**
+* Сохраняет поле в текстовый файл
+* Формат: первая строка "rows cols", далее rows строк по cols чисел
+* @param field игровое поле
+* @param filename имя файла
+* @return 0 при успешном сохранении, -4 если файл открыть не удалось
+*/
+int save_to_file(Field* field, char* filename)
+{
+    FILE* file;
+
+    file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        printf("Ошибка открытия файла!\n");
+        return -4;
+    }
+
+    write_field(file, field);
+
+    fclose(file);
+
+    printf("Поле сохранено в %s\n", filename);
+    return 0;
+}
+
+/**
+* Отображает файл в память только для чтения (mmap, в Windows — MapViewOfFile)
+* Пустой файл отображается как data == NULL, size == 0
+* @param map состояние отображения
+* @param filename имя файла
+* @return 0 при успехе, -4 если файл открыть или отобразить не удалось
+*/
+int file_map(MappedFile* map, char* filename)
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    void* view;
+
+    map->data = NULL;
+    map->size = 0;
+    map->mapping = NULL;
+    map->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (map->file == INVALID_HANDLE_VALUE)
+    {
+        return -4;
+    }
+
+    if (!GetFileSizeEx(map->file, &size))
+    {
+        file_unmap(map);
+        return -4;
+    }
+
+    if (size.QuadPart == 0)
+    {
+        return 0;
+    }
+
+    map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    view = map->mapping != NULL ? MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (view == NULL)
+    {
+        file_unmap(map);
+        return -4;
+    }
+
+    map->data = (const char*)view;
+    map->size = (size_t)size.QuadPart;
+#else
+    struct stat info;
+    void* view;
+    int fd;
+
+    map->data = NULL;
+    map->size = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -4;
+    }
+
+    if (fstat(fd, &info) != 0 || S_ISDIR(info.st_mode))
+    {
+        close(fd);
+        return -4;
+    }
+
+    if (info.st_size > 0)
+    {
+        view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED)
+        {
+            close(fd);
+            return -4;
+        }
+
+        map->data = (const char*)view;
+        map->size = (size_t)info.st_size;
+    }
+
+    /* отображение остаётся действительным и после закрытия файла */
+    close(fd);
+#endif
+
+    return 0;
+}
+
+/**
+* Снимает отображение файла
+* @param map состояние отображения
+* @return 0
+*/
+int file_unmap(MappedFile* map)
+{
+#ifdef _WIN32
+    if (map->data != NULL)
+    {
+        UnmapViewOfFile(map->data);
+    }
+
+    if (map->mapping != NULL)
+    {
+        CloseHandle(map->mapping);
+    }
+
+    if (map->file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(map->file);
+    }
+
+    map->mapping = NULL;
+    map->file = INVALID_HANDLE_VALUE;
+#else
+    if (map->data != NULL)
+    {
+        munmap((void*)map->data, map->size);
+    }
+#endif
+
+    map->data = NULL;
+    map->size = 0;
+
+    return 0;
+}
+
+/**
+* Сбрасывает буфер потока и данные файла на диск (fsync, в Windows — _commit),
+* чтобы записанное пережило сбой или перезагрузку
+* @param file открытый для записи файл
+* @return 0 при успехе, -4 при ошибке записи
+*/
+int file_sync(FILE* file)
+{
+    if (fflush(file) != 0)
+    {
+        return -4;
+    }
+
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0 ? 0 : -4;
+#else
+    return fsync(fileno(file)) == 0 ? 0 : -4;
+#endif
+}
+
+/**
+* Возвращает текущую позицию в файле (64-битную и в Windows, где ftell — 32-битный)
+* @param file открытый файл
+* @return позиция в байтах, -1 при ошибке
+*/
+long long file_tell(FILE* file)
+{
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return (long long)ftello(file);
+#endif
+}
+
+/**
+* Обрезает файл до size байт
+* @param filename имя файла
+* @param size новая длина файла
+* @return 0 при успехе, -4 если файл открыть или обрезать не удалось, -1 если файл короче size
+*/
+int file_truncate(char* filename, long long size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER length;
+    HANDLE file;
+    int result;
+
+    file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return -4;
+    }
+
+    result = -1;
+
+    if (GetFileSizeEx(file, &length) && length.QuadPart >= size)
+    {
+        length.QuadPart = size;
+        result = SetFilePointerEx(file, length, NULL, FILE_BEGIN) && SetEndOfFile(file) ? 0 : -4;
+    }
+
+    CloseHandle(file);
+
+    return result;
+#else
+    struct stat info;
+
+    if (stat(filename, &info) != 0)
+    {
+        return -4;
+    }
+
+    if ((long long)info.st_size < size)
+    {
+        return -1;
+    }
+
+    return truncate(filename, (off_t)size) == 0 ? 0 : -4;
+#endif
+}
+
+/**
+* Заменяет файл target файлом source одним переименованием: при сбое
+* на диске остаётся либо старый, либо новый файл целиком
+* @param source новый файл
+* @param target заменяемый файл
+* @return 0 при успехе, -4 при ошибке
+*/
+int file_replace(char* source, char* target)
+{
+#ifdef _WIN32
+    return MoveFileExA(source, target, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -4;
+#else
+    return rename(source, target) == 0 ? 0 : -4;
+#endif
+}
+
+/**
+* Пропускает пробелы, переводы строк и строки-комментарии, начинающиеся с '#'
+* @param p текущая позиция в тексте
+* @param end конец текста
+* @return позиция первого значащего символа, либо end
+*/
+const char* scan_space(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '#'))
+    {
+        if (*p == '#')
+        {
+            while (p < end && *p != '\n')
+            {
+                p++;
+            }
+        }
+        else
+        {
+            p++;
+        }
+    }
+
+    return p;
+}
+
+/**
+* Читает неотрицательное целое число из текста в памяти, пропуская пробелы
+* и переводы строк перед ним (без копирования и без fscanf)
+* @param cursor текущая позиция, сдвигается за прочитанное число
+* @param end конец текста
+* @param value сюда записывается число
+* @return 0 при успехе, -1 если в позиции нет числа или оно больше 1000000
+*/
+int scan_number(const char** cursor, const char* end, int* value)
+{
+    const char* p;
+    int result;
+
+    p = *cursor;
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    {
+        p++;
+    }
+
+    if (p == end || *p < '0' || *p > '9')
+    {
+        return -1;
+    }
+
+    result = 0;
+
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        result = result * 10 + (*p - '0');
+        p++;
+
+        if (result > 1000000)
+        {
+            return -1;
+        }
+    }
+
+    *cursor = p;
+    *value = result;
+
+    return 0;
+}
+
+/**
+* Разбирает очередное поле в формате write_field из текста в памяти
+* (например, из file_map). Пустые строки и строки, начинающиеся с '#',
+* перед полем пропускаются. Если field == NULL, поле только проверяется
+* и пропускается (так находятся начала полей)
+* @param cursor текущая позиция, сдвигается за прочитанное поле
+* @param end конец текста
+* @param field сюда записывается поле (create_scratch_field), либо NULL
+* @return 1 если поле прочитано, 0 если текст закончился, -1 при ошибке формата
+* или выделения памяти
+*/
+int parse_field(const char** cursor, const char* end, Field** field)
+{
+    const char* p;
+    int rows;
+    int cols;
+
+    p = scan_space(*cursor, end);
+    *cursor = p;
+
+    if (p == end)
+    {
+        return 0;
+    }
+
+    if (scan_number(&p, end, &rows) != 0 || scan_number(&p, end, &cols) != 0
+        || rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE || rows > LARGE_MAX_SIZE || cols > LARGE_MAX_SIZE)
+    {
+        return -1;
+    }
+
+    if (field != NULL)
+    {
+        *field = create_scratch_field(rows, cols);
+        if (*field == NULL)
+        {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            int value;
+
+            if (scan_number(&p, end, &value) != 0 || value > 127)
+            {
+                if (field != NULL)
+                {
+                    free_field(*field);
+                    *field = NULL;
+                }
+
+                return -1;
+            }
+
+            if (field != NULL)
+            {
+                FIELD_AT(*field, i, j) = (Cell)value;
+            }
+        }
+    }
+
+    *cursor = p;
+
+    return 1;
+}
+
+/**
+* Возвращает наибольшее возможное число в клетке поля rows x cols:
+* сумма длин линий чёрной клетки не больше rows + cols - 2, а в полях
+* из плиток (generate_tiled) линии не выходят за плитку со стороной TILE_SIZE
+* @param rows количество строк
+* @param cols количество столбцов
+* @return наибольшее число в клетке
+*/
+int library_max_clue(int rows, int cols)
+{
+    if (rows > MAX_FIELD_SIZE || cols > MAX_FIELD_SIZE)
+    {
+        return 2 * (TILE_SIZE - 1);
+    }
+
+    return rows + cols - 2;
+}
+
+/**
+* Заполняет заголовок пустой библиотеки полей rows x cols: ширина клетки —
+* 4 бита, если max_clue не больше 15, иначе 8 бит
+* @param header заголовок
+* @param rows количество строк
+* @param cols количество столбцов
+* @param max_clue наибольшее число в клетке
+* @return 0
+*/
+int library_init_header(LibraryHeader* header, int rows, int cols, int max_clue)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, LIBRARY_MAGIC, 4);
+    header->version = LIBRARY_VERSION;
+    header->rows = (unsigned int)rows;
+    header->cols = (unsigned int)cols;
+    header->cell_bits = max_clue <= 15 ? 4 : 8;
+    header->record_size = (unsigned int)(((size_t)rows * (size_t)cols * header->cell_bits + 7) / 8);
+    header->count = 0;
+
+    return 0;
+}
+
+/**
+* Создаёт двоичную библиотеку полей rows x cols и записывает заголовок
+* Ширина клетки — 4 бита, если max_clue не больше 15, иначе 8 бит.
+* Записи дописываются через буфер BATCH_OUTPUT_BUFFER (library_append),
+* число записей попадает в заголовок при library_finish
+* @param writer состояние записи
+* @param filename имя файла
+* @param rows количество строк
+* @param cols количество столбцов
+* @param max_clue наибольшее число в клетке
+* @return 0 при успехе, -4 если файл открыть не удалось, -6 при ошибке выделения памяти
+*/
+int library_create(LibraryWriter* writer, char* filename, int rows, int cols, int max_clue)
+{
+    LibraryHeader* header;
+
+    header = &writer->header;
+    library_init_header(header, rows, cols, max_clue);
+
+    writer->record = (unsigned char*)malloc(header->record_size);
+    if (writer->record == NULL)
+    {
+        return -6;
+    }
+
+    writer->file = fopen(filename, "wb");
+    if (writer->file == NULL)
+    {
+        free(writer->record);
+        return -4;
+    }
+
+    setvbuf(writer->file, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+    fwrite(header, sizeof(*header), 1, writer->file);
+
+    return 0;
+}
+
+/**
+* Упаковывает поле в запись и дописывает её в библиотеку
+* При 4 битах на клетку клетка с чётным номером лежит в младшей половине байта
+* @param writer состояние записи
+* @param field поле того же размера, что и библиотека
+* @return 0 при успехе, -1 если размер поля другой или число не помещается в клетку,
+* -4 при ошибке записи в файл (число записей в заголовке при ошибке не меняется)
+*/
+int library_append(LibraryWriter* writer, Field* field)
+{
+    LibraryHeader* header;
+    int limit;
+    int k;
+
+    header = &writer->header;
+
+    if ((unsigned int)field->rows != header->rows || (unsigned int)field->cols != header->cols)
+    {
+        return -1;
+    }
+
+    limit = (1 << header->cell_bits) - 1;
+    memset(writer->record, 0, header->record_size);
+    k = 0;
+
+    for (int i = 0; i < field->rows; i++)
+    {
+        for (int j = 0; j < field->cols; j++)
+        {
+            int value = FIELD_AT(field, i, j);
+
+            if (value < WHITE || value > limit)
+            {
+                return -1;
+            }
+
+            if (header->cell_bits == 4)
+            {
+                writer->record[k >> 1] |= (unsigned char)(value << ((k & 1) * 4));
+            }
+            else
+            {
+                writer->record[k] = (unsigned char)value;
+            }
+
+            k++;
+        }
+    }
+
+    if (fwrite(writer->record, header->record_size, 1, writer->file) != 1)
+    {
+        return -4;
+    }
+
+    header->count++;
+
+    return 0;
+}
+
+/**
+* Записывает в заголовок число записей и закрывает библиотеку
+* @param writer состояние записи
+* @return 0 при успехе, -4 при ошибке записи в файл
+*/
+int library_finish(LibraryWriter* writer)
+{
+    int result;
+
+    result = 0;
+
+    if (fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1)
+    {
+        result = -4;
+    }
+
+    if (fclose(writer->file) != 0)
+    {
+        result = -4;
+    }
+
+    free(writer->record);
+    writer->file = NULL;
+    writer->record = NULL;
+
+    return result;
+}
+
+/**
+* Открывает для дописывания библиотеку, которую записывал library_create:
+* файл обрезается до заголовка и первых count записей (записи после них могли
+* остаться неполными при сбое), заголовок сверяется с размерами поля
+* @param writer состояние записи
+* @param filename имя файла
+* @param rows количество строк
+* @param cols количество столбцов
+* @param max_clue наибольшее число в клетке
+* @param count число записей, которые остаются в библиотеке
+* @return 0 при успехе, -4 если файл открыть не удалось, -1 если это другая
+* библиотека или в файле меньше count записей, -6 при ошибке выделения памяти
+*/
+int library_resume(LibraryWriter* writer, char* filename, int rows, int cols, int max_clue, unsigned long long count)
+{
+    LibraryHeader expected;
+    int result;
+
+    library_init_header(&expected, rows, cols, max_clue);
+    result = file_truncate(filename, (long long)(sizeof(expected) + count * expected.record_size));
+    if (result != 0)
+    {
+        return result;
+    }
+
+    writer->record = (unsigned char*)malloc(expected.record_size);
+    if (writer->record == NULL)
+    {
+        return -6;
+    }
+
+    writer->file = fopen(filename, "r+b");
+    if (writer->file == NULL)
+    {
+        free(writer->record);
+        return -4;
+    }
+
+    if (fread(&writer->header, sizeof(writer->header), 1, writer->file) != 1
+        || memcmp(writer->header.magic, expected.magic, 4) != 0 || writer->header.version != expected.version
+        || writer->header.rows != expected.rows || writer->header.cols != expected.cols
+        || writer->header.cell_bits != expected.cell_bits || writer->header.record_size != expected.record_size)
+    {
+        fclose(writer->file);
+        free(writer->record);
+        return -1;
+    }
+
+    /* между чтением и записью в потоке нужен fseek */
+    writer->header.count = count;
+    fseek(writer->file, 0, SEEK_END);
+    setvbuf(writer->file, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+
+    return 0;
+}
+
+/**
+* Записывает в заголовок текущее число записей и сбрасывает библиотеку на диск
+* (file_sync), не закрывая её: после сбоя файл остаётся целой библиотекой
+* @param writer состояние записи
+* @return 0 при успехе, -4 при ошибке записи в файл
+*/
+int library_sync(LibraryWriter* writer)
+{
+    if (fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1
+        || fseek(writer->file, 0, SEEK_END) != 0)
+    {
+        return -4;
+    }
+
+    return file_sync(writer->file);
+}
+
+/**
+* Открывает двоичную библиотеку только для чтения, отображая файл в память
+* (file_map), и проверяет заголовок
+* @param reader состояние чтения
+* @param filename имя файла
+* @return 0 при успехе, -4 если файл открыть не удалось, -1 если это не библиотека
+* полей или файл обрезан
+*/
+int library_open(LibraryReader* reader, char* filename)
+{
+    LibraryHeader* header;
+    unsigned long long expected;
+
+    if (file_map(&reader->map, filename) != 0)
+    {
+        return -4;
+    }
+
+    if (reader->map.size < sizeof(LibraryHeader))
+    {
+        file_unmap(&reader->map);
+        return -1;
+    }
+
+    memcpy(&reader->header, reader->map.data, sizeof(LibraryHeader));
+    reader->records = (const unsigned char*)reader->map.data + sizeof(LibraryHeader);
+    header = &reader->header;
+    expected = ((unsigned long long)header->rows * header->cols * header->cell_bits + 7) / 8;
+
+    if (memcmp(header->magic, LIBRARY_MAGIC, 4) != 0 || header->version != LIBRARY_VERSION
+        || header->rows < MIN_FIELD_SIZE || header->cols < MIN_FIELD_SIZE
+        || header->rows > LARGE_MAX_SIZE || header->cols > LARGE_MAX_SIZE
+        || (header->cell_bits != 4 && header->cell_bits != 8) || header->record_size != expected
+        || header->count > (reader->map.size - sizeof(LibraryHeader)) / header->record_size)
+    {
+        file_unmap(&reader->map);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* Распаковывает запись с номером index в поле (без чтения остальных записей)
+* @param reader открытая библиотека
+* @param index номер записи (с 0)
+* @param field поле размера библиотеки (create_field)
+* @return 0 при успехе, -1 если номера нет в библиотеке или размер поля другой
+*/
+int library_get(LibraryReader* reader, long long index, Field* field)
+{
+    const unsigned char* record;
+    LibraryHeader* header;
+    int k;
+
+    header = &reader->header;
+
+    if (index < 0 || (unsigned long long)index >= header->count
+        || (unsigned int)field->rows != header->rows || (unsigned int)field->cols != header->cols)
+    {
+        return -1;
+    }
+
+    record = reader->records + (size_t)index * header->record_size;
+    k = 0;
+
+    for (int i = 0; i < field->rows; i++)
+    {
+        for (int j = 0; j < field->cols; j++)
+        {
+            if (header->cell_bits == 4)
+            {
+                FIELD_AT(field, i, j) = (Cell)((record[k >> 1] >> ((k & 1) * 4)) & 0x0F);
+            }
+            else
+            {
+                FIELD_AT(field, i, j) = (Cell)record[k];
+            }
+
+            k++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+* Снимает отображение библиотеки
+* @param reader состояние чтения
+* @return 0
+*/
+int library_close(LibraryReader* reader)
+{
+    file_unmap(&reader->map);
+    reader->records = NULL;
+
+    return 0;
+}
+
+/**
+* Проверяет, что поле имеет ровно одно решение
+* Числа чёрных клеток распределяются по четырём направлениям точным решателем
+* (count_solutions), который останавливается, найдя второе решение.
+* Результат учитывается в статистике генерации gen_stats
+* @param puzzle игровое поле
+* @return 1 если решение существует и единственно, 0 если решений нет или их несколько
+*/
+int is_solvable(Field* puzzle)
+{
+    int solutions;
+
+    solutions = count_solutions(puzzle, SOLUTION_LIMIT);
+
+    if (solutions == 0)
+    {
+        gen_stats.rejected_unsolvable++;
+    }
+    else if (solutions > 1)
+    {
+        gen_stats.rejected_ambiguous++;
+    }
+    else if (solutions == 1)
+    {
+        gen_stats.accepted++;
+    }
+
+    return solutions == 1;
+}
+
+/**
+* Подсчитывает решения поля, но не более limit
+* Для каждой белой клетки заранее находятся ближайшие чёрные клетки в четырёх
+* направлениях — только они могут провести к ней луч (solver_build). Далее
+* выполняется перебор с распространением ограничений (solver_propagate, solver_search).
+* Если потоку разрешено занять несколько потоков (split_threads) и перебор
+* не уложился в SPLIT_THRESHOLD ветвлений, он прерывается и повторяется
+* параллельно (count_solutions_split).
+* Память решателя берётся из рабочей области потока и возвращается в неё
+* @param puzzle игровое поле (WHITE и числа в чёрных клетках)
+* @param limit после скольких найденных решений прекратить перебор
+* @return количество найденных решений (от 0 до limit), -1 при ошибке выделения памяти
+*/
+int count_solutions(Field* puzzle, int limit)
+{
+    Solver solver;
+    size_t mark = scratch.used;
+
+    if (solver_build(&solver, puzzle) != 0)
+    {
+        arena_release(&scratch, mark);
+        return -1;
+    }
+
+    solver.limit = limit;
+
+    if (split_threads > 1)
+    {
+        solver.branch_limit = SPLIT_THRESHOLD;
+    }
+
+    solver_search(&solver);
+    solver_free(&solver);
+    arena_release(&scratch, mark);
+
+    if (solver.stop)
+    {
+        return count_solutions_split(puzzle, limit, split_threads);
+    }
+
+    return solver.solutions;
+}
+
+/**
+* Оценивает сложность поля для человека: ограничения распространяются только
+* логическими правилами решателя (solver_propagate) — насыщение суммы числа
+* чёрной клетки, закрытие луча перед уже покрытой клеткой и вынужденное
+* продление единственного возможного луча. Сложность растёт с числом
+* проходов до неподвижной точки; если логики не хватает, поле дорешивается
+* перебором, и каждое ветвление добавляет RATING_GUESS_WEIGHT очков.
+* Память решателя берётся из рабочей области потока и возвращается в неё
+* @param puzzle игровое поле с единственным решением
+* @param rating результат оценки
+* @return 0 при успехе, -1 при ошибке выделения памяти
+*/
+int rate_field(Field* puzzle, Rating* rating)
+{
+    Solver solver;
+    size_t mark = scratch.used;
+    int is_fixed;
+
+    memset(rating, 0, sizeof(*rating));
+
+    if (solver_build(&solver, puzzle) != 0)
+    {
+        arena_release(&scratch, mark);
+        return -1;
+    }
+
+    solver.rating = rating;
+    is_fixed = solver_propagate(&solver);
+    solver.rating = NULL;
+
+    for (int var = 0; is_fixed && var < solver.black_count * 4; var++)
+    {
+        is_fixed = solver.bounds[var * 2] == solver.bounds[var * 2 + 1];
+    }
+
+    if (!is_fixed)
+    {
+        solver.limit = 1;
+        solver_search(&solver);
+        rating->guesses = solver.branches;
+    }
+
+    solver_free(&solver);
+    arena_release(&scratch, mark);
+
+    rating->score = RATING_ROUND_WEIGHT * rating->rounds + RATING_GUESS_WEIGHT * rating->guesses;
+
+    if (rating->guesses > 0)
+    {
+        rating->tier = RATING_GUESS;
+    }
+    else if (rating->rounds > RATING_HARD_ROUNDS)
+    {
+        rating->tier = RATING_HARD;
+    }
+    else if (rating->rounds > RATING_MEDIUM_ROUNDS)
+    {
+        rating->tier = RATING_MEDIUM;
+    }
+    else
+    {
+        rating->tier = RATING_EASY;
+    }
+
+    return 0;
+}
+
+/**
+* Возвращает название уровня сложности поля
+* @param tier уровень (от RATING_EASY до RATING_GUESS)
+* @return название уровня
+*/
+const char* rating_name(int tier)
+{
+    if (tier == RATING_EASY)
+    {
+        return "лёгкое";
+    }
+
+    if (tier == RATING_MEDIUM)
+    {
+        return "среднее";
+    }
+
+    if (tier == RATING_HARD)
+    {
+        return "сложное";
+    }
+
+    return "с перебором";
+}
+
+/**
+* Строит переменные и ограничения решателя для поля: для каждой чёрной
+* клетки — границы длины луча по четырём направлениям, для каждой белой
+* клетки — лучи, которые могут до неё дотянуться, и расстояния до них
+* @param solver состояние решателя (заполняется)
+* @param puzzle игровое поле
+* @return 0 при успехе, -1 при ошибке выделения памяти
+*/
+int solver_build(Solver* solver, Field* puzzle)
+{
+    Direction directions_local[4] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+    int* black_at;
+    int total;
+    int steps[4];
+    int range;
+    int w;
+
+    total = (puzzle->rows + 2) * puzzle->stride;
+    black_at = (int*)arena_alloc(&scratch, (size_t)total * sizeof(int));
+    if (black_at == NULL)
+    {
+        return -1;
+    }
+
+    for (int d = 0; d < 4; d++)
+    {
+        steps[d] = directions_local[d].dx * puzzle->stride + directions_local[d].dy;
+    }
+
+    solver->black_count = 0;
+    solver->white_count = 0;
+
+    for (int i = 0; i < total; i++)
+    {
+        black_at[i] = -1;
+
+        if (puzzle->cells[i] > 0)
+        {
+            black_at[i] = solver->black_count++;
+        }
+        else if (puzzle->cells[i] == WHITE)
+        {
+            solver->white_count++;
+        }
+    }
+
+    solver->numbers = (int*)arena_alloc(&scratch, (size_t)(solver->black_count + 1) * sizeof(int));
+    solver->cand_var = (int*)arena_alloc(&scratch, (size_t)(solver->white_count + 1) * 4 * sizeof(int));
+    solver->cand_dist = (int*)arena_alloc(&scratch, (size_t)(solver->white_count + 1) * 4 * sizeof(int));
+    solver->bounds = (short*)arena_alloc(&scratch, (size_t)(solver->black_count + 1) * 8 * sizeof(short));
+    solver->trail_pos = NULL;
+    solver->trail_old = NULL;
+
+    if (solver->numbers == NULL || solver->cand_var == NULL || solver->cand_dist == NULL || solver->bounds == NULL)
+    {
+        solver_free(solver);
+        arena_free(&scratch, black_at);
+        return -1;
+    }
+
+    range = 0;
+    w = 0;
+
+    for (int i = 0; i < total; i++)
+    {
+        if (puzzle->cells[i] > 0)
+        {
+            int b = black_at[i];
+
+            solver->numbers[b] = puzzle->cells[i];
+
+            for (int d = 0; d < 4; d++)
+            {
+                int ray_len = 0;
+                int index = i + steps[d];
+
+                while (puzzle->cells[index] == WHITE)
+                {
+                    ray_len++;
+                    index += steps[d];
+                }
+
+                if (ray_len > solver->numbers[b])
+                {
+                    ray_len = solver->numbers[b];
+                }
+
+                solver->bounds[(b * 4 + d) * 2] = 0;
+                solver->bounds[(b * 4 + d) * 2 + 1] = (short)ray_len;
+                range += ray_len;
+            }
+        }
+        else if (puzzle->cells[i] == WHITE)
+        {
+            for (int e = 0; e < 4; e++)
+            {
+                int dist = 1;
+                int index = i + steps[e];
+
+                while (puzzle->cells[index] == WHITE)
+                {
+                    dist++;
+                    index += steps[e];
+                }
+
+                solver->cand_var[w * 4 + e] = -1;
+                solver->cand_dist[w * 4 + e] = dist;
+
+                if (puzzle->cells[index] > 0)
+                {
+                    /* луч чёрной клетки идёт к белой в противоположном направлении */
+                    solver->cand_var[w * 4 + e] = black_at[index] * 4 + (e ^ 1);
+                }
+            }
+
+            w++;
+        }
+    }
+
+    arena_free(&scratch, black_at);
+
+    solver->trail_pos = (int*)arena_alloc(&scratch, (size_t)(range + 2) * sizeof(int));
+    solver->trail_old = (short*)arena_alloc(&scratch, (size_t)(range + 2) * sizeof(short));
+
+    if (solver->trail_pos == NULL || solver->trail_old == NULL)
+    {
+        solver_free(solver);
+        return -1;
+    }
+
+    solver->trail_len = 0;
+    solver->solutions = 0;
+    solver->limit = 1;
+    solver->solution = NULL;
+    solver->rating = NULL;
+    solver->branches = 0;
+    solver->branch_limit = LLONG_MAX;
+    solver->stop = 0;
+    solver->pool = NULL;
+    solver->worker = 0;
+    solver->path_pos = NULL;
+    solver->path_value = NULL;
+    solver->path_len = 0;
+    solver->is_hungry = 0;
+
+    return 0;
+}
+
+/**
+* Освобождает память решателя (память из рабочей области потока
+* освобождается вместе с ней)
+* @param solver состояние решателя
+* @return 0
+*/
+int solver_free(Solver* solver)
+{
+    arena_free(&scratch, solver->trail_pos);
+    arena_free(&scratch, solver->trail_old);
+    arena_free(&scratch, solver->numbers);
+    arena_free(&scratch, solver->cand_var);
+    arena_free(&scratch, solver->cand_dist);
+    arena_free(&scratch, solver->bounds);
+
+    return 0;
+}
+
+/**
+* Сужает границу переменной решателя с записью старого значения в trail
+* @param solver состояние решателя
+* @param pos индекс границы в solver->bounds
+* @param value новое значение границы
+* @return 0
+*/
+int solver_set_bound(Solver* solver, int pos, int value)
+{
+    solver->trail_pos[solver->trail_len] = pos;
+    solver->trail_old[solver->trail_len] = solver->bounds[pos];
+    solver->trail_len++;
+    solver->bounds[pos] = (short)value;
+
+    return 0;
+}
+
+/**
+* Откатывает изменения границ до отметки mark
+* @param solver состояние решателя
+* @param mark длина trail, до которой выполняется откат
+* @return 0
+*/
+int solver_undo(Solver* solver, int mark)
+{
+    while (solver->trail_len > mark)
+    {
+        solver->trail_len--;
+        solver->bounds[solver->trail_pos[solver->trail_len]] = solver->trail_old[solver->trail_len];
+    }
+
+    return 0;
+}
+
+/**
+* Распространяет ограничения до неподвижной точки
+* 1) сумма длин четырёх лучей чёрной клетки равна её числу
+* 2) каждая белая клетка покрыта ровно одним лучом: если луч уже гарантированно
+*    доходит до клетки, остальные кандидаты обрезаются перед ней; если кандидат
+*    остался один, его луч обязан дотянуться до клетки
+* Срабатывания правил (насыщение суммы, закрытие луча, вынужденное продление)
+* и число проходов с изменениями добавляются в solver->rating, если он задан
+* @param solver состояние решателя
+* @return 1 если противоречий не найдено, 0 если ограничения несовместны
+*/
+int solver_propagate(Solver* solver)
+{
+    int changed = 1;
+    int rounds = 0;
+    int sum_steps = 0;
+    int block_steps = 0;
+    int force_steps = 0;
+
+    while (changed)
+    {
+        changed = 0;
+
+        for (int b = 0; b < solver->black_count; b++)
+        {
+            short* bound = &solver->bounds[b * 8];
+            int number = solver->numbers[b];
+
+            for (int d = 0; d < 4; d++)
+            {
+                int sum_lo = bound[0] + bound[2] + bound[4] + bound[6];
+                int sum_hi = bound[1] + bound[3] + bound[5] + bound[7];
+                int max_len = number - (sum_lo - bound[d * 2]);
+                int min_len = number - (sum_hi - bound[d * 2 + 1]);
+
+                if (bound[d * 2 + 1] > max_len)
+                {
+                    solver_set_bound(solver, b * 8 + d * 2 + 1, max_len);
+                    changed = 1;
+                    sum_steps++;
+                }
+
+                if (bound[d * 2] < min_len)
+                {
+                    solver_set_bound(solver, b * 8 + d * 2, min_len);
+                    changed = 1;
+                    sum_steps++;
+                }
+
+                if (bound[d * 2] > bound[d * 2 + 1])
+                {
+                    return 0;
+                }
+            }
+        }
+
+        for (int w = 0; w < solver->white_count; w++)
+        {
+            int* vars = &solver->cand_var[w * 4];
+            int* dists = &solver->cand_dist[w * 4];
+            int owners = 0;
+            int owner = -1;
+            int possible = 0;
+            int last = -1;
+
+            for (int k = 0; k < 4; k++)
+            {
+                if (vars[k] < 0)
+                {
+                    continue;
+                }
+
+                if (solver->bounds[vars[k] * 2] >= dists[k])
+                {
+                    owners++;
+                    owner = k;
+                }
+
+                if (solver->bounds[vars[k] * 2 + 1] >= dists[k])
+                {
+                    possible++;
+                    last = k;
+                }
+            }
+
+            if (owners > 1 || possible == 0)
+            {
+                return 0;
+            }
+
+            if (owners == 1)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    if (k != owner && vars[k] >= 0 && solver->bounds[vars[k] * 2 + 1] >= dists[k])
+                    {
+                        if (solver->bounds[vars[k] * 2] > dists[k] - 1)
+                        {
+                            return 0;
+                        }
+
+                        solver_set_bound(solver, vars[k] * 2 + 1, dists[k] - 1);
+                        changed = 1;
+                        block_steps++;
+                    }
+                }
+            }
+            else if (possible == 1)
+            {
+                solver_set_bound(solver, vars[last] * 2, dists[last]);
+                changed = 1;
+                force_steps++;
+            }
+        }
+
+        rounds += changed;
+    }
+
+    if (solver->rating != NULL)
+    {
+        solver->rating->rounds += rounds;
+        solver->rating->sum_steps += sum_steps;
+        solver->rating->block_steps += block_steps;
+        solver->rating->force_steps += force_steps;
+    }
+
+    return 1;
+}
+
+/**
+* Рекурсивный перебор с распространением ограничений
+* Выбирает луч с наименьшим разбросом длины и делит перебор на две ветви:
+* луч останавливается на минимальной длине, либо становится длиннее.
+* Перебор прекращается, когда найдено solver->limit решений или поставлен
+* solver->stop. При параллельном подсчёте вторая ветвь отдаётся ждущему
+* работы потоку (split_give), а найденные решения учитываются в общем
+* состоянии (split_found)
+* @param solver состояние решателя
+* @return количество найденных к этому моменту решений
+*/
+int solver_search(Solver* solver)
+{
+    int mark;
+    int propagated;
+    int best;
+    int best_range;
+    int is_given;
+
+    mark = solver->trail_len;
+
+    if (!solver_propagate(solver))
+    {
+        solver_undo(solver, mark);
+        return solver->solutions;
+    }
+
+    best = -1;
+    best_range = 0;
+
+    for (int var = 0; var < solver->black_count * 4; var++)
+    {
+        int var_range = solver->bounds[var * 2 + 1] - solver->bounds[var * 2];
+
+        if (var_range > 0 && (best < 0 || var_range < best_range))
+        {
+            best = var;
+            best_range = var_range;
+        }
+    }
+
+    if (best < 0)
+    {
+        if (solver->solution != NULL && solver->solutions == 0)
+        {
+            for (int var = 0; var < solver->black_count * 4; var++)
+            {
+                solver->solution[var] = (unsigned char)solver->bounds[var * 2];
+            }
+        }
+
+        solver->solutions++;
+
+        if (solver->pool != NULL)
+        {
+            split_found(solver);
+        }
+
+        solver_undo(solver, mark);
+        return solver->solutions;
+    }
+
+    solver->branches++;
+
+    if (solver->pool != NULL && solver->branches % SPLIT_POLL == 0)
+    {
+        split_poll(solver);
+    }
+
+    if (solver->branches > solver->branch_limit)
+    {
+        solver->stop = 1;
+    }
+
+    if (solver->stop)
+    {
+        solver_undo(solver, mark);
+        return solver->solutions;
+    }
+
+    propagated = solver->trail_len;
+    is_given = solver->is_hungry && split_give(solver, best * 2, solver->bounds[best * 2] + 1);
+
+    solver_decide(solver, best * 2 + 1, solver->bounds[best * 2]);
+    solver_search(solver);
+    solver->path_len--;
+    solver_undo(solver, propagated);
+
+    if (!is_given && solver->solutions < solver->limit && !solver->stop)
+    {
+        solver_decide(solver, best * 2, solver->bounds[best * 2] + 1);
+        solver_search(solver);
+        solver->path_len--;
+    }
+
+    solver_undo(solver, mark);
+
+    return solver->solutions;
+}
+
+/**
+* Принимает решение перебора: сужает границу (solver_set_bound) и дописывает
+* его в путь от корня, если путь ведётся (параллельный подсчёт)
+* @param solver состояние решателя
+* @param pos индекс границы в solver->bounds
+* @param value новое значение границы
+* @return 0
+*/
+int solver_decide(Solver* solver, int pos, int value)
+{
+    if (solver->path_pos != NULL)
+    {
+        solver->path_pos[solver->path_len] = pos;
+        solver->path_value[solver->path_len] = (short)value;
+    }
+
+    solver->path_len++;
+
+    return solver_set_bound(solver, pos, value);
+}
+
+/**
+* Подсчитывает решения поля несколькими потоками
+* Каждый поток строит свой решатель и перебирает поддеревья из своей очереди.
+* Когда есть поток, ждущий работы, перебирающий поток отдаёт ему вторую ветвь
+* очередного ветвления (split_give), а ждущий поток забирает самое раннее
+* отложенное поддерево любой очереди (split_take). Найдя limit решений на всех,
+* потоки прекращают перебор. Текущий поток работает наравне с threads - 1
+* дополнительными (split_worker). Память пула, очередей и поддеревьев
+* выделяется через counted_malloc, а выделения дополнительных потоков
+* и сами потоки (по одному выделению стека на поток) добавляются
+* к alloc_count вызвавшего потока
+* @param puzzle игровое поле
+* @param limit после скольких найденных решений прекратить перебор
+* @param threads число потоков
+* @return количество найденных решений (от 0 до limit), -1 при ошибке выделения памяти
+*/
+int count_solutions_split(Field* puzzle, int limit, int threads)
+{
+    SplitPool pool;
+    SplitWorker* workers;
+    thread_handle* handles;
+    SplitTask* root;
+    int started;
+    int result;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.puzzle = puzzle;
+    pool.limit = limit;
+    pool.threads = threads;
+    pool.deques = (SplitDeque*)counted_malloc((size_t)threads * sizeof(SplitDeque));
+    workers = (SplitWorker*)counted_malloc((size_t)threads * sizeof(SplitWorker));
+    handles = (thread_handle*)counted_malloc((size_t)threads * sizeof(thread_handle));
+    root = (SplitTask*)counted_malloc(sizeof(SplitTask));
+
+    if (pool.deques != NULL)
+    {
+        memset(pool.deques, 0, (size_t)threads * sizeof(SplitDeque));
+        pool.deques[0].tasks = (SplitTask**)counted_malloc(sizeof(SplitTask*));
+    }
+
+    if (root != NULL)
+    {
+        memset(root, 0, sizeof(SplitTask));
+    }
+
+    if (pool.deques == NULL || workers == NULL || handles == NULL || root == NULL || pool.deques[0].tasks == NULL)
+    {
+        if (pool.deques != NULL)
+        {
+            free(pool.deques[0].tasks);
+        }
+
+        free(pool.deques);
+        free(workers);
+        free(handles);
+        free(root);
+        return -1;
+    }
+
+    /* корень перебора (пустой путь) — первое поддерево очереди потока 0 */
+    pool.deques[0].tasks[0] = root;
+    pool.deques[0].count = 1;
+    pool.deques[0].capacity = 1;
+
+    mutex_init(&pool.lock);
+    cond_init(&pool.work);
+    started = 0;
+
+    for (int i = 1; i < threads; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+
+        if (thread_create(&handles[started], split_worker, &workers[i]) != 0)
+        {
+            break;
+        }
+
+        started++;
+    }
+
+    split_run(&pool, 0);
+
+    for (int i = 0; i < started; i++)
+    {
+        thread_join(handles[i]);
+    }
+
+    /* выделения дополнительных потоков и их стеки (по одному на поток) видны в счётчике вызвавшего */
+    alloc_count += pool.allocs + started;
+    result = pool.solutions < limit ? pool.solutions : limit;
+
+    /* поддеревья, не перебранные из-за остановки или ошибки выделения памяти */
+    for (int i = 0; i < threads; i++)
+    {
+        SplitDeque* deque = &pool.deques[i];
+
+        if (deque->count > 0 && !pool.stop)
+        {
+            result = -1;
+        }
+
+        for (int k = deque->head; k < deque->head + deque->count; k++)
+        {
+            free(deque->tasks[k]);
+        }
+
+        free(deque->tasks);
+    }
+
+    cond_destroy(&pool.work);
+    mutex_destroy(&pool.lock);
+    free(pool.deques);
+    free(workers);
+    free(handles);
+
+    return result;
+}
+
+/**
+* Дополнительный поток параллельного подсчёта решений: со своей рабочей
+* областью перебирает поддеревья (split_run), а в конце добавляет свой
+* счётчик выделений памяти в pool->allocs
+* @param arg указатель на SplitWorker
+* @return THREAD_RETURN
+*/
+THREAD_FUNC split_worker(void* arg)
+{
+    SplitWorker* worker;
+
+    worker = (SplitWorker*)arg;
+    arena_reserve(&scratch, scratch_size(worker->pool->puzzle->rows, worker->pool->puzzle->cols));
+    split_run(worker->pool, worker->index);
+    arena_destroy(&scratch);
+
+    mutex_lock(&worker->pool->lock);
+    worker->pool->allocs += alloc_count;
+    mutex_unlock(&worker->pool->lock);
+
+    return THREAD_RETURN;
+}
+
+/**
+* Перебирает поддеревья параллельного подсчёта, пока они есть или пока
+* не поставлен флаг остановки. Для поддерева решатель откатывается к корню,
+* ограничения распространяются и решения пути принимаются в том же порядке,
+* что и в отдавшем его потоке, — состояние совпадает с состоянием в момент
+* ветвления. Поток ждёт работы, пока другие заняты: они могут отдать ему ветвь
+* @param pool общее состояние потоков
+* @param index номер потока (его очередь в pool->deques)
+* @return 0 при успехе, -1 при ошибке выделения памяти
+*/
+int split_run(SplitPool* pool, int index)
+{
+    Solver solver;
+    size_t mark = scratch.used;
+    int range;
+
+    if (solver_build(&solver, pool->puzzle) != 0)
+    {
+        arena_release(&scratch, mark);
+        return -1;
+    }
+
+    /* каждое решение пути сужает границу хотя бы на 1 */
+    range = 0;
+
+    for (int var = 0; var < solver.black_count * 4; var++)
+    {
+        range += solver.bounds[var * 2 + 1] - solver.bounds[var * 2];
+    }
+
+    solver.path_pos = (int*)arena_alloc(&scratch, (size_t)(range + 1) * sizeof(int));
+    solver.path_value = (short*)arena_alloc(&scratch, (size_t)(range + 1) * sizeof(short));
+
+    if (solver.path_pos == NULL || solver.path_value == NULL)
+    {
+        solver_free(&solver);
+        arena_release(&scratch, mark);
+        return -1;
+    }
+
+    solver.limit = pool->limit;
+    solver.pool = pool;
+    solver.worker = index;
+
+    mutex_lock(&pool->lock);
+
+    for (;;)
+    {
+        SplitTask* task = pool->stop ? NULL : split_take(pool, index);
+
+        if (task != NULL)
+        {
+            int is_alive;
+
+            pool->busy++;
+            mutex_unlock(&pool->lock);
+
+            solver_undo(&solver, 0);
+            solver.path_len = 0;
+            is_alive = solver_propagate(&solver);
+
+            for (int i = 0; is_alive && i < task->length; i++)
+            {
+                solver_decide(&solver, task->pos[i], task->value[i]);
+                is_alive = solver_propagate(&solver);
+            }
+
+            if (is_alive)
+            {
+                solver_search(&solver);
+            }
+
+            free(task);
+
+            mutex_lock(&pool->lock);
+            pool->busy--;
+
+            if (pool->busy == 0)
+            {
+                cond_broadcast(&pool->work);
+            }
+
+            continue;
+        }
+
+        /* очереди пусты: если никто не перебирает, новых поддеревьев не будет */
+        if (pool->stop || pool->busy == 0)
+        {
+            break;
+        }
+
+        pool->idle++;
+        cond_wait(&pool->work, &pool->lock);
+        pool->idle--;
+    }
+
+    cond_broadcast(&pool->work);
+    mutex_unlock(&pool->lock);
+
+    arena_free(&scratch, solver.path_pos);
+    arena_free(&scratch, solver.path_value);
+    solver_free(&solver);
+    arena_release(&scratch, mark);
+
+    return 0;
+}
+
+/**
+* Берёт поддерево для потока (под pool->lock): последнее из своей очереди,
+* а если она пуста — самое раннее из очереди другого потока
+* @param pool общее состояние потоков
+* @param index номер потока
+* @return поддерево (освобождает взявший) или NULL, если очереди пусты
+*/
+SplitTask* split_take(SplitPool* pool, int index)
+{
+    SplitDeque* own = &pool->deques[index];
+    SplitTask* task;
+
+    if (own->count > 0)
+    {
+        own->count--;
+        task = own->tasks[own->head + own->count];
+
+        if (own->count == 0)
+        {
+            own->head = 0;
+        }
 
-    field = (int**)malloc(rows * sizeof(int*));
-    if (field == NULL)
-    {
-        printf("Ошибка выделения памяти для поля\n");
-        return NULL;
+        return task;
     }
 
-    for (row_index = 0; row_index < rows; row_index++)
+    for (int k = 1; k < pool->threads; k++)
     {
-        field[row_index] = (int*)malloc(cols * sizeof(int));
-        if (field[row_index] == NULL)
+        SplitDeque* victim = &pool->deques[(index + k) % pool->threads];
+
+        if (victim->count > 0)
         {
-            printf("Ошибка выделения памяти для строки поля\n");
+            task = victim->tasks[victim->head];
+            victim->head++;
+            victim->count--;
 
-            for (col_index = 0; col_index < row_index; col_index++)
+            if (victim->count == 0)
             {
-                free(field[col_index]);
+                victim->head = 0;
             }
 
-            free(field);
-            return NULL;
-        }
-
-        for (col_index = 0; col_index < cols; col_index++)
-        {
-            field[row_index][col_index] = EMPTY;
+            return task;
         }
     }
 
-    return field;
+    return NULL;
 }
 
 /**
-* Освобождает память, выделенную под поле
-* @param field указатель на поле
-* @param rows количество строк (сколько строк освобождать)
-* @return 0
+* Откладывает вторую ветвь ветвления в очередь потока для ждущего работы потока:
+* путь к ней — текущий путь решателя и решение pos = value
+* @param solver состояние решателя
+* @param pos индекс границы второй ветви
+* @param value значение границы второй ветви
+* @return 1 если ветвь отложена, 0 если не хватило памяти (ветвь перебирается здесь же)
 */
-int free_field(int** field, int rows)
+int split_give(Solver* solver, int pos, int value)
 {
-    if (field == NULL)
+    SplitPool* pool = solver->pool;
+    SplitDeque* deque = &pool->deques[solver->worker];
+    SplitTask* task;
+    int length = solver->path_len + 1;
+
+    solver->is_hungry = 0;
+    task = (SplitTask*)counted_malloc(sizeof(SplitTask) + (size_t)length * (sizeof(int) + sizeof(short)));
+    if (task == NULL)
     {
         return 0;
     }
 
-    for (int i = 0; i < rows; i++)
+    task->length = length;
+    task->pos = (int*)(task + 1);
+    task->value = (short*)(task->pos + length);
+    memcpy(task->pos, solver->path_pos, (size_t)solver->path_len * sizeof(int));
+    memcpy(task->value, solver->path_value, (size_t)solver->path_len * sizeof(short));
+    task->pos[length - 1] = pos;
+    task->value[length - 1] = (short)value;
+
+    mutex_lock(&pool->lock);
+
+    if (deque->head > 0)
+    {
+        memmove(deque->tasks, deque->tasks + deque->head, (size_t)deque->count * sizeof(SplitTask*));
+        deque->head = 0;
+    }
+
+    if (deque->count == deque->capacity)
     {
-        if (field[i] != NULL)
+        int capacity = deque->capacity > 0 ? deque->capacity * 2 : 4;
+        SplitTask** tasks = (SplitTask**)counted_malloc((size_t)capacity * sizeof(SplitTask*));
+
+        if (tasks == NULL)
+        {
+            mutex_unlock(&pool->lock);
+            free(task);
+            return 0;
+        }
+
+        if (deque->count > 0)
         {
-            free(field[i]);
+            memcpy(tasks, deque->tasks, (size_t)deque->count * sizeof(SplitTask*));
         }
+
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
     }
 
-    free(field);
-    return 0;
-}
+    deque->tasks[deque->count++] = task;
+    cond_broadcast(&pool->work);
+    mutex_unlock(&pool->lock);
 
-/**
-* Проверяет, что координаты клетки находятся в пределах поля
-* @param x индекс строки
-* @param y индекс столбца
-* @param rows количество строк
-* @param cols количество столбцов
-* @return 1 если координаты корректны, 0 если выходят за границы
-*/
-int is_valid(int x, int y, int rows, int cols)
-{
-    return (x >= 0 && x < rows && y >= 0 && y < cols);
+    return 1;
 }
 
 /**
-* Проверяет, свободна ли клетка для продолжения линии
-* @param field игровое поле
-* @param x индекс строки
-* @param y индекс столбца
-* @param rows количество строк
-* @param cols количество столбцов
-* @return 1 если клетка валидна и EMPTY, иначе 0
+* Раз в SPLIT_POLL ветвлений сверяет решатель с общим состоянием потоков:
+* не пора ли остановиться и есть ли поток, которому нечего перебирать
+* (тогда очередная вторая ветвь отдаётся ему)
+* @param solver состояние решателя
+* @return 0
 */
-int is_cell_available_for_line(int** field, int x, int y, int rows, int cols)
+int split_poll(Solver* solver)
 {
-    if (!is_valid(x, y, rows, cols))
-    {
-        return 0;
-    }
+    SplitPool* pool = solver->pool;
 
-    if (field[x][y] == EMPTY)
-    {
-        return 1;
-    }
+    mutex_lock(&pool->lock);
+    solver->stop = pool->stop;
+    solver->is_hungry = pool->idle > 0 && pool->deques[solver->worker].count == 0;
+    mutex_unlock(&pool->lock);
 
     return 0;
 }
 
 /**
-* Проводит линию от чёрной клетки в заданном направлении по пустым клеткам
-* Длина линии выбирается случайно в пределах доступной длины
-* Клетки линии помечаются значением id
-* @param field игровое поле
-* @param x индекс строки стартовой (чёрной) клетки
-* @param y индекс столбца стартовой (чёрной) клетки
-* @param dir направление (dx, dy)
-* @param rows количество строк
-* @param cols количество столбцов
-* @param id идентификатор линии (число, которым помечаются клетки линии)
-* @return длина проведённой линии (количество закрашенных клеток), либо 0 если провести линию нельзя
+* Учитывает найденное решение в общем состоянии потоков; набрав limit
+* решений на всех, ставит флаг остановки и будит ждущие потоки
+* @param solver состояние решателя
+* @return 0
 */
-int draw_line(int** field, int x, int y, Direction dir, int rows, int cols, int id)
+int split_found(Solver* solver)
 {
-    int len;
-    int cx;
-    int cy;
-    int available_len;
-    int max_len;
-    
-    len = 0;
-
-    cx = x + dir.dx;
-    cy = y + dir.dy;
+    SplitPool* pool = solver->pool;
 
-    available_len = 0;
-
-    while (is_cell_available_for_line(field, cx, cy, rows, cols))
-    {
-        available_len++;
-        cx += dir.dx;
-        cy += dir.dy;
-    }
+    mutex_lock(&pool->lock);
+    pool->solutions++;
 
-    if (available_len == 0)
+    if (pool->solutions >= pool->limit)
     {
-        return 0;
+        pool->stop = 1;
+        cond_broadcast(&pool->work);
     }
 
-    max_len = 1 + rand() % available_len;
-
-    cx = x + dir.dx;
-    cy = y + dir.dy;
+    solver->stop = pool->stop;
+    mutex_unlock(&pool->lock);
 
-    for (int i = 0; i < max_len; i++)
-    {
-        field[cx][cy] = id;
-        len++;
-
-        cx += dir.dx;
-        cy += dir.dy;
-    }
-
-    return len;
+    return 0;
 }
 
 /**
-* Проверяет, что поле полностью покрыто (не осталось EMPTY клеток)
-* @param field игровое поле
+* Возвращает размер рабочей области для функций windrose.h с полем rows x cols:
+* память одной попытки (scratch_size) и запас на выравнивание
 * @param rows количество строк
 * @param cols количество столбцов
-* @return 1 если пустых клеток нет, 0 если есть хотя бы одна EMPTY
+* @return размер в байтах
 */
-int is_fully_covered(int** field, int rows, int cols)
+size_t windrose_workspace_size(int rows, int cols)
 {
-    for (int row_index = 0; row_index < rows; row_index++)
-    {
-        for (int col_index = 0; col_index < cols; col_index++)
-        {
-            if (field[row_index][col_index] == EMPTY)
-            {
-                return 0;
-            }
-        }
-    }
-
-    return 1;
+    return scratch_size(rows, cols) + ARENA_ALIGN;
 }
 
 /**
-* Генерирует одно игровое поле головоломки «Роза ветров»
-* 1) создаёт пустое поле
-* 2) размещает чёрные клетки
-* 3) пытается провести линии от каждой чёрной клетки
-* 4) проверяет покрытие поля
-* 5) преобразует поле в формат: WHITE (0) и числа в чёрных клетках
+* Возвращает размер буфера для windrose_serialize с полем rows x cols:
+* строка размеров и до 5 символов на клетку плюс '\n' на строку
+* и завершающий нуль
 * @param rows количество строк
 * @param cols количество столбцов
-* @return указатель на сгенерированное поле, либо NULL если генерация не удалась
+* @return размер в байтах
 */
-int** generate_puzzle(int rows, int cols)
+size_t windrose_text_size(int rows, int cols)
 {
-    Direction directions_local[4] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
-    int** puzzle;
-    int black_count;
-    int area;
-    Point* blacks;
-    int* lengths;
-    int placed;
-
-    puzzle = create_field(rows, cols);
-    if (puzzle == NULL)
-    {
-        return NULL;
-    }
-
-    black_count = 0;
-    area = rows * cols;
-
-    typedef struct
-    {
-        int field_area;
-        int blacks_count;
-        int amount_of_rand_numbers;
-    } BlackParams;
-
-    BlackParams black_params[] = {
-        {25,  3, 3},
-        {64,  9, 4},
-        {81,  15, 5},
-        {100, 36, 6},
-        {121, 45, 7},
-        {144, 56, 8}
-    };
-
-    int black_params_count = (int)(sizeof(black_params) / sizeof(black_params[0]));
-    int i = 0;
-
-    while (i < black_params_count && area > black_params[i].field_area)
-    {
-        i++;
-    }
+    return 24 + (size_t)rows * ((size_t)cols * 5 + 1) + 1;
+}
 
-    black_count = black_params[i].blacks_count + rand() % black_params[i].amount_of_rand_numbers;
+/**
+* Генерирует поле с единственным решением (встраиваемый интерфейс)
+* Перед каждой попыткой генератор инициализируется по
+* (seed, rows, cols, index, попытка) — как в пакетном режиме, поэтому поле
+* совпадает с полем index из --batch -s seed. Проверяется не больше
+* max_attempts попыток, начиная с first_attempt. Временная память берётся
+* только из workspace (на время вызова она становится рабочей областью потока)
+* @param rows количество строк (от WINDROSE_MIN_SIZE до WINDROSE_MAX_SIZE)
+* @param cols количество столбцов
+* @param engine способ генерации (WINDROSE_ENGINE_REJECTION или WINDROSE_ENGINE_CONSTRUCTIVE)
+* @param seed начальное значение
+* @param index номер поля
+* @param first_attempt номер первой попытки (от 1)
+* @param max_attempts сколько попыток проверить
+* @param workspace рабочая область
+* @param workspace_size размер рабочей области (не меньше windrose_workspace_size)
+* @param cells массив из rows * cols клеток для результата
+* @param attempt номер попытки, давшей поле
+* @return WINDROSE_OK, WINDROSE_ERROR_ARGUMENT при неверных размерах или способе,
+* WINDROSE_ERROR_BUFFER если рабочая область мала, WINDROSE_ERROR_ATTEMPTS если поле не найдено
+*/
+int windrose_generate(int rows, int cols, int engine, unsigned long long seed, long long index,
+    long long first_attempt, long long max_attempts, void* workspace, size_t workspace_size,
+    signed char* cells, long long* attempt)
+{
+    Arena saved;
+    Rng rng;
+    int is_tiled;
+    int result;
 
-    blacks = (Point*)malloc((size_t)black_count * sizeof(Point));
-    if (blacks == NULL)
+    if (rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE || rows > LARGE_MAX_SIZE || cols > LARGE_MAX_SIZE
+        || (engine != ENGINE_REJECTION && engine != ENGINE_CONSTRUCTIVE) || first_attempt <= 0)
     {
-        printf("Ошибка выделения памяти для черных клеток\n");
-        free_field(puzzle, rows);
-        return NULL;
+        return WINDROSE_ERROR_ARGUMENT;
     }
 
-    lengths = (int*)calloc((size_t)black_count, sizeof(int));
-    if (lengths == NULL)
+    if (workspace_size < windrose_workspace_size(rows, cols))
     {
-        printf("Ошибка выделения памяти для длин линий\n");
-        free(blacks);
-        free_field(puzzle, rows);
-        return NULL;
+        return WINDROSE_ERROR_BUFFER;
     }
 
-    placed = 0;
+    saved = scratch;
+    arena_attach(&scratch, workspace, workspace_size);
+    is_tiled = rows > MAX_FIELD_SIZE || cols > MAX_FIELD_SIZE;
+    result = WINDROSE_ERROR_ATTEMPTS;
 
-    while (placed < black_count)
+    for (long long k = 0; k < max_attempts && result != WINDROSE_OK; k++)
     {
-        int x;
-        int y;
-
-        x = rand() % rows;
-        y = rand() % cols;
+        Field* puzzle;
 
-        if (puzzle[x][y] == EMPTY)
-        {
-            puzzle[x][y] = BLACK;
-            blacks[placed].x = x;
-            blacks[placed].y = y;
-            placed++;
-        }
-    }
+        /* память прошлой попытки возвращается в арену */
+        arena_release(&scratch, 0);
+        rng_seed_puzzle(&rng, seed, rows, cols, index, first_attempt + k);
 
-    for (int i = 0; i < black_count; i++)
-    {
-        int dirs[4] = { 0, 1, 2, 3 };
-        int temp;
-        
-        for (int j = 0; j < 4; j++)
+        if (is_tiled)
         {
-            int k = rand() % 4;
-            temp = dirs[j];
-            dirs[j] = dirs[k];
-            dirs[k] = temp;
+            /* generate_tiled сам проверяет единственность решения всего поля */
+            puzzle = generate_tiled(rows, cols, engine, &rng);
         }
-
-        for (int d = 0; d < 4; d++)
+        else
         {
-            Direction dir;
-            int line_len;
+            puzzle = generate_field(rows, cols, engine, &rng);
 
-            dir = directions_local[dirs[d]];
-            line_len = draw_line(puzzle, blacks[i].x, blacks[i].y, dir, rows, cols, i + 1);
-            lengths[i] += line_len;
+            if (puzzle != NULL && !is_solvable(puzzle))
+            {
+                free_field(puzzle);
+                puzzle = NULL;
+            }
         }
 
-        if (lengths[i] <= 0)
+        if (puzzle != NULL)
         {
-            free(blacks);
-            free(lengths);
-            free_field(puzzle, rows);
-            return NULL;
+            field_to_cells(puzzle, cells);
+            free_field(puzzle);
+            *attempt = first_attempt + k;
+            result = WINDROSE_OK;
         }
     }
 
-    if (!is_fully_covered(puzzle, rows, cols))
-    {
-        free(blacks);
-        free(lengths);
-        free_field(puzzle, rows);
-        return NULL;
-    }
-
-    for (int i = 0; i < rows; i++)
-    {
-        for (int j = 0; j < cols; j++)
-        {
-            if (puzzle[i][j] == BLACK)
-            {
-                for (int k = 0; k < black_count; k++)
-                {
-                    if (blacks[k].x == i && blacks[k].y == j)
-                    {
-                        puzzle[i][j] = lengths[k];
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                puzzle[i][j] = WHITE;
-            }
-        }
-    }
+    scratch = saved;
 
-    free(blacks);
-    free(lengths);
+    return result;
+}
 
-    return puzzle;
+/**
+* Подсчитывает решения поля, но не больше двух (встраиваемый интерфейс)
+* @param rows количество строк
+* @param cols количество столбцов
+* @param cells rows * cols клеток поля
+* @param workspace рабочая область
+* @param workspace_size размер рабочей области (не меньше windrose_workspace_size)
+* @return 0 — решений нет, 1 — решение единственно, 2 — решений несколько;
+* WINDROSE_ERROR_ARGUMENT, WINDROSE_ERROR_BUFFER или WINDROSE_ERROR_FORMAT при ошибке
+*/
+int windrose_validate(int rows, int cols, const signed char* cells, void* workspace, size_t workspace_size)
+{
+    return windrose_solve(rows, cols, cells, workspace, workspace_size, NULL);
 }
 
 /**
-* Выводит игровое поле в консоль в виде ASCII-таблицы
-* WHITE выводится как пустая клетка, числа выводятся в чёрных клетках
-* @param field игровое поле
+* Решает поле (встраиваемый интерфейс). Для каждой чёрной клетки по порядку
+* строк в rays записываются длины четырёх лучей первого найденного решения:
+* вверх, вниз, влево, вправо (4 байта на чёрную клетку)
 * @param rows количество строк
 * @param cols количество столбцов
-* @return 0
+* @param cells rows * cols клеток поля
+* @param workspace рабочая область
+* @param workspace_size размер рабочей области (не меньше windrose_workspace_size)
+* @param rays массив длин лучей, либо NULL, если нужно только число решений
+* @return 0 — решений нет, 1 — решение единственно, 2 — решений несколько
+* (в rays первое из них); WINDROSE_ERROR_ARGUMENT, WINDROSE_ERROR_BUFFER
+* или WINDROSE_ERROR_FORMAT при ошибке
 */
-int print_field(int** field, int rows, int cols)
+int windrose_solve(int rows, int cols, const signed char* cells, void* workspace, size_t workspace_size,
+    unsigned char* rays)
 {
-    printf("+");
-    for (int j = 0; j < cols; j++)
+    Arena saved;
+    Solver solver;
+    Field* field;
+    int result;
+
+    if (rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE || rows > LARGE_MAX_SIZE || cols > LARGE_MAX_SIZE)
     {
-        printf("-----+");
+        return WINDROSE_ERROR_ARGUMENT;
     }
-    printf("\n");
 
-    for (int i = 0; i < rows; i++)
+    if (workspace_size < windrose_workspace_size(rows, cols))
     {
-        printf("|");
-        for (int j = 0; j < cols; j++)
-        {
-            if (field[i][j] == WHITE)
-            {
-                printf("     |");
-            }
-            else
-            {
-                printf(" %2d  |", field[i][j]);
-            }
-        }
-        printf("\n");
+        return WINDROSE_ERROR_BUFFER;
+    }
 
-        printf("+");
-        for (int j = 0; j < cols; j++)
-        {
-            printf("-----+");
-        }
-        printf("\n");
+    saved = scratch;
+    arena_attach(&scratch, workspace, workspace_size);
+    field = create_scratch_field(rows, cols);
+
+    if (field == NULL || field_from_cells(field, cells) != 0)
+    {
+        result = field == NULL ? WINDROSE_ERROR_BUFFER : WINDROSE_ERROR_FORMAT;
+    }
+    else if (solver_build(&solver, field) != 0)
+    {
+        result = WINDROSE_ERROR_BUFFER;
+    }
+    else
+    {
+        solver.limit = SOLUTION_LIMIT;
+        solver.solution = rays;
+        solver_search(&solver);
+        solver_free(&solver);
+        result = solver.solutions;
     }
 
-    return 0;
+    free_field(field);
+    scratch = saved;
+
+    return result;
 }
 
 /**
-* Сохраняет поле в текстовый файл
-* Формат: первая строка "rows cols", далее rows строк по cols чисел
-* @param field игровое поле
+* Оценивает сложность поля логическими правилами (rate_field, встраиваемый интерфейс)
 * @param rows количество строк
 * @param cols количество столбцов
-* @param filename имя файла
-* @return 0 при успешном сохранении, -4 если файл открыть не удалось
+* @param cells rows * cols клеток поля с единственным решением
+* @param workspace рабочая область
+* @param workspace_size размер рабочей области (не меньше windrose_workspace_size)
+* @param score очки сложности (больше — сложнее)
+* @return уровень сложности от WINDROSE_TIER_EASY до WINDROSE_TIER_GUESS;
+* WINDROSE_ERROR_ARGUMENT, WINDROSE_ERROR_BUFFER или WINDROSE_ERROR_FORMAT при ошибке
 */
-int save_to_file(int** field, int rows, int cols, char* filename)
+int windrose_rate(int rows, int cols, const signed char* cells, void* workspace, size_t workspace_size,
+    long long* score)
 {
-    FILE* file;
+    Arena saved;
+    Rating rating;
+    Field* field;
+    int result;
 
-    file = fopen(filename, "w");
-    if (file == NULL)
+    if (rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE || rows > LARGE_MAX_SIZE || cols > LARGE_MAX_SIZE)
     {
-        printf("Ошибка открытия файла!\n");
-        return -4;
+        return WINDROSE_ERROR_ARGUMENT;
     }
 
-    fprintf(file, "%d %d\n", rows, cols);
+    if (workspace_size < windrose_workspace_size(rows, cols))
+    {
+        return WINDROSE_ERROR_BUFFER;
+    }
 
-    for (int i = 0; i < rows; i++)
+    saved = scratch;
+    arena_attach(&scratch, workspace, workspace_size);
+    field = create_scratch_field(rows, cols);
+
+    if (field == NULL || field_from_cells(field, cells) != 0)
     {
-        for (int j = 0; j < cols; j++)
-        {
-            fprintf(file, "%d ", field[i][j]);
-        }
-        fprintf(file, "\n");
+        result = field == NULL ? WINDROSE_ERROR_BUFFER : WINDROSE_ERROR_FORMAT;
+    }
+    else if (rate_field(field, &rating) != 0)
+    {
+        result = WINDROSE_ERROR_BUFFER;
+    }
+    else
+    {
+        *score = rating.score;
+        result = rating.tier;
     }
 
-    fclose(file);
+    free_field(field);
+    scratch = saved;
 
-    printf("Поле сохранено в %s\n", filename);
-    return 0;
+    return result;
 }
 
 /**
-* Выполняет проверку верности поля
-* Проверка: сумма чисел в чёрных клетках равна количеству белых клеток (WHITE)
-* @param puzzle игровое поле
+* Записывает поле в буфер в текстовом формате write_field (встраиваемый интерфейс)
 * @param rows количество строк
 * @param cols количество столбцов
-* @return 1 если проверка пройдена, 0 если проверка не пройдена
+* @param cells rows * cols клеток поля
+* @param buffer буфер для текста (с завершающим нулём)
+* @param size размер буфера (не меньше windrose_text_size)
+* @param length длина записанного текста без завершающего нуля
+* @return WINDROSE_OK, WINDROSE_ERROR_ARGUMENT при неверных размерах,
+* WINDROSE_ERROR_BUFFER если буфер мал
 */
-int is_solvable(int** puzzle, int rows, int cols)
+int windrose_serialize(int rows, int cols, const signed char* cells, char* buffer, size_t size, size_t* length)
 {
-    int total_white;
-    int total_black_numbers;
+    size_t used;
 
-    total_white = 0;
-    total_black_numbers = 0;
+    if (rows < MIN_FIELD_SIZE || cols < MIN_FIELD_SIZE || rows > LARGE_MAX_SIZE || cols > LARGE_MAX_SIZE)
+    {
+        return WINDROSE_ERROR_ARGUMENT;
+    }
 
-    for (int i = 0; i < rows; i++)
+    if (size < windrose_text_size(rows, cols))
     {
-        for (int j = 0; j < cols; j++)
-        {
-            if (puzzle[i][j] == WHITE)
-            {
-                total_white++;
-            }
-            else if (puzzle[i][j] > 0)
-            {
-                total_black_numbers += puzzle[i][j];
-            }
-        }
+        return WINDROSE_ERROR_BUFFER;
     }
 
-    if (total_black_numbers == total_white)
+    used = (size_t)sprintf(buffer, "%d %d\n", rows, cols);
+
+    for (int i = 0; i < rows; i++)
     {
-        return 1;
+        used += (size_t)format_row(buffer + used, &cells[i * cols], cols);
     }
 
-    return 0;
+    buffer[used] = '\0';
+    *length = used;
+
+    return WINDROSE_OK;
 }
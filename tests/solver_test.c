@@ -0,0 +1,264 @@
+/*
+* Проверка точного решателя: число решений count_solutions сравнивается
+* с полным перебором на случайных полях от 4 x 4 до 6 x 6 с постоянными seed.
+* Тот же подсчёт повторяется параллельно (split_threads > 1 и count_solutions_split).
+* Исходный файл программы подключается целиком (без main), поэтому тест
+* видит внутренние функции решателя. Цель solver_test в CMakeLists.txt, запуск — ctest
+*/
+#define WINDROSE_LIBRARY
+#include "../2Souce.c"
+
+#define TEST_BOARDS 640
+#define TEST_SEED 20240601
+#define TEST_LIMIT 64
+#define TEST_THREADS 4
+#define TEST_MIN_SIZE 4
+#define TEST_MAX_SIZE 6
+
+int brute_count(Field* puzzle, int limit);
+int brute_search(Field* puzzle, Point* blacks, int black_count, int k, char* covered, int limit);
+int brute_ray(Field* puzzle, char* covered, int x, int y, int dir, int len, int mark);
+Field* test_board(Rng* rng);
+
+/**
+* Проверяет решатель на TEST_BOARDS полях
+* @return 0 если все подсчёты совпали с перебором, 1 при расхождении
+*/
+int main()
+{
+    long long counts[3] = { 0, 0, 0 };
+
+    arena_reserve(&scratch, scratch_size(TEST_MAX_SIZE, TEST_MAX_SIZE));
+
+    for (int i = 0; i < TEST_BOARDS; i++)
+    {
+        Rng rng;
+        Field* puzzle;
+        int expected;
+        int serial;
+        int split;
+        int direct;
+
+        rng_seed(&rng, (unsigned long long)TEST_SEED + (unsigned long long)i);
+        puzzle = test_board(&rng);
+
+        if (puzzle == NULL)
+        {
+            printf("Ошибка выделения памяти\n");
+            return 1;
+        }
+
+        expected = brute_count(puzzle, TEST_LIMIT);
+
+        split_threads = 1;
+        serial = count_solutions(puzzle, TEST_LIMIT);
+        split_threads = TEST_THREADS;
+        split = count_solutions(puzzle, TEST_LIMIT);
+        split_threads = 1;
+        direct = count_solutions_split(puzzle, TEST_LIMIT, TEST_THREADS);
+
+        if (serial != expected || split != expected || direct != expected)
+        {
+            printf("Поле %d: перебор %d, count_solutions %d, с split_threads %d, count_solutions_split %d\n",
+                i, expected, serial, split, direct);
+            write_field(stdout, puzzle);
+            free_field(puzzle);
+            return 1;
+        }
+
+        counts[expected > 2 ? 2 : expected]++;
+        free_field(puzzle);
+    }
+
+    printf("Проверено полей: %d (нет решения: %lld, одно: %lld, несколько: %lld)\n",
+        TEST_BOARDS, counts[0], counts[1], counts[2]);
+    arena_destroy(&scratch);
+
+    return 0;
+}
+
+/**
+* Строит случайное поле: покрытое линиями поле generate_puzzle (у него есть
+* хотя бы одно решение), в трети полей число одной чёрной клетки изменено
+* на 1 — у таких полей решений часто нет или несколько
+* @param rng генератор случайных чисел
+* @return поле (освобождает вызывающий) или NULL при ошибке выделения памяти
+*/
+Field* test_board(Rng* rng)
+{
+    Field* puzzle;
+    int rows;
+    int cols;
+
+    rows = TEST_MIN_SIZE + rng_range(rng, TEST_MAX_SIZE - TEST_MIN_SIZE + 1);
+    cols = TEST_MIN_SIZE + rng_range(rng, TEST_MAX_SIZE - TEST_MIN_SIZE + 1);
+    puzzle = create_field(rows, cols);
+
+    if (puzzle == NULL)
+    {
+        return NULL;
+    }
+
+    for (;;)
+    {
+        size_t mark = scratch.used;
+        Field* candidate = generate_puzzle(rows, cols, 2 + rng_range(rng, rows * cols / 4), rng);
+
+        if (candidate != NULL)
+        {
+            copy_field(puzzle, candidate);
+            arena_release(&scratch, mark);
+            break;
+        }
+
+        arena_release(&scratch, mark);
+    }
+
+    if (rng_range(rng, 3) == 0)
+    {
+        int x;
+        int y;
+
+        do
+        {
+            x = rng_range(rng, rows);
+            y = rng_range(rng, cols);
+        } while (FIELD_AT(puzzle, x, y) == WHITE);
+
+        FIELD_AT(puzzle, x, y) = (Cell)(FIELD_AT(puzzle, x, y) + (rng_range(rng, 2) == 0 && FIELD_AT(puzzle, x, y) > 1 ? -1 : 1));
+    }
+
+    return puzzle;
+}
+
+/**
+* Считает решения поля полным перебором, независимо от решателя: для каждой
+* чёрной клетки по очереди перебираются все разбиения её числа на четыре луча,
+* лучи не должны пересекаться, в конце все белые клетки должны быть покрыты
+* @param puzzle игровое поле
+* @param limit после скольких решений прекратить перебор
+* @return количество решений (не больше limit)
+*/
+int brute_count(Field* puzzle, int limit)
+{
+    Point blacks[TEST_MAX_SIZE * TEST_MAX_SIZE];
+    char covered[TEST_MAX_SIZE * TEST_MAX_SIZE];
+    int black_count = 0;
+
+    for (int i = 0; i < puzzle->rows; i++)
+    {
+        for (int j = 0; j < puzzle->cols; j++)
+        {
+            covered[i * puzzle->cols + j] = FIELD_AT(puzzle, i, j) != WHITE;
+
+            if (FIELD_AT(puzzle, i, j) != WHITE)
+            {
+                blacks[black_count].x = i;
+                blacks[black_count].y = j;
+                black_count++;
+            }
+        }
+    }
+
+    return brute_search(puzzle, blacks, black_count, 0, covered, limit);
+}
+
+/**
+* Перебирает лучи чёрных клеток начиная с k-й
+* @param puzzle игровое поле
+* @param blacks координаты чёрных клеток
+* @param black_count количество чёрных клеток
+* @param k номер очередной чёрной клетки
+* @param covered занятые клетки (чёрные и покрытые лучами)
+* @param limit после скольких решений прекратить перебор
+* @return количество решений (не больше limit)
+*/
+int brute_search(Field* puzzle, Point* blacks, int black_count, int k, char* covered, int limit)
+{
+    int clue;
+    int found = 0;
+
+    if (k == black_count)
+    {
+        for (int i = 0; i < puzzle->rows * puzzle->cols; i++)
+        {
+            if (!covered[i])
+            {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    clue = FIELD_AT(puzzle, blacks[k].x, blacks[k].y);
+
+    for (int up = 0; up <= clue && found < limit; up++)
+    {
+        for (int down = 0; up + down <= clue && found < limit; down++)
+        {
+            for (int left = 0; up + down + left <= clue && found < limit; left++)
+            {
+                int len[4] = { up, down, left, clue - up - down - left };
+                int dir;
+
+                for (dir = 0; dir < 4; dir++)
+                {
+                    if (brute_ray(puzzle, covered, blacks[k].x, blacks[k].y, dir, len[dir], 1) != len[dir])
+                    {
+                        break;
+                    }
+                }
+
+                if (dir == 4)
+                {
+                    found += brute_search(puzzle, blacks, black_count, k + 1, covered, limit - found);
+                }
+
+                /* снимаются только лучи, которые удалось провести */
+                while (dir-- > 0)
+                {
+                    brute_ray(puzzle, covered, blacks[k].x, blacks[k].y, dir, len[dir], 0);
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+/**
+* Занимает (mark == 1) или освобождает (mark == 0) клетки луча длины len
+* от чёрной клетки (x, y) в направлении dir (вверх, вниз, влево, вправо).
+* При занятии луч останавливается на границе поля или занятой клетке,
+* и его уже занятая часть освобождается
+* @param puzzle игровое поле
+* @param covered занятые клетки
+* @param x строка чёрной клетки
+* @param y столбец чёрной клетки
+* @param dir направление
+* @param len длина луча
+* @param mark 1 — занять, 0 — освободить
+* @return len, если луч проведён (или освобождён), иначе -1
+*/
+int brute_ray(Field* puzzle, char* covered, int x, int y, int dir, int len, int mark)
+{
+    static const int dx[4] = { -1, 1, 0, 0 };
+    static const int dy[4] = { 0, 0, -1, 1 };
+
+    for (int step = 1; step <= len; step++)
+    {
+        int i = x + dx[dir] * step;
+        int j = y + dy[dir] * step;
+
+        if (mark && (i < 0 || j < 0 || i >= puzzle->rows || j >= puzzle->cols || covered[i * puzzle->cols + j]))
+        {
+            brute_ray(puzzle, covered, x, y, dir, step - 1, 0);
+            return -1;
+        }
+
+        covered[i * puzzle->cols + j] = (char)mark;
+    }
+
+    return len;
+}
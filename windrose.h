@@ -0,0 +1,57 @@
+﻿#ifndef WINDROSE_H
+#define WINDROSE_H
+
+/*
+* Встраиваемый интерфейс генератора полей «Роза ветров»
+* Функции не выводят сообщений, не выделяют память и не используют общих
+* изменяемых данных: временная память берётся из рабочей области, которую
+* передаёт вызывающий (не меньше windrose_workspace_size байт), поэтому
+* функции можно вызывать одновременно из разных потоков, каждый со своей
+* рабочей областью. Поле передаётся построчно массивом rows * cols клеток:
+* 0 — белая клетка, число больше 0 — чёрная клетка с этим числом
+*/
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Коды результата (отрицательные — ошибки) */
+#define WINDROSE_OK 0
+#define WINDROSE_ERROR_ARGUMENT -1
+#define WINDROSE_ERROR_BUFFER -2
+#define WINDROSE_ERROR_ATTEMPTS -3
+#define WINDROSE_ERROR_FORMAT -4
+
+/* Способ генерации (как ключ -e пакетного режима) */
+#define WINDROSE_ENGINE_REJECTION 0
+#define WINDROSE_ENGINE_CONSTRUCTIVE 1
+
+/* Уровни сложности поля (windrose_rate) */
+#define WINDROSE_TIER_EASY 1
+#define WINDROSE_TIER_MEDIUM 2
+#define WINDROSE_TIER_HARD 3
+#define WINDROSE_TIER_GUESS 4
+
+/* Допустимые размеры поля */
+#define WINDROSE_MIN_SIZE 3
+#define WINDROSE_MAX_SIZE 500
+
+size_t windrose_workspace_size(int rows, int cols);
+size_t windrose_text_size(int rows, int cols);
+int windrose_generate(int rows, int cols, int engine, unsigned long long seed, long long index,
+    long long first_attempt, long long max_attempts, void* workspace, size_t workspace_size,
+    signed char* cells, long long* attempt);
+int windrose_validate(int rows, int cols, const signed char* cells, void* workspace, size_t workspace_size);
+int windrose_solve(int rows, int cols, const signed char* cells, void* workspace, size_t workspace_size,
+    unsigned char* rays);
+int windrose_rate(int rows, int cols, const signed char* cells, void* workspace, size_t workspace_size,
+    long long* score);
+int windrose_serialize(int rows, int cols, const signed char* cells, char* buffer, size_t size, size_t* length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif